@@ -9,10 +9,16 @@ BitGen_ANALYZER::BitGen_ANALYZER(const std::string& filepath,
   CFG_ASSERT(m_file->good());
   CFG_ASSERT(m_aes_key == nullptr || m_aes_key->size() == 16 ||
              m_aes_key->size() == 32);
+  if (m_aes_key != nullptr) {
+    m_ctr = CFG_MEM_NEW(CFGOpenSSL_CTR, m_aes_key->data(), m_aes_key->size());
+  }
 }
 
 BitGen_ANALYZER::~BitGen_ANALYZER() {
   memset(m_decompressed_data, 0, sizeof(m_decompressed_data));
+  if (m_ctr != nullptr) {
+    CFG_MEM_DELETE(m_ctr);
+  }
 }
 
 template <typename T>
@@ -586,10 +592,9 @@ void BitGen_ANALYZER::challenge(std::string space,
       if ((m_header.encryption == "ctr128" && m_aes_key->size() == 16) ||
           (m_header.encryption == "ctr256" && m_aes_key->size() == 32)) {
         uint8_t plain_data[64] = {0};
-        CFGOpenSSL::ctr_decrypt(&m_current_bop_data[0x240], plain_data,
-                                sizeof(plain_data), m_aes_key->data(),
-                                m_aes_key->size(), m_header.iv,
-                                sizeof(m_header.iv));
+        m_ctr->set_iv(m_header.iv, sizeof(m_header.iv));
+        m_ctr->update(&m_current_bop_data[0x240], plain_data,
+                      sizeof(plain_data));
         update_iv(m_header.iv);
         uint32_t challenge_crc32 =
             get_u32(&plain_data[sizeof(plain_data) - sizeof(challenge_crc32)]);
@@ -899,8 +904,9 @@ void BitGen_ANALYZER::parse_payload(std::string space, const uint8_t* data,
     (*m_file) << CFG_convert_bytes_to_hex_string(iv, 16).c_str();
     (*m_file) << ")";
     (*m_file) << "\n";
-    CFGOpenSSL::ctr_decrypt(data, plain_data, size, m_aes_key->data(),
-                            m_aes_key->size(), iv, 16, iv);
+    m_ctr->set_iv(iv, 16);
+    m_ctr->update(data, plain_data, size);
+    m_ctr->get_iv(iv);
   }
   (*m_file) << space.c_str() << "Block: Payload\n";
   (*m_file) << space.c_str() << print_repeat_word_line("-", 100).c_str()
@@ -162,6 +162,8 @@ class BitGen_ANALYZER {
   std::string m_filepath = "";
   std::ofstream* m_file = nullptr;
   std::vector<uint8_t>* m_aes_key = nullptr;
+  // Key is expanded once, each decryption only sets the IV
+  CFGOpenSSL_CTR* m_ctr = nullptr;
   const uint8_t* m_current_bop_data = nullptr;
   size_t m_current_bop_data_index = 0;
   size_t m_current_bop_size = 0;
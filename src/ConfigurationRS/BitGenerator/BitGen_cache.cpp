@@ -0,0 +1,215 @@
+#include "BitGen_cache.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+#include "CFGCrypto/CFGOpenSSL.h"
+
+#define BitGen_CACHE_MAGIC "BITGEN_CACHE"
+#define BitGen_CACHE_MAGIC_SIZE (sizeof(BitGen_CACHE_MAGIC) - 1)
+#define BitGen_CACHE_SHA_SIZE (32)
+// Magic, SHA-256 of the rest of the entry, version, data size and whether
+// the data is compressed
+#define BitGen_CACHE_HEADER_SIZE \
+  (BitGen_CACHE_MAGIC_SIZE + BitGen_CACHE_SHA_SIZE + 4 + 8 + 1)
+#define BitGen_CACHE_EXTENSION ".cache"
+
+BitGen_CACHE::BitGen_CACHE(const std::string& directory, uint64_t max_size)
+    : m_directory(directory), m_max_size(max_size) {
+  CFG_ASSERT(m_directory.size());
+  std::error_code ec;
+  std::filesystem::create_directories(m_directory, ec);
+  for (auto& entry : std::filesystem::directory_iterator(m_directory, ec)) {
+    if (entry.path().extension() == BitGen_CACHE_EXTENSION) {
+      m_size += entry.file_size(ec);
+    }
+  }
+}
+
+std::string BitGen_CACHE::get_payload_key(const uint8_t* payload,
+                                          size_t payload_size, bool compress,
+                                          CFG_COMPRESS_LEVEL compress_level) {
+  CFG_ASSERT(payload != nullptr && payload_size > 0);
+  std::vector<uint8_t> data(32);
+  CFGOpenSSL::sha_256(payload, payload_size, &data[0]);
+  CFG_append_u32(data, BitGen_CACHE_VERSION);
+  CFG_append_u32(data, compress ? (uint32_t)(compress_level) : 0xFFFFFFFF);
+  CFG_append_u64(data, (uint64_t)(payload_size));
+  return get_key(data);
+}
+
+std::string BitGen_CACHE::get_encrypted_key(const std::string& payload_key,
+                                            const std::vector<uint8_t>& aes_key,
+                                            const uint8_t* iv) {
+  CFG_ASSERT(payload_key.size());
+  CFG_ASSERT(aes_key.size() == 16 || aes_key.size() == 32);
+  CFG_ASSERT(iv != nullptr);
+  std::vector<uint8_t> data(payload_key.begin(), payload_key.end());
+  data.insert(data.end(), aes_key.begin(), aes_key.end());
+  data.insert(data.end(), iv, iv + 16);
+  std::string key = get_key(data);
+  memset(&data[0], 0, data.size());
+  return key;
+}
+
+bool BitGen_CACHE::get(const std::string& key, bool& compressed,
+                       BitGen_BITSTREAM_ARENA& arena,
+                       std::vector<BitGen_BITSTREAM_BLOCK*>& blocks,
+                       size_t& size) {
+  CFG_ASSERT(blocks.empty());
+  size_t block_count = arena.get_block_count();
+  std::string filepath = get_filepath(key);
+  std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+  bool status = false;
+  if (file.is_open()) {
+    size_t file_size = (size_t)(file.tellg());
+    if (file_size >= BitGen_CACHE_HEADER_SIZE) {
+      std::vector<uint8_t> entry(file_size);
+      file.seekg(0);
+      file.read((char*)(&entry[0]), entry.size());
+      size_t index = BitGen_CACHE_MAGIC_SIZE + BitGen_CACHE_SHA_SIZE;
+      uint8_t sha[BitGen_CACHE_SHA_SIZE];
+      CFGOpenSSL::sha_256(&entry[index], entry.size() - index, sha);
+      uint32_t version = 0;
+      uint64_t data_size = 0;
+      memcpy(&version, &entry[index], sizeof(version));
+      memcpy(&data_size, &entry[index + 4], sizeof(data_size));
+      if (file.good() &&
+          memcmp(&entry[0], BitGen_CACHE_MAGIC, BitGen_CACHE_MAGIC_SIZE) ==
+              0 &&
+          memcmp(&entry[BitGen_CACHE_MAGIC_SIZE], sha, sizeof(sha)) == 0 &&
+          version == BitGen_CACHE_VERSION &&
+          data_size == (file_size - BitGen_CACHE_HEADER_SIZE)) {
+        compressed = entry[BitGen_CACHE_HEADER_SIZE - 1] != 0;
+        size = (size_t)(data_size);
+        for (index = 0; index < size; index += BitGen_BITSTREAM_BLOCK_SIZE) {
+          blocks.push_back(arena.add_block(BitGen_BITSTREAM_DATA_BLOCK));
+          memcpy(blocks.back()->data(),
+                 &entry[BitGen_CACHE_HEADER_SIZE + index],
+                 std::min(size - index, (size_t)(BitGen_BITSTREAM_BLOCK_SIZE)));
+        }
+        status = true;
+      }
+    }
+    file.close();
+  }
+  if (status) {
+    // Most recently used
+    std::error_code ec;
+    std::filesystem::last_write_time(
+        filepath, std::filesystem::file_time_type::clock::now(), ec);
+  } else {
+    arena.truncate(block_count);
+    blocks.clear();
+    size = 0;
+  }
+  return status;
+}
+
+void BitGen_CACHE::put(const std::string& key, bool compressed,
+                       const std::vector<BitGen_BITSTREAM_BLOCK*>& blocks,
+                       size_t size) {
+  CFG_ASSERT(size <= (blocks.size() * BitGen_BITSTREAM_BLOCK_SIZE));
+  uint64_t file_size = BitGen_CACHE_HEADER_SIZE + size;
+  if (file_size > m_max_size) {
+    return;
+  }
+  std::vector<uint8_t> entry(BitGen_CACHE_MAGIC,
+                             BitGen_CACHE_MAGIC + BitGen_CACHE_MAGIC_SIZE);
+  entry.resize(BitGen_CACHE_MAGIC_SIZE + BitGen_CACHE_SHA_SIZE);
+  CFG_append_u32(entry, BitGen_CACHE_VERSION);
+  CFG_append_u64(entry, (uint64_t)(size));
+  CFG_append_u8(entry, compressed ? 1 : 0);
+  CFG_ASSERT(entry.size() == BitGen_CACHE_HEADER_SIZE);
+  entry.resize(BitGen_CACHE_HEADER_SIZE + size);
+  for (size_t index = 0; index < size; index += BitGen_BITSTREAM_BLOCK_SIZE) {
+    memcpy(&entry[BitGen_CACHE_HEADER_SIZE + index],
+           blocks[index / BitGen_BITSTREAM_BLOCK_SIZE]->data(),
+           std::min(size - index, (size_t)(BitGen_BITSTREAM_BLOCK_SIZE)));
+  }
+  size_t index = BitGen_CACHE_MAGIC_SIZE + BitGen_CACHE_SHA_SIZE;
+  CFGOpenSSL::sha_256(&entry[index], entry.size() - index,
+                      &entry[BitGen_CACHE_MAGIC_SIZE]);
+  std::lock_guard<std::mutex> lock(m_mutex);
+  // Write to a temporary file first, an entry is either complete or missing
+  std::string filepath = get_filepath(key);
+  std::string temp_filepath = filepath + ".tmp";
+  std::ofstream file(temp_filepath, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return;
+  }
+  file.write((const char*)(&entry[0]), entry.size());
+  bool status = file.good();
+  file.close();
+  std::error_code ec;
+  if (status) {
+    uint64_t old_size = 0;
+    if (std::filesystem::exists(filepath, ec)) {
+      old_size = std::filesystem::file_size(filepath, ec);
+    }
+    std::filesystem::rename(temp_filepath, filepath, ec);
+    if (!ec) {
+      m_size = m_size - std::min(m_size, old_size) + file_size;
+      if (m_size > m_max_size) {
+        evict();
+      }
+      return;
+    }
+  }
+  std::filesystem::remove(temp_filepath, ec);
+}
+
+void BitGen_CACHE::count(bool hit) {
+  if (hit) {
+    m_hit++;
+  } else {
+    m_miss++;
+  }
+}
+
+std::string BitGen_CACHE::get_report() const {
+  return CFG_print("BITGEN cache: %ld hit(s), %ld miss(es)", (size_t)(m_hit),
+                   (size_t)(m_miss));
+}
+
+std::string BitGen_CACHE::get_key(const std::vector<uint8_t>& data) {
+  CFG_ASSERT(data.size());
+  uint8_t sha[32];
+  CFGOpenSSL::sha_256(&data[0], data.size(), sha);
+  std::string key = CFG_convert_bytes_to_hex_string(sha, sizeof(sha));
+  memset(sha, 0, sizeof(sha));
+  return key;
+}
+
+std::string BitGen_CACHE::get_filepath(const std::string& key) {
+  CFG_ASSERT(key.size());
+  return (std::filesystem::path(m_directory) / (key + BitGen_CACHE_EXTENSION))
+      .string();
+}
+
+void BitGen_CACHE::evict() {
+  // Remove the least recently used entries until it is within the limit
+  std::vector<std::pair<std::filesystem::file_time_type,
+                        std::pair<std::string, uint64_t>>>
+      entries;
+  std::error_code ec;
+  m_size = 0;
+  for (auto& entry : std::filesystem::directory_iterator(m_directory, ec)) {
+    if (entry.path().extension() == BitGen_CACHE_EXTENSION) {
+      uint64_t size = entry.file_size(ec);
+      entries.push_back(
+          {entry.last_write_time(ec), {entry.path().string(), size}});
+      m_size += size;
+    }
+  }
+  std::sort(entries.begin(), entries.end());
+  for (auto& entry : entries) {
+    if (m_size <= m_max_size) {
+      break;
+    }
+    if (std::filesystem::remove(entry.second.first, ec)) {
+      m_size -= entry.second.second;
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef BITGEN_CACHE_H
+#define BITGEN_CACHE_H
+
+#include <atomic>
+#include <mutex>
+
+#include "BitGen_packer.h"
+
+// Bump whenever the compressor, the encryption or the entry format changes,
+// so that entries written by older tool are never reused
+#define BitGen_CACHE_VERSION (2)
+
+// On-disk cache of compressed and encrypted action payloads, so that the
+// unchanged actions of a re-generated bitstream are not compressed and
+// encrypted again. Entries are addressed by the SHA-256 of everything that
+// decides their content:
+//   - payload entry: version, compression level and the payload
+//   - encrypted entry: the payload entry key, AES key and IV
+// Payloads of an encrypted bitstream only have the encrypted entry.
+// Each entry carries the SHA-256 of its content, an entry that does not
+// match it (truncated or corrupted on disk) is a miss.
+// The least recently used entries are removed once the total size is over
+// the limit. The cache never fails the generation, any I/O error is a miss.
+class BitGen_CACHE {
+ public:
+  BitGen_CACHE(const std::string& directory, uint64_t max_size);
+  std::string get_payload_key(const uint8_t* payload, size_t payload_size,
+                              bool compress, CFG_COMPRESS_LEVEL compress_level);
+  std::string get_encrypted_key(const std::string& payload_key,
+                                const std::vector<uint8_t>& aes_key,
+                                const uint8_t* iv);
+  // Entry data is read into new data blocks of the arena (or written from
+  // data blocks), where the data of payload entry that is not compressed is
+  // not stored at all
+  bool get(const std::string& key, bool& compressed,
+           BitGen_BITSTREAM_ARENA& arena,
+           std::vector<BitGen_BITSTREAM_BLOCK*>& blocks, size_t& size);
+  void put(const std::string& key, bool compressed,
+           const std::vector<BitGen_BITSTREAM_BLOCK*>& blocks, size_t size);
+  // One hit or miss per cached action, whatever the number of lookups
+  void count(bool hit);
+  uint64_t get_hit_count() const { return m_hit; }
+  uint64_t get_miss_count() const { return m_miss; }
+  std::string get_report() const;
+
+ private:
+  std::string get_key(const std::vector<uint8_t>& data);
+  std::string get_filepath(const std::string& key);
+  void evict();
+  const std::string m_directory;
+  const uint64_t m_max_size;
+  uint64_t m_size = 0;
+  std::atomic<uint64_t> m_hit{0};
+  std::atomic<uint64_t> m_miss{0};
+  std::mutex m_mutex;
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include "BitGen_decompress_engine.h"
 
+#include <algorithm>
+
 #define BitGen_DECOMPRESS_ENGINE_VERSION (0)
 #define ENABLE_DEBUG (0)
 
@@ -367,9 +369,14 @@ void BitGen_DECOMPRESS_ENGINE::output_cmp(uint8_t* output,
       m_total_output_index++;
       m_track_cmp |= 1;
     } else if (m_flag_index < m_flag_size) {
-      output[m_output_index++] = m_compress_variable;
-      m_total_output_index++;
-      m_flag_index++;
+      // Emit as much of the sequence as the output window can take
+      size_t size = std::min(m_flag_size - m_flag_index,
+                             output_size - m_output_index);
+      CFG_ASSERT((m_total_output_index + size) <= m_original_size);
+      memset(&output[m_output_index], m_compress_variable, size);
+      m_output_index += size;
+      m_total_output_index += size;
+      m_flag_index += size;
       m_track_cmp |= (m_flag_index == m_flag_size ? 2 : 0);
     } else if (!m_output_variable &&
                (m_flag == BitGen_DECOMPRESS_ENGINE_CMP_ZERO_VAR_TYPE ||
@@ -429,19 +436,21 @@ void BitGen_DECOMPRESS_ENGINE::output_none(const uint8_t* input,
   CFG_ASSERT(m_state == BitGen_DECOMPRESS_ENGINE_OUTPUT_NONE_STATE);
   CFG_ASSERT(m_total_input_index < m_compress_size);
   CFG_ASSERT(m_total_output_index < m_original_size);
-  while (m_flag_index < m_flag_size && m_input_index < input_size &&
-         m_output_index < output_size) {
-    CFG_ASSERT(m_total_output_index < m_original_size);
-    CFG_ASSERT(m_total_input_index < m_compress_size);
-    output[m_output_index++] = input[m_input_index];
-    if (m_flag_repeat) {
-      m_none_data[m_flag_index] = input[m_input_index];
-    }
-    m_flag_index++;
-    m_input_index++;
-    m_total_output_index++;
-    m_total_input_index++;
+  // Copy as much as both the input and the output windows allow
+  size_t size = std::min(std::min(m_flag_size - m_flag_index,
+                                  input_size - m_input_index),
+                         output_size - m_output_index);
+  CFG_ASSERT((m_total_output_index + size) <= m_original_size);
+  CFG_ASSERT((m_total_input_index + size) <= m_compress_size);
+  memcpy(&output[m_output_index], &input[m_input_index], size);
+  if (m_flag_repeat) {
+    memcpy(&m_none_data[m_flag_index], &input[m_input_index], size);
   }
+  m_flag_index += size;
+  m_input_index += size;
+  m_output_index += size;
+  m_total_output_index += size;
+  m_total_input_index += size;
   if (m_flag_index == m_flag_size) {
     m_flag_index = 0;
     m_done = m_total_output_index == m_original_size;
@@ -474,11 +483,13 @@ void BitGen_DECOMPRESS_ENGINE::output_none_repeat(uint8_t* output,
   CFG_ASSERT(m_total_input_index <= m_compress_size);
   CFG_ASSERT(m_total_output_index < m_original_size);
   while (m_repeat_index < m_repeat_size) {
-    while (m_output_index < output_size && m_flag_index < m_flag_size) {
-      CFG_ASSERT(m_total_output_index < m_original_size);
-      output[m_output_index++] = m_none_data[m_flag_index++];
-      m_total_output_index++;
-    }
+    size_t size =
+        std::min(m_flag_size - m_flag_index, output_size - m_output_index);
+    CFG_ASSERT((m_total_output_index + size) <= m_original_size);
+    memcpy(&output[m_output_index], &m_none_data[m_flag_index], size);
+    m_output_index += size;
+    m_flag_index += size;
+    m_total_output_index += size;
     CFG_ASSERT(m_output_index <= output_size);
     if (m_flag_index == m_flag_size) {
       m_flag_index = 0;
@@ -1,12 +1,138 @@
 #include "BitGen_packer.h"
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 
+#include "BitGen_cache.h"
+#include "CFGCommonRS/CFGCompress.h"
 #include "CFGCrypto/CFGOpenSSL.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BitGen_PACKER_SSE2
+#endif
+
+// Number of blocks hashed by one thread at a time
+#define BitGen_PACKER_HASH_GROUP_SIZE (64)
+
 const std::vector<std::string> BitGen_BITSTREAM_SUPPORTED_BOP_IDENTIFIER = {
     "FSBL", "FPGA", "ACPU", "UBT", "LNX", "ZPHR", "KEYC"};
 
+struct BitGen_PACKER_COMPRESS_PREDICTION {
+  std::atomic<bool> check{false};
+  // Predicted compressible: compression is kept, or dropped because it does
+  // not save any block
+  std::atomic<uint64_t> kept{0};
+  std::atomic<uint64_t> dropped{0};
+  // Predicted not compressible: compression is skipped. Only known to be
+  // wrong when check is enabled.
+  std::atomic<uint64_t> skipped{0};
+  std::atomic<uint64_t> wrongly_skipped{0};
+};
+
+static BitGen_PACKER_COMPRESS_PREDICTION BitGen_PACKER_compress_prediction;
+
+// Fletcher-32 sums of 16 bits words. The sums are not modular, they simply
+// wrap and only their lower 16 bits are used, hence the additions can be
+// grouped in any way.
+static void BitGen_PACKER_fletcher32(const uint8_t* data, size_t word_count,
+                                     uint32_t& c0, uint32_t& c1) {
+  size_t i = 0;
+#if defined(BitGen_PACKER_SSE2)
+  // 8 words at a time. Signed multiply-add of the words is only off by
+  // multiples of 0x10000. The sums of previous chunks are accumulated as
+  // prefix, each of the words in them adds to c1 again for every chunk.
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i weights = _mm_set_epi16(1, 2, 3, 4, 5, 6, 7, 8);
+  __m128i sum = _mm_setzero_si128();
+  __m128i prefix = _mm_setzero_si128();
+  __m128i weighted = _mm_setzero_si128();
+  size_t chunk_count = word_count / 8;
+  for (size_t j = 0; j < chunk_count; j++) {
+    __m128i words = _mm_loadu_si128((const __m128i*)(&data[j * 16]));
+    prefix = _mm_add_epi32(prefix, sum);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(words, ones));
+    weighted = _mm_add_epi32(weighted, _mm_madd_epi16(words, weights));
+  }
+  auto horizontal_sum = [](__m128i value) {
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, 0x4E));
+    value = _mm_add_epi32(value, _mm_shuffle_epi32(value, 0xB1));
+    return (uint32_t)(_mm_cvtsi128_si32(value));
+  };
+  c1 += (uint32_t)(chunk_count * 8) * c0 + 8 * horizontal_sum(prefix) +
+        horizontal_sum(weighted);
+  c0 += horizontal_sum(sum);
+  i = chunk_count * 8;
+#endif
+  for (; i < word_count; i++) {
+    uint16_t word = 0;
+    memcpy(&word, &data[i * 2], sizeof(word));
+    c0 += word;
+    c1 += c0;
+  }
+}
+
+// Checksum of the original payload, updated piece by piece so that it is
+// computed while the payload is compressed or copied
+class BitGen_PACKER_CHECKSUM {
+ public:
+  BitGen_PACKER_CHECKSUM(uint8_t type) : m_type(type) {}
+  void update(const uint8_t* data, size_t size) {
+    CFG_ASSERT(data != nullptr || size == 0);
+    m_size += size;
+    if (m_type != 0x10 || size == 0) {
+      return;
+    }
+    // Odd byte waits for the next one to make a word
+    if (m_has_pending_byte) {
+      uint8_t word[2] = {m_pending_byte, data[0]};
+      BitGen_PACKER_fletcher32(word, 1, m_c0, m_c1);
+      data++;
+      size--;
+    }
+    BitGen_PACKER_fletcher32(data, size / 2, m_c0, m_c1);
+    m_has_pending_byte = (size & 1) != 0;
+    if (m_has_pending_byte) {
+      m_pending_byte = data[size - 1];
+    }
+  }
+  uint64_t get(uint32_t& checksum_size) {
+    uint64_t checksum = 0;
+    if (m_type == 0x10) {
+      // Flecther-32
+      CFG_ASSERT(m_size > 0 && (m_size % 4) == 0);
+      uint32_t type_checksum =
+          (m_c1 << 16) | ((-(m_c1 + m_c0)) & 0x0000ffff);
+      checksum = (uint64_t)(type_checksum);
+      checksum_size = (uint64_t)(sizeof(type_checksum));
+    } else {
+      CFG_INTERNAL_ERROR("Does not support checksum type %d", m_type);
+    }
+    return checksum;
+  }
+  uint32_t get_checksum_size() {
+    uint32_t checksum_size = 0;
+    if (m_type == 0x10) {
+      // Flecther-32
+      checksum_size = 4;
+    } else {
+      CFG_INTERNAL_ERROR("Does not support checksum type %d", m_type);
+    }
+    return checksum_size;
+  }
+  size_t get_size() { return m_size; }
+
+ private:
+  const uint8_t m_type;
+  uint32_t m_c0 = 0;
+  uint32_t m_c1 = 0;
+  size_t m_size = 0;
+  bool m_has_pending_byte = false;
+  uint8_t m_pending_byte = 0;
+};
+
 BitGen_BITSTREAM_BOP_FIELD::~BitGen_BITSTREAM_BOP_FIELD() {
   memset(iv, 0, sizeof(iv));
 }
@@ -39,16 +165,79 @@ BitGen_BITSTREAM_BOP::~BitGen_BITSTREAM_BOP() {
   }
 }
 
-BitGen_BITSTREAM_BLOCK::BitGen_BITSTREAM_BLOCK(BitGen_BITSTREAM_BLOCK_TYPE t)
-    : type(t) {
-  data.resize(BitGen_BITSTREAM_BLOCK_SIZE);
-  memset(&data[0], 0, data.size());
+BitGen_BITSTREAM_ARENA::BitGen_BITSTREAM_ARENA(std::vector<uint8_t>& buffer,
+                                               size_t hash_size)
+    : m_buffer(buffer),
+      m_start(buffer.size()),
+      m_hash_size(hash_size),
+      m_group_size((BitGen_BITSTREAM_BLOCK_SIZE / hash_size) - 1) {
+  CFG_ASSERT(m_hash_size == 32 || m_hash_size == 48 || m_hash_size == 64);
+  m_blocks.push_back(
+      BitGen_BITSTREAM_BLOCK(BitGen_BITSTREAM_HEADER_BLOCK, this, 0));
+  m_buffer.resize(m_start + BitGen_BITSTREAM_BLOCK_SIZE);
 }
 
-BitGen_BITSTREAM_BLOCK::~BitGen_BITSTREAM_BLOCK() {
-  if (data.size()) {
-    memset(&data[0], 0, data.size());
-    data.clear();
+BitGen_BITSTREAM_ARENA::~BitGen_BITSTREAM_ARENA() { m_blocks.clear(); }
+
+BitGen_BITSTREAM_BLOCK* BitGen_BITSTREAM_ARENA::add_block(
+    BitGen_BITSTREAM_BLOCK_TYPE type) {
+  CFG_ASSERT(type == BitGen_BITSTREAM_ACTION_BLOCK ||
+             type == BitGen_BITSTREAM_DATA_BLOCK);
+  CFG_ASSERT(!m_finalized);
+  // Every group of blocks starts with its hash block
+  size_t group = m_block_count / m_group_size;
+  size_t hash_index = 1 + group * (m_group_size + 1);
+  if ((m_block_count % m_group_size) == 0) {
+    m_blocks.push_back(
+        BitGen_BITSTREAM_BLOCK(BitGen_BITSTREAM_HASH_BLOCK, this, hash_index));
+  }
+  size_t index = hash_index + 1 + (m_block_count % m_group_size);
+  m_blocks.push_back(BitGen_BITSTREAM_BLOCK(type, this, index));
+  CFG_ASSERT(m_blocks.size() == (index + 1));
+  m_block_count++;
+  // Grown part is zeros
+  m_buffer.resize(m_start + get_size());
+  return &m_blocks.back();
+}
+
+void BitGen_BITSTREAM_ARENA::truncate(size_t block_count) {
+  CFG_ASSERT(block_count <= m_block_count);
+  CFG_ASSERT(!m_finalized);
+  if (block_count == m_block_count) {
+    return;
+  }
+  size_t size = BitGen_BITSTREAM_BLOCK_SIZE;
+  if (block_count) {
+    size_t group = (block_count - 1) / m_group_size;
+    size += (1 + group * (m_group_size + 1) + 1 +
+             ((block_count - 1) % m_group_size)) *
+            BitGen_BITSTREAM_BLOCK_SIZE;
+  }
+  while (get_size() > size) {
+    m_blocks.pop_back();
+  }
+  m_block_count = block_count;
+  // Removed data does not stay in the buffer, and it is zeros when it grows
+  memset(&m_buffer[m_start + size], 0, m_buffer.size() - m_start - size);
+  m_buffer.resize(m_start + size);
+}
+
+void BitGen_BITSTREAM_ARENA::finalize() {
+  CFG_ASSERT(!m_finalized);
+  m_finalized = true;
+  if (m_block_count && ((m_block_count - 1) % m_group_size) == 0) {
+    // Last block takes the place of the hash block before it
+    BitGen_BITSTREAM_BLOCK block = m_blocks.back();
+    m_blocks.pop_back();
+    CFG_ASSERT(m_blocks.back().type == BitGen_BITSTREAM_HASH_BLOCK);
+    CFG_ASSERT(m_blocks.back().index == (block.index - 1));
+    m_blocks.pop_back();
+    m_blocks.push_back(
+        BitGen_BITSTREAM_BLOCK(block.type, this, block.index - 1));
+    memcpy(get_data(block.index - 1), get_data(block.index),
+           BitGen_BITSTREAM_BLOCK_SIZE);
+    memset(get_data(block.index), 0, BitGen_BITSTREAM_BLOCK_SIZE);
+    m_buffer.resize(m_start + get_size());
   }
 }
 
@@ -90,47 +279,47 @@ static void BitGen_PACKER_gen_bop_header_basic_field(
   // Identifier - byte [3:0]
   CFG_ASSERT(field.identifier.size());
   CFG_ASSERT(field.identifier.size() <= 4);
-  memcpy(&header->data[0], field.identifier.c_str(), field.identifier.size());
+  memcpy(&header->data()[0], field.identifier.c_str(), field.identifier.size());
   // Version - byte [0x7:0x4]
-  memcpy(&header->data[0x4], (void*)(&field.version), sizeof(field.version));
+  memcpy(&header->data()[0x4], (void*)(&field.version), sizeof(field.version));
   // Size - byte [0xF:0x8]
   // OPN Tool - byte [0x3F:0x10]
   CFG_ASSERT(field.opn_tool.size() <= 48);
-  memcpy(&header->data[0x10], field.opn_tool.c_str(), field.opn_tool.size());
+  memcpy(&header->data()[0x10], field.opn_tool.c_str(), field.opn_tool.size());
   // JTAG ID - byte [0x43:0x40]
-  memcpy(&header->data[0x40], (void*)(&field.jtag_id), sizeof(field.jtag_id));
+  memcpy(&header->data()[0x40], (void*)(&field.jtag_id), sizeof(field.jtag_id));
   // JTAG Mask - byte [0x47:0x44]
-  memcpy(&header->data[0x40], (void*)(&field.jtag_mask),
+  memcpy(&header->data()[0x40], (void*)(&field.jtag_mask),
          sizeof(field.jtag_mask));
   // Reserved - byte [0x4F:0x48]
   // Obscured Chipid - byte [0x50]
-  memcpy(&header->data[0x50], (void*)(&field.chipid), sizeof(field.chipid));
+  memcpy(&header->data()[0x50], (void*)(&field.chipid), sizeof(field.chipid));
   // Obscured Reserved - byte [0x5B:0x51]
   // Obscured CRC - byte [0x5F:0x5C]
-  uint32_t crc32 = CFG_crc32(&header->data[0x50], 12);
-  memcpy(&header->data[0x5C], (void*)(&crc32), sizeof(crc32));
+  uint32_t crc32 = CFG_crc32(&header->data()[0x50], 12);
+  memcpy(&header->data()[0x5C], (void*)(&crc32), sizeof(crc32));
   // Checksum - byte [0x60]
-  memcpy(&header->data[0x60], (void*)(&field.checksum), sizeof(field.checksum));
+  memcpy(&header->data()[0x60], (void*)(&field.checksum),
+         sizeof(field.checksum));
   // Compression - byte [0x61] - currently only support DCMP0
   uint8_t compression = compress ? 0x10 : 0;
-  memcpy(&header->data[0x61], (void*)(&compression), sizeof(compression));
+  memcpy(&header->data()[0x61], (void*)(&compression), sizeof(compression));
   // Integrity - byte [0x62] - impossible there is no interity
   CFG_ASSERT(field.integrity != 0);
-  memcpy(&header->data[0x62], (void*)(&field.integrity),
+  memcpy(&header->data()[0x62], (void*)(&field.integrity),
          sizeof(field.integrity));
 }
 
-static void BitGen_PACKER_gen_bop_header_encryption_field(
-    BitGen_BITSTREAM_BOP_FIELD& field, BitGen_BITSTREAM_BLOCK*& header,
-    std::vector<uint8_t>& aes_key) {
+// Random data of the BOP is generated in the order of the BOPs, before they
+// are generated in parallel
+static void BitGen_PACKER_gen_bop_random_data(BitGen_BITSTREAM_BOP_FIELD& field,
+                                              std::vector<uint8_t>& aes_key,
+                                              std::vector<uint8_t>& challenge) {
   CFG_ASSERT(aes_key.size() == 0 || aes_key.size() == 16 ||
              aes_key.size() == 32);
   if (aes_key.size()) {
-    // Encryption - byte [0x80]
-    header->data[0x80] = aes_key.size() == 16 ? 0x10 : 0x12;
     // Challenge
-    std::vector<uint8_t> challenge(64);
-    std::vector<uint8_t> encrypted_challenge(challenge.size());
+    challenge.resize(64);
     uint32_t crc = 0;
     CFGOpenSSL::generate_random_data(&challenge[0],
                                      challenge.size() - sizeof(uint32_t));
@@ -141,15 +330,29 @@ static void BitGen_PACKER_gen_bop_header_encryption_field(
     if (CFG_check_all_zeros(field.iv, sizeof(field.iv))) {
       CFGOpenSSL::generate_iv(field.iv, false);
     }
+  }
+}
+
+static void BitGen_PACKER_gen_bop_header_encryption_field(
+    BitGen_BITSTREAM_BOP_FIELD& field, BitGen_BITSTREAM_BLOCK*& header,
+    std::vector<uint8_t>& aes_key, std::vector<uint8_t>& challenge,
+    CFGOpenSSL_CTR* ctr) {
+  CFG_ASSERT(aes_key.size() == 0 || aes_key.size() == 16 ||
+             aes_key.size() == 32);
+  if (aes_key.size()) {
+    // Encryption - byte [0x80]
+    header->data()[0x80] = aes_key.size() == 16 ? 0x10 : 0x12;
+    CFG_ASSERT(challenge.size() == 64);
+    std::vector<uint8_t> encrypted_challenge(challenge.size());
     // Encrypt
-    CFGOpenSSL::ctr_encrypt(&challenge[0], &encrypted_challenge[0],
-                            challenge.size(), &aes_key[0], aes_key.size(),
-                            field.iv, sizeof(field.iv));
+    CFG_ASSERT(ctr != nullptr);
+    ctr->set_iv(field.iv, sizeof(field.iv));
+    ctr->update(&challenge[0], &encrypted_challenge[0], challenge.size());
     // Challenge - random data - byte [0x27F:0x240]
-    memcpy(&header->data[0x240], &encrypted_challenge[0],
+    memcpy(&header->data()[0x240], &encrypted_challenge[0],
            encrypted_challenge.size());
     // IV - byte [0x28F:0x280]
-    memcpy(&header->data[0x280], field.iv, sizeof(field.iv));
+    memcpy(&header->data()[0x280], field.iv, sizeof(field.iv));
     // Increment IV
     uint32_t iv = 0;
     memcpy((void*)(&iv), field.iv, sizeof(iv));
@@ -158,115 +361,295 @@ static void BitGen_PACKER_gen_bop_header_encryption_field(
   }
 }
 
-static void BitGen_PACKER_update_action(
-    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks, uint8_t* data, size_t size,
-    uint8_t*& action_data, size_t& action_remaining_size) {
-  if (action_remaining_size >= size) {
-    // We have enough space
-    memcpy(action_data, data, size);
-    action_data += size;
-    action_remaining_size -= size;
-  } else {
-    // We do not have enough space, create new one
-    BitGen_BITSTREAM_BLOCK* action =
-        CFG_MEM_NEW(BitGen_BITSTREAM_BLOCK, BitGen_BITSTREAM_ACTION_BLOCK);
-    // To prevent unlimited recursive
-    CFG_ASSERT(size <= action->data.size());
-    // Action data has new pointer now
-    action_data = &action->data[0];
-    // New remaining value as well
-    action_remaining_size = action->data.size();
-    blocks.push_back(action);
-    BitGen_PACKER_update_action(blocks, data, size, action_data,
-                                action_remaining_size);
-  }
-}
-
-static void BitGen_PACKER_update_hash(
-    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks, BitGen_BITSTREAM_BLOCK* block,
-    size_t hash_size, uint8_t*& hash_data, size_t& hash_remaining_size,
-    bool is_last_block) {
-  CFG_ASSERT(block != nullptr);
-  CFG_ASSERT(block->data.size());
-  CFG_ASSERT(hash_remaining_size >= hash_size);
-  if (hash_remaining_size >= (2 * hash_size) || is_last_block) {
-    // We have enough space
-    CFGOpenSSL::sha((uint8_t)(hash_size), &block->data[0], block->data.size(),
-                    hash_data);
-    hash_data += hash_size;
-    hash_remaining_size -= hash_size;
-    blocks.push_back(block);
-  } else {
+// Where the next action header goes: the action area of the BOP header first,
+// then the action blocks that are added whenever it runs out of space
+struct BitGen_PACKER_ACTION_AREA {
+  BitGen_BITSTREAM_BLOCK* block = nullptr;
+  size_t offset = 0;
+  size_t remaining_size = 0;
+};
+
+// Reserve the space of action data, return its offset in area.block
+static size_t BitGen_PACKER_reserve_action(BitGen_BITSTREAM_ARENA& arena,
+                                           BitGen_PACKER_ACTION_AREA& area,
+                                           size_t size) {
+  if (area.remaining_size < size) {
     // We do not have enough space, create new one
-    // But at this point the hash block is still empty, hence we store the
-    // pointer of last hash addr, and only update hash block's hash pointer at
-    // the very end
-    BitGen_BITSTREAM_BLOCK* hash =
-        CFG_MEM_NEW(BitGen_BITSTREAM_BLOCK, BitGen_BITSTREAM_HASH_BLOCK);
-    hash->hash_block_hash_data_ptr = hash_data;
-    // To prevent unlimited recursive
-    CFG_ASSERT(hash->data.size() >= (2 * hash_size));
-    // Hash data has new pointer now
-    hash_data = &hash->data[0];
-    // New remaining value as well
-    hash_remaining_size = hash->data.size();
-    blocks.push_back(hash);
-    BitGen_PACKER_update_hash(blocks, block, hash_size, hash_data,
-                              hash_remaining_size, is_last_block);
+    area.block = arena.add_block(BitGen_BITSTREAM_ACTION_BLOCK);
+    area.offset = 0;
+    area.remaining_size = BitGen_BITSTREAM_BLOCK_SIZE;
+    // not legal if you cannot fit action in one 2k block
+    CFG_ASSERT(size <= area.remaining_size);
+  }
+  size_t offset = area.offset;
+  area.offset += size;
+  area.remaining_size -= size;
+  return offset;
+}
+
+static void BitGen_PACKER_update_action(BitGen_BITSTREAM_ARENA& arena,
+                                        BitGen_PACKER_ACTION_AREA& area,
+                                        const uint8_t* data, size_t size) {
+  size_t offset = BitGen_PACKER_reserve_action(arena, area, size);
+  memcpy(&area.block->data()[offset], data, size);
+}
+
+// Append data to the data blocks, which already hold 'size' bytes. Checksum
+// (if any) is updated with each piece right after it is copied.
+static size_t BitGen_PACKER_append_data(
+    BitGen_BITSTREAM_ARENA& arena, std::vector<BitGen_BITSTREAM_BLOCK*>& blocks,
+    size_t size, const uint8_t* data, size_t data_size,
+    BitGen_PACKER_CHECKSUM* checksum = nullptr) {
+  while (data_size) {
+    if ((size / BitGen_BITSTREAM_BLOCK_SIZE) == blocks.size()) {
+      blocks.push_back(arena.add_block(BitGen_BITSTREAM_DATA_BLOCK));
+    }
+    size_t offset = size % BitGen_BITSTREAM_BLOCK_SIZE;
+    size_t copy_size =
+        std::min(data_size, (size_t)(BitGen_BITSTREAM_BLOCK_SIZE) - offset);
+    memcpy(&blocks[size / BitGen_BITSTREAM_BLOCK_SIZE]->data()[offset], data,
+           copy_size);
+    if (checksum != nullptr) {
+      checksum->update(data, copy_size);
+    }
+    size += copy_size;
+    data += copy_size;
+    data_size -= copy_size;
+  }
+  return size;
+}
+
+// Remove the data blocks, which are the last blocks of the arena
+static void BitGen_PACKER_delete_blocks(
+    BitGen_BITSTREAM_ARENA& arena,
+    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks) {
+  CFG_ASSERT(blocks.size() <= arena.get_block_count());
+  arena.truncate(arena.get_block_count() - blocks.size());
+  blocks.clear();
+}
+
+static size_t BitGen_PACKER_drain_stream(
+    CFG_COMPRESS_STREAM& stream, BitGen_BITSTREAM_ARENA& arena,
+    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks, size_t size) {
+  uint8_t buffer[BitGen_BITSTREAM_BLOCK_SIZE];
+  while (size_t drain_size = stream.drain(buffer, sizeof(buffer))) {
+    size = BitGen_PACKER_append_data(arena, blocks, size, buffer, drain_size);
+  }
+  memset(buffer, 0, sizeof(buffer));
+  return size;
+}
+
+// Compress the payload straight into data blocks. Only the default level can
+// be streamed (and updates the checksum, if any, chunk by chunk while it is
+// still in cache), other levels need the whole compressed copy first.
+static size_t BitGen_PACKER_compress_payload(
+    std::vector<uint8_t>& payload, CFG_COMPRESS_LEVEL compress_level,
+    BitGen_BITSTREAM_ARENA& arena, std::vector<BitGen_BITSTREAM_BLOCK*>& blocks,
+    BitGen_PACKER_CHECKSUM* checksum) {
+  CFG_ASSERT(payload.size());
+  CFG_ASSERT(blocks.empty());
+  if (compress_level != CFG_COMPRESS_DEFAULT_LEVEL) {
+    std::vector<uint8_t> data;
+    CFG_compress(&payload[0], payload.size(), data, nullptr, false,
+                 compress_level);
+    size_t size =
+        BitGen_PACKER_append_data(arena, blocks, 0, &data[0], data.size());
+    memset(&data[0], 0, data.size());
+    return size;
   }
+  // The header goes first but is only known at the end, reserve the largest
+  // one and shift the data once the real one is known
+  const size_t max_header_size = CFG_COMPRESS_STREAM::get_max_header_size();
+  CFG_ASSERT(max_header_size < BitGen_BITSTREAM_BLOCK_SIZE);
+  blocks.push_back(arena.add_block(BitGen_BITSTREAM_DATA_BLOCK));
+  size_t size = max_header_size;
+  CFG_COMPRESS_STREAM stream;
+  for (size_t index = 0; index < payload.size();) {
+    size_t feed_size = std::min(payload.size() - index, (size_t)(64 * 1024));
+    stream.feed(&payload[index], feed_size);
+    if (checksum != nullptr) {
+      checksum->update(&payload[index], feed_size);
+    }
+    index += feed_size;
+    size = BitGen_PACKER_drain_stream(stream, arena, blocks, size);
+  }
+  stream.finish();
+  size = BitGen_PACKER_drain_stream(stream, arena, blocks, size);
+  std::vector<uint8_t> header;
+  stream.get_header(header);
+  CFG_ASSERT(header.size() <= max_header_size);
+  size_t shift = max_header_size - header.size();
+  for (size_t index = max_header_size; index < size;) {
+    // Data only moves toward the front, block by block
+    size_t src_offset = index % BitGen_BITSTREAM_BLOCK_SIZE;
+    size_t dest_offset = (index - shift) % BitGen_BITSTREAM_BLOCK_SIZE;
+    size_t move_size =
+        std::min(std::min(size - index, (size_t)(BitGen_BITSTREAM_BLOCK_SIZE) -
+                                            src_offset),
+                 (size_t)(BitGen_BITSTREAM_BLOCK_SIZE) - dest_offset);
+    memmove(&blocks[(index - shift) / BitGen_BITSTREAM_BLOCK_SIZE]
+                 ->data()[dest_offset],
+            &blocks[index / BitGen_BITSTREAM_BLOCK_SIZE]->data()[src_offset],
+            move_size);
+    index += move_size;
+  }
+  size -= shift;
+  for (size_t index = size; index < (size + shift); index++) {
+    blocks[index / BitGen_BITSTREAM_BLOCK_SIZE]
+        ->data()[index % BitGen_BITSTREAM_BLOCK_SIZE] = 0;
+  }
+  size_t block_count =
+      (size + BitGen_BITSTREAM_BLOCK_SIZE - 1) / BitGen_BITSTREAM_BLOCK_SIZE;
+  if (blocks.size() > block_count) {
+    arena.truncate(arena.get_block_count() - (blocks.size() - block_count));
+    blocks.resize(block_count);
+  }
+  memcpy(&blocks[0]->data()[0], &header[0], header.size());
+  return size;
+}
+
+// Encrypt the data blocks in place. Every block is a multiple of AES block,
+// hence the counter simply carries on from one block to the next, and the
+// blocks can be spread over the threads of the CTR context.
+static void BitGen_PACKER_encrypt_blocks(
+    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks, size_t size,
+    CFGOpenSSL_CTR* ctr, const uint8_t* iv) {
+  CFG_ASSERT(ctr != nullptr);
+  std::vector<CFGOpenSSL_CTR_PIECE> pieces;
+  for (auto& block : blocks) {
+    CFG_ASSERT(size);
+    size_t block_size = std::min(size, (size_t)(BitGen_BITSTREAM_BLOCK_SIZE));
+    pieces.push_back({block->data(), block->data(), block_size});
+    size -= block_size;
+  }
+  CFG_ASSERT(size == 0);
+  ctr->set_iv(iv, 16);
+  ctr->update(pieces);
 }
 
 static void BitGen_PACKER_gen_action(
     BitGen_BITSTREAM_BOP*& bop, BitGen_BITSTREAM_ACTION*& action,
-    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks, uint8_t*& action_data,
-    size_t& action_remaining_size, uint8_t checksum, bool compress,
-    std::vector<uint8_t>& aes_key) {
+    BitGen_BITSTREAM_ARENA& arena, BitGen_PACKER_ACTION_AREA& area,
+    uint8_t checksum, bool compress, CFG_COMPRESS_LEVEL compress_level,
+    std::vector<uint8_t>& aes_key, CFGOpenSSL_CTR* ctr, BitGen_CACHE* cache) {
   CFG_ASSERT(action != nullptr);
   CFG_ASSERT(action->action);
   CFG_ASSERT((action->action & 0xF000) == 0);
   bool cmd_is_forced_to_turn_off_compress = false;
   bool cmd_is_forced_to_use_dedicated_iv = false;
   std::vector<uint8_t> action_header;
-  std::vector<uint8_t> payload;
+  // Payload goes straight into its data blocks, so that there is no other
+  // copy of the compressed or the encrypted payload
+  std::vector<BitGen_BITSTREAM_BLOCK*> payload_blocks;
+  size_t payload_size = 0;
+  // Checksum of original payload, computed while it is compressed or copied
+  BitGen_PACKER_CHECKSUM payload_checksum(checksum);
+  // Action header goes before the payload but is only complete once the
+  // payload is ready. Its size is known, reserve the space first
+  size_t action_header_size = 8 + action->field.size();
+  if (action->payload.size()) {
+    action_header_size += action->has_original_payload_size ? 4 : 0;
+    action_header_size +=
+        action->has_checksum ? payload_checksum.get_checksum_size() : 0;
+    action_header_size += aes_key.size() && action->iv.size() ? 16 : 0;
+  }
+  size_t action_offset =
+      BitGen_PACKER_reserve_action(arena, area, action_header_size);
+  BitGen_BITSTREAM_BLOCK* action_block = area.block;
+  // Result of the same payload (with the same AES key and IV if it is
+  // encrypted) from previous run. Checking the prediction needs every payload
+  // to be compressed, hence it does not use the cache. The payload of an
+  // encrypted bitstream is only cached encrypted, the compressed plain text
+  // never goes to the disk.
+  std::string payload_key = "";
+  std::string encrypted_key = "";
+  bool cached = false;
+  bool encrypted = false;
+  if (cache != nullptr && action->payload.size() &&
+      (compress || aes_key.size()) &&
+      !(compress && BitGen_PACKER_compress_prediction.check)) {
+    payload_key = cache->get_payload_key(
+        &action->payload[0], action->payload.size(), compress, compress_level);
+    bool compressed = false;
+    if (aes_key.size()) {
+      CFG_ASSERT(action->iv.empty() || action->iv.size() == 16);
+      encrypted_key = cache->get_encrypted_key(
+          payload_key, aes_key,
+          action->iv.size() ? &action->iv[0] : bop->field.iv);
+      encrypted =
+          cache->get(encrypted_key, compressed, arena, payload_blocks,
+                     payload_size);
+    } else {
+      cached = cache->get(payload_key, compressed, arena, payload_blocks,
+                          payload_size);
+    }
+    if (encrypted || cached) {
+      cmd_is_forced_to_turn_off_compress = compress && !compressed;
+    }
+    cache->count(encrypted || cached);
+  }
   // Prepare payload so we will know the size
   if (action->payload.size()) {
-    if (compress) {
-      CFG_compress(&action->payload[0], action->payload.size(), payload);
-      size_t compressed_block_count =
-          (payload.size() + BitGen_BITSTREAM_BLOCK_SIZE - 1) /
-          BitGen_BITSTREAM_BLOCK_SIZE;
-      size_t original_block_count =
-          (action->payload.size() + BitGen_BITSTREAM_BLOCK_SIZE - 1) /
-          BitGen_BITSTREAM_BLOCK_SIZE;
-      if (compressed_block_count >= original_block_count) {
-        memset(&payload[0], 0, payload.size());
-        payload.clear();
+    if (compress && !cached && !encrypted) {
+      BitGen_PACKER_COMPRESS_PREDICTION& prediction =
+          BitGen_PACKER_compress_prediction;
+      // Random or encrypted data never saves a block, do not waste time
+      bool compressible = CFG_COMPRESS::predict_compressible(
+          &action->payload[0], action->payload.size());
+      bool saved = false;
+      if (compressible || prediction.check) {
+        payload_size = BitGen_PACKER_compress_payload(
+            action->payload, compress_level, arena, payload_blocks,
+            action->has_checksum ? &payload_checksum : nullptr);
+        size_t original_block_count =
+            (action->payload.size() + BitGen_BITSTREAM_BLOCK_SIZE - 1) /
+            BitGen_BITSTREAM_BLOCK_SIZE;
+        saved = payload_blocks.size() < original_block_count;
+      }
+      if (!compressible) {
+        prediction.skipped++;
+        prediction.wrongly_skipped += saved ? 1 : 0;
+      } else if (saved) {
+        prediction.kept++;
+      } else {
+        prediction.dropped++;
+      }
+      // Checking the prediction does not change the bitstream
+      if (!compressible || !saved) {
+        BitGen_PACKER_delete_blocks(arena, payload_blocks);
+        payload_size = 0;
         cmd_is_forced_to_turn_off_compress = true;
       }
+      if (payload_key.size() && aes_key.empty()) {
+        cache->put(payload_key, !cmd_is_forced_to_turn_off_compress,
+                   payload_blocks, payload_size);
+      }
     }
-    if (payload.empty()) {
-      payload.insert(payload.end(), action->payload.begin(),
-                     action->payload.end());
+    if (payload_blocks.empty()) {
+      payload_size = BitGen_PACKER_append_data(
+          arena, payload_blocks, 0, &action->payload[0], action->payload.size(),
+          action->has_checksum && payload_checksum.get_size() == 0
+              ? &payload_checksum
+              : nullptr);
     }
   }
   // Encrypt
-  if (payload.size() > 0 && aes_key.size() > 0) {
+  if (payload_size > 0 && aes_key.size() > 0) {
     CFG_ASSERT(aes_key.size() == 16 || aes_key.size() == 32);
-    std::vector<uint8_t> encrypted_payload(payload.size());
     if (action->iv.size()) {
       cmd_is_forced_to_use_dedicated_iv = true;
       CFG_ASSERT(action->iv.size() == 16);
-      CFGOpenSSL::ctr_encrypt(&payload[0], &encrypted_payload[0],
-                              payload.size(), &aes_key[0], aes_key.size(),
-                              &action->iv[0], action->iv.size());
-    } else {
-      CFGOpenSSL::ctr_encrypt(&payload[0], &encrypted_payload[0],
-                              payload.size(), &aes_key[0], aes_key.size(),
-                              bop->field.iv, sizeof(bop->field.iv));
     }
-    // Copy to payload
-    memcpy(&payload[0], &encrypted_payload[0], payload.size());
-    memset(&encrypted_payload[0], 0, encrypted_payload.size());
+    if (!encrypted) {
+      BitGen_PACKER_encrypt_blocks(
+          payload_blocks, payload_size, ctr,
+          cmd_is_forced_to_use_dedicated_iv ? &action->iv[0] : bop->field.iv);
+      if (encrypted_key.size()) {
+        cache->put(encrypted_key,
+                   compress && !cmd_is_forced_to_turn_off_compress,
+                   payload_blocks, payload_size);
+      }
+    }
     // Increment IV
     if (!cmd_is_forced_to_use_dedicated_iv) {
       uint32_t iv = 0;
@@ -281,17 +664,21 @@ static void BitGen_PACKER_gen_action(
   CFG_append_u16(action_header, 0);
   // Payload size
   if (action->payload.size()) {
-    CFG_ASSERT(payload.size());
-    CFG_append_u32(action_header, (uint32_t)(payload.size()));
+    CFG_ASSERT(payload_size);
+    CFG_append_u32(action_header, (uint32_t)(payload_size));
     // Original payload size if applicable
     if (action->has_original_payload_size) {
       CFG_append_u32(action_header, (uint32_t)(action->payload.size()));
     }
     // Checksum if applicable
     if (action->has_checksum) {
+      if (payload_checksum.get_size() != action->payload.size()) {
+        // Not computed while preparing the payload (cached or not streamed)
+        CFG_ASSERT(payload_checksum.get_size() == 0);
+        payload_checksum.update(&action->payload[0], action->payload.size());
+      }
       uint32_t checksum_size = 0;
-      uint64_t checksum_value = BitGen_PACKER::calc_checksum(
-          action->payload, checksum, checksum_size);
+      uint64_t checksum_value = payload_checksum.get(checksum_size);
       CFG_ASSERT(checksum_size == 4 || checksum_size == 8);
       for (uint32_t i = 0; i < checksum_size; i++) {
         CFG_append_u8(action_header, (uint8_t)(checksum_value));
@@ -299,7 +686,7 @@ static void BitGen_PACKER_gen_action(
       }
     }
   } else {
-    CFG_ASSERT(payload.empty());
+    CFG_ASSERT(payload_blocks.empty());
     CFG_ASSERT(!action->has_original_payload_size);
     CFG_ASSERT(!action->has_checksum);
     CFG_append_u32(action_header, 0);
@@ -317,8 +704,7 @@ static void BitGen_PACKER_gen_action(
   }
   CFG_ASSERT(action_header.size());
   CFG_ASSERT((action_header.size() % 4) == 0);
-  // not legal if you cannot fit action in one 2k block
-  CFG_ASSERT(action_header.size() <= BitGen_BITSTREAM_BLOCK_SIZE);
+  CFG_ASSERT(action_header.size() == action_header_size);
   // Update command and size last
   if (action->payload.size() != 0 && action->has_original_payload_size) {
     action_header[1] |= 0x80;
@@ -334,150 +720,157 @@ static void BitGen_PACKER_gen_action(
   }
   uint16_t action_size = action_header.size();
   memcpy(&action_header[2], (void*)(&action_size), sizeof(action_size));
-  BitGen_PACKER_update_action(blocks, &action_header[0], action_header.size(),
-                              action_data, action_remaining_size);
+  memcpy(&action_block->data()[action_offset], &action_header[0],
+         action_header.size());
   memset(&action_header[0], 0, action_header.size());
   action_header.clear();
-  // Create payload
-  while (payload.size()) {
-    BitGen_BITSTREAM_BLOCK* data =
-        CFG_MEM_NEW(BitGen_BITSTREAM_BLOCK, BitGen_BITSTREAM_DATA_BLOCK);
-    size_t data_size = payload.size();
-    if (data_size > data->data.size()) {
-      data_size = data->data.size();
-    }
-    memcpy(&data->data[0], &payload[0], data_size);
-    memset(&payload[0], 0, data_size);
-    payload.erase(payload.begin(), payload.begin() + data_size);
-    blocks.push_back(data);
-  }
+  // Payload is already in place, right after the action header
 }
 
 static void BitGen_PACKER_gen_actions(
-    BitGen_BITSTREAM_BOP*& bop, std::vector<BitGen_BITSTREAM_BLOCK*>& blocks,
-    uint8_t* action_data, size_t action_remaining_size, uint8_t checksum,
-    bool compress, std::vector<uint8_t>& aes_key) {
+    BitGen_BITSTREAM_BOP*& bop, BitGen_BITSTREAM_ARENA& arena,
+    uint8_t checksum, bool compress, CFG_COMPRESS_LEVEL compress_level,
+    std::vector<uint8_t>& aes_key, CFGOpenSSL_CTR* ctr, BitGen_CACHE* cache) {
   CFG_ASSERT(bop->actions.size());
+  // Action area of the header - byte [0x1FF:0xC0]
+  BitGen_PACKER_ACTION_AREA area;
+  area.block = arena.get_header();
+  area.offset = 0xC0;
+  area.remaining_size = 0x140;
   // Version
   const uint32_t ACTION_VERSION = 0;
-  BitGen_PACKER_update_action(blocks, (uint8_t*)(&ACTION_VERSION),
-                              sizeof(ACTION_VERSION), action_data,
-                              action_remaining_size);
+  BitGen_PACKER_update_action(arena, area, (const uint8_t*)(&ACTION_VERSION),
+                              sizeof(ACTION_VERSION));
   // Total action
   uint32_t action_count = (uint32_t)(bop->actions.size());
-  BitGen_PACKER_update_action(blocks, (uint8_t*)(&action_count),
-                              sizeof(action_count), action_data,
-                              action_remaining_size);
+  BitGen_PACKER_update_action(arena, area, (const uint8_t*)(&action_count),
+                              sizeof(action_count));
   // Loop through the action
   for (auto& action : bop->actions) {
-    BitGen_PACKER_gen_action(bop, action, blocks, action_data,
-                             action_remaining_size, checksum, compress,
-                             aes_key);
+    BitGen_PACKER_gen_action(bop, action, arena, area, checksum, compress,
+                             compress_level, aes_key, ctr, cache);
   }
 }
 
-static void BitGen_PACKER_update_hash(
-    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks) {
-  CFG_ASSERT(blocks.size());
+static void BitGen_PACKER_update_hash(BitGen_BITSTREAM_ARENA& arena,
+                                      size_t max_threads) {
+  arena.finalize();
+  std::deque<BitGen_BITSTREAM_BLOCK>& blocks = arena.get_blocks();
   // first block must be header
-  CFG_ASSERT(blocks.front()->type == BitGen_BITSTREAM_HEADER_BLOCK);
-  std::vector<BitGen_BITSTREAM_BLOCK*> temp;
-  for (auto& block : blocks) {
-    temp.push_back(block);
-  }
-  blocks.clear();
-  BitGen_BITSTREAM_BLOCK* header = temp.front();
-  temp.erase(temp.begin());
-  blocks.push_back(header);
-  CFG_ASSERT(header->data[0x62] == 0x10 || header->data[0x62] == 0x11 ||
-             header->data[0x62] == 0x12);
-  size_t hash_size =
-      header->data[0x62] == 0x10 ? 32 : (header->data[0x62] == 0x11 ? 48 : 64);
-  uint8_t* hash_data = &header->data[0x200];
-  size_t hash_remaining_size = hash_size;
-  if (temp.size()) {
-    while (temp.size()) {
-      BitGen_BITSTREAM_BLOCK* block = temp.front();
-      temp.erase(temp.begin());
-      CFG_ASSERT(block->type == BitGen_BITSTREAM_ACTION_BLOCK ||
-                 block->type == BitGen_BITSTREAM_DATA_BLOCK);
-      BitGen_PACKER_update_hash(blocks, block, hash_size, hash_data,
-                                hash_remaining_size, temp.empty());
-    }
-    for (auto iter = blocks.rbegin(); iter != blocks.rend(); iter++) {
-      BitGen_BITSTREAM_BLOCK* block = *iter;
+  BitGen_BITSTREAM_BLOCK* header = &blocks.front();
+  CFG_ASSERT(header->type == BitGen_BITSTREAM_HEADER_BLOCK);
+  CFG_ASSERT(header->data()[0x62] == 0x10 || header->data()[0x62] == 0x11 ||
+             header->data()[0x62] == 0x12);
+  size_t hash_size = header->data()[0x62] == 0x10
+                         ? 32
+                         : (header->data()[0x62] == 0x11 ? 48 : 64);
+  CFG_ASSERT(hash_size == arena.get_hash_size());
+  if (blocks.size() > 1) {
+    // Every block puts its digest in the next slot of the header or of the
+    // hash block before it. Hash block starts new slots for the blocks after
+    // it. The arena no longer grows, the data pointers stay good
+    std::vector<std::pair<BitGen_BITSTREAM_BLOCK*, uint8_t*>> digests;
+    std::vector<std::pair<BitGen_BITSTREAM_BLOCK*, uint8_t*>> hash_digests;
+    uint8_t* hash_data = &header->data()[0x200];
+    size_t hash_remaining_size = hash_size;
+    for (size_t i = 1; i < blocks.size(); i++) {
+      BitGen_BITSTREAM_BLOCK* block = &blocks[i];
+      CFG_ASSERT(hash_remaining_size >= hash_size);
       if (block->type == BitGen_BITSTREAM_HASH_BLOCK) {
-        CFG_ASSERT(block->hash_block_hash_data_ptr != nullptr);
-        CFGOpenSSL::sha((uint8_t)(hash_size), &block->data[0],
-                        block->data.size(), block->hash_block_hash_data_ptr);
-        block->hash_block_hash_data_ptr = nullptr;
+        hash_digests.push_back({block, hash_data});
+        hash_data = block->data();
+        hash_remaining_size = BitGen_BITSTREAM_BLOCK_SIZE;
+      } else {
+        CFG_ASSERT(block->type == BitGen_BITSTREAM_ACTION_BLOCK ||
+                   block->type == BitGen_BITSTREAM_DATA_BLOCK);
+        digests.push_back({block, hash_data});
+        hash_data += hash_size;
+        hash_remaining_size -= hash_size;
+      }
+    }
+    // Digest of action and data block only depends on the block itself,
+    // hence they are computed in parallel, a group of blocks at a time
+    size_t group_count = (digests.size() + BitGen_PACKER_HASH_GROUP_SIZE - 1) /
+                         BitGen_PACKER_HASH_GROUP_SIZE;
+    CFG_run_in_parallel(group_count, max_threads, [&](size_t group) {
+      size_t end = std::min(digests.size(),
+                            (group + 1) * BitGen_PACKER_HASH_GROUP_SIZE);
+      for (size_t i = group * BitGen_PACKER_HASH_GROUP_SIZE; i < end; i++) {
+        CFGOpenSSL::sha((uint8_t)(hash_size), digests[i].first->data(),
+                        BitGen_BITSTREAM_BLOCK_SIZE, digests[i].second);
       }
+    });
+    // Hash block holds the digest of next hash block, so it goes backward
+    for (auto iter = hash_digests.rbegin(); iter != hash_digests.rend();
+         iter++) {
+      CFGOpenSSL::sha((uint8_t)(hash_size), iter->first->data(),
+                      BitGen_BITSTREAM_BLOCK_SIZE, iter->second);
     }
   } else {
     // special case, there is no block other than header
-    CFGOpenSSL::sha((uint8_t)(hash_size), &header->data[0xC0], 0x140,
-                    &header->data[0x200]);
+    CFGOpenSSL::sha((uint8_t)(hash_size), &header->data()[0xC0], 0x140,
+                    &header->data()[0x200]);
   }
 }
 
 static void BitGen_PACKER_update_bitstream_size(
-    std::vector<BitGen_BITSTREAM_BLOCK*>& blocks) {
-  CFG_ASSERT(blocks.size());
+    BitGen_BITSTREAM_ARENA& arena) {
   // first block must be header
-  BitGen_BITSTREAM_BLOCK* header = blocks.front();
+  BitGen_BITSTREAM_BLOCK* header = arena.get_header();
   CFG_ASSERT(header->type == BitGen_BITSTREAM_HEADER_BLOCK);
-  size_t block_size = header->data.size();
-  CFG_ASSERT(block_size);
-  for (auto& block : blocks) {
-    CFG_ASSERT(block_size == block->data.size());
-  }
-  uint64_t size = (uint64_t)(blocks.size() * block_size);
-  memcpy(&header->data[0x8], (void*)(&size), sizeof(size));
+  uint64_t size = (uint64_t)(arena.get_size());
+  memcpy(&header->data()[0x8], (void*)(&size), sizeof(size));
 }
 
-static void BitGen_PACKER_sign(BitGen_BITSTREAM_BLOCK*& header,
-                               CFGCrypto_KEY*& key) {
-  CFG_ASSERT(header->type == BitGen_BITSTREAM_HEADER_BLOCK);
+// Header is already in the bitstream, the key is shared by all the BOPs
+static void BitGen_PACKER_sign(uint8_t* header, CFGCrypto_KEY*& key) {
   if (key != nullptr) {
     // Authentication - byte [0x81]
-    header->data[0x81] = key->get_bitstream_signing_algo();
+    header[0x81] = key->get_bitstream_signing_algo();
     std::vector<uint8_t> public_key;
     key->get_public_key(public_key, 4);
     CFG_ASSERT(public_key.size());
     CFG_ASSERT(public_key.size() <= 272);
-    memcpy(&header->data[0x570], &public_key[0], public_key.size());
+    memcpy(&header[0x570], &public_key[0], public_key.size());
     size_t signature_size = CFGOpenSSL::sign_message(
-        &header->data[0], 0x680, &header->data[0x680], 0x100, key);
+        &header[0], 0x680, &header[0x680], 0x100, key);
     CFG_ASSERT(signature_size <= 0x100);
     memset(&public_key[0], 0, public_key.size());
     public_key.clear();
   }
 }
 
-static void BitGen_PACKER_finalize(BitGen_BITSTREAM_BLOCK*& header) {
-  CFG_ASSERT(header->type == BitGen_BITSTREAM_HEADER_BLOCK);
+static void BitGen_PACKER_finalize(uint8_t* header) {
   uint32_t crc32 = 0;
-  crc32 = CFG_crc32(&header->data[0], header->data.size() - sizeof(crc32));
-  memcpy(&header->data[header->data.size() - sizeof(crc32)], (void*)(&crc32),
-         sizeof(crc32));
+  crc32 = CFG_crc32(&header[0], BitGen_BITSTREAM_BLOCK_SIZE - sizeof(crc32));
+  memcpy(&header[BitGen_BITSTREAM_BLOCK_SIZE - sizeof(crc32)],
+         (void*)(&crc32), sizeof(crc32));
 }
 
+// BOP is generated straight at the end of data, it is signed and finalized
+// once it is in the bitstream
 static void BitGen_PACKER_gen_bop_bitstream(
-    BitGen_BITSTREAM_BOP*& bop, std::vector<BitGen_BITSTREAM_BLOCK*>& blocks,
-    bool compress, std::vector<uint8_t>& aes_key, CFGCrypto_KEY*& key) {
+    BitGen_BITSTREAM_BOP*& bop, std::vector<uint8_t>& data, bool compress,
+    CFG_COMPRESS_LEVEL compress_level, std::vector<uint8_t>& aes_key,
+    std::vector<uint8_t>& challenge, CFGOpenSSL_CTR* ctr, BitGen_CACHE* cache,
+    size_t max_threads) {
   CFG_ASSERT(bop->actions.size());
-  BitGen_BITSTREAM_BLOCK* header =
-      CFG_MEM_NEW(BitGen_BITSTREAM_BLOCK, BitGen_BITSTREAM_HEADER_BLOCK);
-  blocks.push_back(header);
+  // Integrity decides the hash block layout
+  CFG_ASSERT(bop->field.integrity == 0x10 || bop->field.integrity == 0x11 ||
+             bop->field.integrity == 0x12);
+  BitGen_BITSTREAM_ARENA arena(
+      data, bop->field.integrity == 0x10
+                ? 32
+                : (bop->field.integrity == 0x11 ? 48 : 64));
+  BitGen_BITSTREAM_BLOCK* header = arena.get_header();
   BitGen_PACKER_gen_bop_header_basic_field(bop->field, header, compress);
-  BitGen_PACKER_gen_bop_header_encryption_field(bop->field, header, aes_key);
-  BitGen_PACKER_gen_actions(bop, blocks, &header->data[0xC0], 0x140,
-                            header->data[0x60], compress, aes_key);
-  BitGen_PACKER_update_hash(blocks);
-  BitGen_PACKER::obscure(&header->data[0x50], &header->data[0x200]);
-  BitGen_PACKER_update_bitstream_size(blocks);
-  BitGen_PACKER_sign(header, key);
-  BitGen_PACKER_finalize(header);
+  BitGen_PACKER_gen_bop_header_encryption_field(bop->field, header, aes_key,
+                                                challenge, ctr);
+  BitGen_PACKER_gen_actions(bop, arena, header->data()[0x60], compress,
+                            compress_level, aes_key, ctr, cache);
+  BitGen_PACKER_update_hash(arena, max_threads);
+  BitGen_PACKER::obscure(&header->data()[0x50], &header->data()[0x200]);
+  BitGen_PACKER_update_bitstream_size(arena);
 }
 
 void BitGen_PACKER::update_bitstream_end_size(uint8_t* const data,
@@ -505,25 +898,76 @@ void BitGen_PACKER::generate_bitstream(std::vector<BitGen_BITSTREAM_BOP*>& bops,
                                        std::vector<uint8_t>& data,
                                        bool compress,
                                        std::vector<uint8_t>& aes_key,
-                                       CFGCrypto_KEY*& key) {
+                                       CFGCrypto_KEY*& key,
+                                       CFG_COMPRESS_LEVEL compress_level,
+                                       BitGen_CACHE* cache,
+                                       size_t max_threads) {
   CFG_ASSERT(bops.size());
-  // Track each BOP size
-  size_t start_index = data.size();
-  std::vector<size_t> tracking_size;
-  for (BitGen_BITSTREAM_BOP*& bop : bops) {
-    size_t temp_start_index = data.size();
-    std::vector<BitGen_BITSTREAM_BLOCK*> bop_blocks;
-    BitGen_PACKER_gen_bop_bitstream(bop, bop_blocks, compress, aes_key, key);
-    CFG_ASSERT(bop_blocks.size());
-    for (BitGen_BITSTREAM_BLOCK*& block : bop_blocks) {
-      CFG_ASSERT(block != nullptr);
-      data.insert(data.end(), block->data.begin(), block->data.end());
+  CFG_ASSERT(aes_key.size() == 0 || aes_key.size() == 16 ||
+             aes_key.size() == 32);
+  // BOPs are independent until they are put together, hence they are
+  // generated in parallel, each into its own buffer (the first one straight
+  // into data). The threads are shared by the BOPs and the work within them
+  size_t bop_thread_count =
+      std::min(bops.size(), std::max(max_threads, (size_t)(1)));
+  size_t bop_max_threads =
+      std::max(max_threads / bop_thread_count, (size_t)(1));
+  // Random data is generated in order and each BOP has its own CTR context,
+  // so the output does not depend on the thread count. The key is expanded
+  // once and every BOP context is a copy of it
+  std::vector<std::vector<uint8_t>> challenges(bops.size());
+  std::vector<CFGOpenSSL_CTR*> ctrs(bops.size(), nullptr);
+  CFGOpenSSL_CTR* key_ctr = nullptr;
+  if (aes_key.size()) {
+    key_ctr = CFG_MEM_NEW(CFGOpenSSL_CTR, &aes_key[0], aes_key.size());
+  }
+  for (size_t i = 0; i < bops.size(); i++) {
+    BitGen_PACKER_gen_bop_random_data(bops[i]->field, aes_key, challenges[i]);
+    if (key_ctr != nullptr) {
+      ctrs[i] = CFG_MEM_NEW(CFGOpenSSL_CTR, key_ctr, bop_max_threads);
+    }
+  }
+  if (key_ctr != nullptr) {
+    CFG_MEM_DELETE(key_ctr);
+  }
+  // Blocks are laid out straight in the buffer, make room for all of them: at
+  // most the uncompressed payloads and a block per action, plus hash blocks
+  std::vector<std::vector<uint8_t>> bop_data(bops.size());
+  size_t estimated_size = 0;
+  for (size_t i = 0; i < bops.size(); i++) {
+    size_t bop_estimated_size = BitGen_BITSTREAM_BLOCK_SIZE;
+    for (auto& action : bops[i]->actions) {
+      bop_estimated_size +=
+          action->payload.size() + BitGen_BITSTREAM_BLOCK_SIZE;
     }
-    while (bop_blocks.size()) {
-      CFG_MEM_DELETE(bop_blocks.back());
-      bop_blocks.pop_back();
+    bop_estimated_size += bop_estimated_size / 16;
+    if (i > 0) {
+      bop_data[i].reserve(bop_estimated_size);
     }
-    tracking_size.push_back(data.size() - temp_start_index);
+    estimated_size += bop_estimated_size;
+  }
+  data.reserve(data.size() + estimated_size);
+  // Track each BOP size
+  size_t start_index = data.size();
+  std::vector<size_t> tracking_size(bops.size());
+  CFG_run_in_parallel(bops.size(), bop_thread_count, [&](size_t i) {
+    std::vector<uint8_t>& buffer = i == 0 ? data : bop_data[i];
+    size_t temp_start_index = buffer.size();
+    BitGen_PACKER_gen_bop_bitstream(bops[i], buffer, compress, compress_level,
+                                    aes_key, challenges[i], ctrs[i], cache,
+                                    bop_max_threads);
+    tracking_size[i] = buffer.size() - temp_start_index;
+  });
+  // Put the BOPs together in order, then sign them one by one
+  for (size_t i = 1; i < bops.size(); i++) {
+    data.insert(data.end(), bop_data[i].begin(), bop_data[i].end());
+    memset(&bop_data[i][0], 0, bop_data[i].size());
+    bop_data[i].clear();
+  }
+  for (size_t i = 0, index = start_index; i < bops.size(); i++) {
+    BitGen_PACKER_sign(&data[index], key);
+    BitGen_PACKER_finalize(&data[index]);
+    index += tracking_size[i];
   }
   size_t total_size = data.size() - start_index;
   for (size_t i = 0, j = tracking_size.size() - 1; i < tracking_size.size();
@@ -532,6 +976,46 @@ void BitGen_PACKER::generate_bitstream(std::vector<BitGen_BITSTREAM_BOP*>& bops,
     start_index += tracking_size[i];
     total_size -= tracking_size[i];
   }
+  if (aes_key.size()) {
+    uint64_t encrypted_size = 0;
+    double encrypted_time = 0;
+    for (auto& ctr : ctrs) {
+      encrypted_size += ctr->get_total_size();
+      if (ctr->get_throughput() > 0) {
+        encrypted_time += (double)(ctr->get_total_size()) / (1024 * 1024) /
+                          ctr->get_throughput();
+      }
+      CFG_MEM_DELETE(ctr);
+    }
+    CFG_POST_DBG("AES-CTR: %ld bytes encrypted at %.1f MB/s",
+                 (size_t)(encrypted_size),
+                 encrypted_time > 0
+                     ? (double)(encrypted_size) / (1024 * 1024) / encrypted_time
+                     : 0.0);
+  }
+}
+
+void BitGen_PACKER::reset_compress_prediction(bool check) {
+  BitGen_PACKER_compress_prediction.check = check;
+  BitGen_PACKER_compress_prediction.kept = 0;
+  BitGen_PACKER_compress_prediction.dropped = 0;
+  BitGen_PACKER_compress_prediction.skipped = 0;
+  BitGen_PACKER_compress_prediction.wrongly_skipped = 0;
+}
+
+std::string BitGen_PACKER::get_compress_prediction_report() {
+  BitGen_PACKER_COMPRESS_PREDICTION& prediction =
+      BitGen_PACKER_compress_prediction;
+  std::string report = CFG_print(
+      "Compression prediction: %ld kept, %ld dropped (predicted compressible), "
+      "%ld skipped (predicted not compressible)",
+      (size_t)(prediction.kept), (size_t)(prediction.dropped),
+      (size_t)(prediction.skipped));
+  if (prediction.check) {
+    report = CFG_print("%s, %ld of them would have saved block(s)",
+                       report.c_str(), (size_t)(prediction.wrongly_skipped));
+  }
+  return report;
 }
 
 uint8_t BitGen_PACKER::get_feature_u8_enum(const std::string& feature) {
@@ -577,24 +1061,13 @@ void BitGen_PACKER::obscure(uint8_t* obscure_addr, const uint8_t* hash_addr) {
 
 uint64_t BitGen_PACKER::calc_checksum(std::vector<uint8_t>& data, uint8_t type,
                                       uint32_t& checksum_size) {
-  uint64_t checksum = 0;
-  if (type == 0x10) {
-    // Flecther-32
-    CFG_ASSERT(data.size() > 0 && (data.size() % 4) == 0);
-    uint16_t* data_ptr = reinterpret_cast<uint16_t*>(&data[0]);
-    size_t u16_length = data.size() / 2;
-    uint32_t c0 = 0;
-    uint32_t c1 = 0;
-    uint32_t type_checksum = 0;
-    for (size_t i = 0; i < u16_length;) {
-      c0 += data_ptr[i++];
-      c1 += c0;
-    }
-    type_checksum = (c1 << 16) | ((-(c1 + c0)) & 0x0000ffff);
-    checksum = (uint64_t)(type_checksum);
-    checksum_size = (uint64_t)(sizeof(type_checksum));
-  } else {
-    CFG_INTERNAL_ERROR("Does not support checksum type %d", type);
-  }
-  return checksum;
+  return calc_checksum(data.size() ? &data[0] : nullptr, data.size(), type,
+                       checksum_size);
+}
+
+uint64_t BitGen_PACKER::calc_checksum(const uint8_t* data, size_t size,
+                                      uint8_t type, uint32_t& checksum_size) {
+  BitGen_PACKER_CHECKSUM checksum(type);
+  checksum.update(data, size);
+  return checksum.get(checksum_size);
 }
@@ -1,11 +1,15 @@
 #ifndef BITGEN_PACKER_H
 #define BITGEN_PACKER_H
 
+#include <deque>
+
 #include "CFGCommonRS/CFGCommonRS.h"
 #include "CFGCrypto/CFGCrypto_key.h"
 
 #define BitGen_BITSTREAM_BLOCK_SIZE (2048)
 
+class BitGen_CACHE;
+
 struct BitGen_BITSTREAM_BOP_FIELD {
   ~BitGen_BITSTREAM_BOP_FIELD();
   std::string identifier = "";
@@ -44,21 +48,77 @@ enum BitGen_BITSTREAM_BLOCK_TYPE {
   BitGen_BITSTREAM_DATA_BLOCK
 };
 
+class BitGen_BITSTREAM_ARENA;
+
+// Block is a view of BitGen_BITSTREAM_BLOCK_SIZE bytes in the arena. The
+// arena may grow, which moves the data, hence the pointer returned by data()
+// is only good until the next block is added
 struct BitGen_BITSTREAM_BLOCK {
-  BitGen_BITSTREAM_BLOCK(BitGen_BITSTREAM_BLOCK_TYPE t);
-  ~BitGen_BITSTREAM_BLOCK();
+  BitGen_BITSTREAM_BLOCK(BitGen_BITSTREAM_BLOCK_TYPE t,
+                         BitGen_BITSTREAM_ARENA* a, size_t i)
+      : type(t), arena(a), index(i) {}
+  uint8_t* data();
   const BitGen_BITSTREAM_BLOCK_TYPE type;
-  std::vector<uint8_t> data;
-  uint8_t* hash_block_hash_data_ptr = nullptr;
+  BitGen_BITSTREAM_ARENA* const arena;
+  // Position in the BOP
+  const size_t index;
+};
+
+// Storage of all the blocks of a BOP, appended to the buffer and laid out
+// exactly as the final BOP: header, then the action and data blocks in the
+// order they are added, with the hash blocks in between. The position of the
+// hash blocks only depends on the number of blocks before them, so they are
+// reserved (as zeros) while the blocks are added, and filled by the end.
+class BitGen_BITSTREAM_ARENA {
+ public:
+  BitGen_BITSTREAM_ARENA(std::vector<uint8_t>& buffer, size_t hash_size);
+  ~BitGen_BITSTREAM_ARENA();
+  BitGen_BITSTREAM_BLOCK* get_header() { return &m_blocks.front(); }
+  // Add action or data block, with the hash block before it if it needs one
+  BitGen_BITSTREAM_BLOCK* add_block(BitGen_BITSTREAM_BLOCK_TYPE type);
+  // Number of action and data blocks
+  size_t get_block_count() { return m_block_count; }
+  // Remove the action and data blocks (and their hash blocks) after the
+  // first 'block_count' ones
+  void truncate(size_t block_count);
+  // Last block does not need a new hash block, its digest fits in the last
+  // one. No more block after this
+  void finalize();
+  // Header, hash, action and data blocks in the order of the BOP
+  std::deque<BitGen_BITSTREAM_BLOCK>& get_blocks() { return m_blocks; }
+  uint8_t* get_data(size_t index) {
+    return &m_buffer[m_start + index * BitGen_BITSTREAM_BLOCK_SIZE];
+  }
+  size_t get_size() { return m_blocks.size() * BitGen_BITSTREAM_BLOCK_SIZE; }
+  size_t get_hash_size() { return m_hash_size; }
+
+ private:
+  std::vector<uint8_t>& m_buffer;
+  const size_t m_start;
+  const size_t m_hash_size;
+  // Number of digests of action and data blocks in a hash block, the rest
+  // holds the digest of next hash block
+  const size_t m_group_size;
+  size_t m_block_count = 0;
+  bool m_finalized = false;
+  std::deque<BitGen_BITSTREAM_BLOCK> m_blocks;
 };
 
+inline uint8_t* BitGen_BITSTREAM_BLOCK::data() {
+  return arena->get_data(index);
+}
+
 class BitGen_PACKER {
  public:
   static int find_supported_bop_identifier(const std::string& identifier);
   static void generate_bitstream(std::vector<BitGen_BITSTREAM_BOP*>& bops,
                                  std::vector<uint8_t>& data, bool compress,
                                  std::vector<uint8_t>& aes_key,
-                                 CFGCrypto_KEY*& key);
+                                 CFGCrypto_KEY*& key,
+                                 CFG_COMPRESS_LEVEL compress_level =
+                                     CFG_COMPRESS_DEFAULT_LEVEL,
+                                 BitGen_CACHE* cache = nullptr,
+                                 size_t max_threads = 1);
   static void update_bitstream_end_size(uint8_t* const data,
                                         uint64_t ending_size, bool is_last_bop);
   static uint8_t get_feature_u8_enum(const std::string& feature);
@@ -69,6 +129,14 @@ class BitGen_PACKER {
   static void obscure(uint8_t* obscure_addr, const uint8_t* hash_addr);
   static uint64_t calc_checksum(std::vector<uint8_t>& data, uint8_t type,
                                 uint32_t& checksum_size);
+  static uint64_t calc_checksum(const uint8_t* data, size_t size,
+                                uint8_t type, uint32_t& checksum_size);
+  // Predicted versus actual outcome of compressing every action payload, to
+  // tune CFG_COMPRESS::predict_compressible(). When check is enabled, payload
+  // that is predicted not compressible is still compressed (and dropped) to
+  // find out whether the prediction was right.
+  static void reset_compress_prediction(bool check);
+  static std::string get_compress_prediction_report();
 };
 
 #endif
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include "BitGenerator.h"
 
 #include <map>
+#include <memory>
 
 #include "BitGen_analyzer.h"
+#include "BitGen_cache.h"
 #include "BitGen_gemini.h"
 #include "BitGen_json.h"
 #include "CFGCommonRS/CFGArgRS_auto.h"
@@ -34,6 +36,9 @@ bool BitGenerator_entry(const CFGCommon_ARG* cmdarg) {
   CFG_ASSERT(cmdarg->arg->m_name == "bitgen");
   auto arg = std::static_pointer_cast<CFGArg_BITGEN>(cmdarg->arg);
   std::vector<uint8_t> aes_key;
+  // Owned by unique_ptr, so that a failed generation (exception) does not
+  // leak it
+  std::unique_ptr<BitGen_CACHE> cache;
   CFG_POST_MSG("This is BITGEN entry");
   if (arg->get_sub_arg_name() == "gen_bitstream") {
     const CFGArg_BITGEN_GEN_BITSTREAM* subarg =
@@ -78,10 +83,23 @@ bool BitGenerator_entry(const CFGCommon_ARG* cmdarg) {
         BitGen_JSON::parse_bitstream(subarg->m_args[0], bops);
         CFG_ASSERT(bops.size())
       }
+      if (subarg->cache_dir.size()) {
+        cache = std::make_unique<BitGen_CACHE>(
+            subarg->cache_dir, (uint64_t)(subarg->cache_size) * 1024 * 1024);
+      }
       std::vector<uint8_t> data;
       std::string bitstream_error_msg = "";
-      BitGen_PACKER::generate_bitstream(bops, data, subarg->compress, aes_key,
-                                        key_ptr);
+      BitGen_PACKER::reset_compress_prediction(
+          subarg->check_compress_prediction);
+      BitGen_PACKER::generate_bitstream(
+          bops, data, subarg->compress, aes_key, key_ptr,
+          CFG_get_compress_level(subarg->compress_level), cache.get(),
+          CFG_get_thread_count(subarg->max_threads));
+      if (subarg->compress && subarg->check_compress_prediction) {
+        CFG_POST_MSG("%s",
+                     BitGen_PACKER::get_compress_prediction_report().c_str());
+        BitGen_PACKER::reset_compress_prediction(false);
+      }
       BitGen_ANALYZER::parse(data, true, true, bitstream_error_msg, false);
       CFG_ASSERT_MSG(bitstream_error_msg.empty(), bitstream_error_msg.c_str());
       CFG_write_binary_file(subarg->m_args[1], &data[0], data.size());
@@ -125,5 +143,9 @@ bool BitGenerator_entry(const CFGCommon_ARG* cmdarg) {
   }
   CFG_POST_MSG("BITGEN elapsed time: %.3f seconds",
                CFG_time_elapse(time_begin));
+  if (cache) {
+    CFG_POST_MSG("%s", cache->get_report().c_str());
+    cache.reset();
+  }
   return status;
 }
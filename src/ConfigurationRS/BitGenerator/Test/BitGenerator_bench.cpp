@@ -0,0 +1,144 @@
+#include <chrono>
+
+#include "BitGen_decompress_engine.h"
+#include "BitGen_packer.h"
+#include "CFGCommonRS/CFGCommonRS.h"
+#include "CFGCommonRS/Test/CFGCommonRS_test_helper.h"
+
+void bench_decompress() {
+  TEST_RANDOM random(0x87654321);
+  std::vector<uint8_t> data =
+      CFG_generate_test_data("token", 4 * 1024 * 1024, random);
+  std::vector<uint8_t> compressed;
+  CFG_compress(&data[0], data.size(), compressed, nullptr, false,
+               CFG_COMPRESS_MAX_LEVEL);
+  std::vector<uint8_t> expected;
+  auto begin = std::chrono::steady_clock::now();
+  CFG_decompress(&compressed[0], compressed.size(), expected, false);
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+  CFG_ASSERT(expected == data);
+  CFG_POST_MSG("CFG_decompress: %ld bytes in %.3f ms (%.1f MB/s)", data.size(),
+               elapsed * 1000, data.size() / elapsed / (1024 * 1024));
+  // The whole input and output in one window
+  BitGen_DECOMPRESS_ENGINE engine;
+  engine.reset();
+  std::vector<uint8_t> output(data.size());
+  size_t output_size = 0;
+  begin = std::chrono::steady_clock::now();
+  BitGen_DECOMPRESS_ENGINE_STATUS status =
+      engine.process(&compressed[0], compressed.size(), &output[0],
+                     output.size(), output_size);
+  elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          begin)
+                .count();
+  CFG_ASSERT(status == BitGen_DECOMPRESS_ENGINE_DONE_STATUS);
+  CFG_ASSERT(output_size == data.size() && output == data);
+  CFG_POST_MSG("Engine: %ld bytes in %.3f ms (%.1f MB/s)", output_size,
+               elapsed * 1000, output_size / elapsed / (1024 * 1024));
+}
+
+void bench_checksum() {
+  TEST_RANDOM random(0x2468ACE0);
+  // Straight 16 bits at a time Fletcher-32 as reference
+  auto fletcher32 = [](const std::vector<uint8_t>& data) {
+    uint32_t c0 = 0;
+    uint32_t c1 = 0;
+    for (size_t i = 0; i < data.size(); i += 2) {
+      c0 += (uint32_t)(data[i]) | ((uint32_t)(data[i + 1]) << 8);
+      c1 += c0;
+    }
+    return (c1 << 16) | ((-(c1 + c0)) & 0x0000ffff);
+  };
+  std::vector<uint8_t> data(32 * 1024 * 1024, 0xFF);
+  for (size_t i = 0; i < data.size(); i += 1 + (random() % 64)) {
+    data[i] = (uint8_t)(random());
+  }
+  auto begin = std::chrono::steady_clock::now();
+  uint32_t expected = fletcher32(data);
+  double reference_elapsed = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - begin)
+                                 .count();
+  begin = std::chrono::steady_clock::now();
+  uint32_t checksum_size = 0;
+  uint64_t checksum = BitGen_PACKER::calc_checksum(data, 0x10, checksum_size);
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+  CFG_ASSERT(checksum == expected);
+  CFG_POST_MSG("Fletcher-32 of %ld bytes: %.1f MB/s reference, %.1f MB/s",
+               data.size(), data.size() / reference_elapsed / 1048576,
+               data.size() / elapsed / 1048576);
+}
+
+void bench_hash() {
+  std::vector<BitGen_BITSTREAM_BOP*> bops;
+  BitGen_BITSTREAM_BOP* bop = CFG_MEM_NEW(BitGen_BITSTREAM_BOP);
+  bop->field.identifier = "FPGA";
+  bops.push_back(bop);
+  BitGen_BITSTREAM_ACTION* action =
+      CFG_MEM_NEW(BitGen_BITSTREAM_ACTION, (uint16_t)(0x101));
+  action->payload.resize(32 * 1024 * 1024 + 3);
+  for (size_t i = 0; i < action->payload.size(); i++) {
+    action->payload[i] = (uint8_t)(i * 31 + (i >> 11));
+  }
+  bop->actions.push_back(action);
+  std::vector<uint8_t> aes_key;
+  CFGCrypto_KEY* key = nullptr;
+  for (uint8_t integrity : {0x10, 0x11, 0x12}) {
+    bop->field.integrity = integrity;
+    int sha_size = integrity == 0x10 ? 256 : (integrity == 0x11 ? 384 : 512);
+    CFG_run_by_thread_count(
+        CFG_print("SHA-%d bitstream of %ld bytes", sha_size,
+                  action->payload.size()),
+        [&](size_t thread_count) {
+          std::vector<uint8_t> data;
+          BitGen_PACKER::generate_bitstream(bops, data, false, aes_key, key,
+                                            CFG_COMPRESS_DEFAULT_LEVEL,
+                                            nullptr, thread_count);
+        });
+  }
+  CFG_MEM_DELETE(bop);
+}
+
+void bench_bop() {
+  std::vector<BitGen_BITSTREAM_BOP*> bops;
+  std::vector<std::string> identifiers = {"FSBL", "FPGA", "ACPU", "UBT"};
+  std::vector<size_t> sizes = {3000, 8 * 1024 * 1024 + 1, 5, 1024 * 1024};
+  for (size_t i = 0; i < identifiers.size(); i++) {
+    BitGen_BITSTREAM_BOP* bop = CFG_MEM_NEW(BitGen_BITSTREAM_BOP);
+    bop->field.identifier = identifiers[i];
+    bop->field.integrity = (uint8_t)(0x10 + (i % 3));
+    BitGen_BITSTREAM_ACTION* action =
+        CFG_MEM_NEW(BitGen_BITSTREAM_ACTION, (uint16_t)(0x101));
+    action->payload.resize(sizes[i]);
+    for (size_t j = 0; j < sizes[i]; j++) {
+      action->payload[j] = (j % 7) ? 0 : (uint8_t)(j * 31 + i);
+    }
+    bop->actions.push_back(action);
+    bops.push_back(bop);
+  }
+  std::vector<uint8_t> aes_key;
+  CFGCrypto_KEY* key = nullptr;
+  CFG_run_by_thread_count(
+      CFG_print("%ld BOPs", bops.size()), [&](size_t thread_count) {
+        std::vector<uint8_t> data;
+        BitGen_PACKER::generate_bitstream(bops, data, true, aes_key, key,
+                                          CFG_COMPRESS_DEFAULT_LEVEL, nullptr,
+                                          thread_count);
+      });
+  while (bops.size()) {
+    CFG_MEM_DELETE(bops.back());
+    bops.pop_back();
+  }
+}
+
+int main(int argc, const char** argv) {
+  CFG_POST_MSG("This is BITGEN benchmark");
+  bench_decompress();
+  bench_checksum();
+  bench_hash();
+  bench_bop();
+  return 0;
+}
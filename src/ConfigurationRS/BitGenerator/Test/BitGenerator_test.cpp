@@ -1,6 +1,370 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include "BitGen_cache.h"
+#include "BitGen_decompress_engine.h"
+#include "BitGen_packer.h"
 #include "CFGCommonRS/CFGCommonRS.h"
+#include "CFGCommonRS/Test/CFGCommonRS_test_helper.h"
+
+bool decompress_by_engine(const std::vector<uint8_t>& input,
+                          size_t input_chunk, size_t output_chunk,
+                          std::vector<uint8_t>& output) {
+  // Feed the engine the way BitGen_ANALYZER does: small input windows, and
+  // the same input again whenever the output window is full
+  BitGen_DECOMPRESS_ENGINE engine;
+  engine.reset();
+  std::vector<uint8_t> buffer(output_chunk);
+  size_t index = 0;
+  BitGen_DECOMPRESS_ENGINE_STATUS status = BitGen_DECOMPRESS_ENGINE_GOOD_STATUS;
+  while (status == BitGen_DECOMPRESS_ENGINE_GOOD_STATUS ||
+         status == BitGen_DECOMPRESS_ENGINE_NEED_INPUT_STATUS) {
+    if (status == BitGen_DECOMPRESS_ENGINE_NEED_INPUT_STATUS) {
+      index += input_chunk;
+    }
+    if (index >= input.size()) {
+      return false;
+    }
+    size_t output_size = 0;
+    status = engine.process(&input[index],
+                            std::min(input_chunk, input.size() - index),
+                            &buffer[0], buffer.size(), output_size);
+    output.insert(output.end(), buffer.begin(), buffer.begin() + output_size);
+  }
+  return status == BitGen_DECOMPRESS_ENGINE_DONE_STATUS;
+}
+
+void test_decompress_engine() {
+  CFG_POST_MSG("Decompress Engine Test");
+  TEST_RANDOM random(0x87654321);
+  std::vector<uint8_t> data = CFG_generate_test_data("token", 300000, random);
+  std::vector<uint8_t> compressed;
+  CFG_compress(&data[0], data.size(), compressed, nullptr, false,
+               CFG_COMPRESS_DEFAULT_LEVEL);
+  std::vector<uint8_t> expected;
+  CFG_decompress(&compressed[0], compressed.size(), expected, false);
+  CFG_ASSERT(expected == data);
+  // Different windows must resume at the same place and give same result
+  const std::vector<std::pair<size_t, size_t>> windows = {
+      {1, 1}, {4, 3}, {4, 4096}, {5, 7}, {4096, 4}, {65536, 65536}};
+  for (auto& window : windows) {
+    std::vector<uint8_t> output;
+    CFG_ASSERT(decompress_by_engine(compressed, window.first, window.second,
+                                    output));
+    CFG_ASSERT(output == expected);
+  }
+}
+
+void test_cache() {
+  CFG_POST_MSG("Cache Test");
+  // Unique directory, so that test runs at the same time do not share it
+  std::random_device random_device;
+  std::string name = CFG_print("bitgen_cache_test_%08x%08x", random_device(),
+                               random_device());
+  std::string directory =
+      (std::filesystem::temp_directory_path() / name).string();
+  std::filesystem::remove_all(directory);
+  std::vector<uint8_t> payload(5000);
+  for (size_t i = 0; i < payload.size(); i++) {
+    payload[i] = (uint8_t)(i * 7);
+  }
+  std::vector<uint8_t> aes_key(16, 0x5A);
+  uint8_t iv[16] = {0};
+  std::vector<uint8_t> buffer;
+  BitGen_BITSTREAM_ARENA arena(buffer, 32);
+  std::vector<BitGen_BITSTREAM_BLOCK*> blocks;
+  for (size_t i = 0; i < payload.size(); i += BitGen_BITSTREAM_BLOCK_SIZE) {
+    blocks.push_back(arena.add_block(BitGen_BITSTREAM_DATA_BLOCK));
+    memcpy(blocks.back()->data(), &payload[i],
+           std::min(payload.size() - i, (size_t)(BitGen_BITSTREAM_BLOCK_SIZE)));
+  }
+  // Room for one entry of this payload only
+  BitGen_CACHE cache(directory, payload.size() * 3 / 2);
+  std::string key = cache.get_payload_key(&payload[0], payload.size(), true,
+                                          CFG_COMPRESS_DEFAULT_LEVEL);
+  // Everything that decides the content is part of the key
+  CFG_ASSERT(key != cache.get_payload_key(&payload[0], payload.size(), true,
+                                          CFG_COMPRESS_MAX_LEVEL));
+  CFG_ASSERT(key != cache.get_payload_key(&payload[0], payload.size(), false,
+                                          CFG_COMPRESS_DEFAULT_LEVEL));
+  CFG_ASSERT(key != cache.get_payload_key(&payload[0], payload.size() - 1,
+                                          true, CFG_COMPRESS_DEFAULT_LEVEL));
+  std::string encrypted_key = cache.get_encrypted_key(key, aes_key, iv);
+  iv[15] = 1;
+  CFG_ASSERT(encrypted_key != cache.get_encrypted_key(key, aes_key, iv));
+  std::vector<BitGen_BITSTREAM_BLOCK*> cached_blocks;
+  size_t size = 0;
+  bool compressed = false;
+  CFG_ASSERT(!cache.get(key, compressed, arena, cached_blocks, size));
+  CFG_ASSERT(cached_blocks.empty() && size == 0);
+  CFG_ASSERT(arena.get_block_count() == blocks.size());
+  cache.put(key, true, blocks, payload.size());
+  cache.put(encrypted_key, false, {}, 0);
+  CFG_ASSERT(cache.get(key, compressed, arena, cached_blocks, size));
+  CFG_ASSERT(compressed && size == payload.size());
+  CFG_ASSERT(cached_blocks.size() == blocks.size());
+  for (size_t i = 0; i < blocks.size(); i++) {
+    CFG_ASSERT(memcmp(cached_blocks[i]->data(), blocks[i]->data(),
+                      BitGen_BITSTREAM_BLOCK_SIZE) == 0);
+  }
+  arena.truncate(blocks.size());
+  cached_blocks.clear();
+  CFG_ASSERT(cache.get(encrypted_key, compressed, arena, cached_blocks, size));
+  CFG_ASSERT(!compressed && size == 0 && cached_blocks.empty());
+  // Least recently used entry goes first
+  std::filesystem::last_write_time(
+      std::filesystem::path(directory) / (key + ".cache"),
+      std::filesystem::file_time_type::clock::now() - std::chrono::hours(1));
+  std::string other_key = cache.get_payload_key(&payload[1], 100, true,
+                                                CFG_COMPRESS_DEFAULT_LEVEL);
+  cache.put(other_key, true, blocks, payload.size());
+  CFG_ASSERT(!cache.get(key, compressed, arena, cached_blocks, size));
+  CFG_ASSERT(cache.get(encrypted_key, compressed, arena, cached_blocks, size));
+  CFG_ASSERT(cache.get(other_key, compressed, arena, cached_blocks, size));
+  // Entry that does not match its SHA-256 is a miss
+  std::string filepath =
+      (std::filesystem::path(directory) / (other_key + ".cache")).string();
+  std::fstream file(filepath, std::ios::binary | std::ios::in | std::ios::out);
+  file.seekp(-1, std::ios::end);
+  file.put((char)(payload.back() ^ 1));
+  file.close();
+  cached_blocks.clear();
+  CFG_ASSERT(!cache.get(other_key, compressed, arena, cached_blocks, size));
+  CFG_ASSERT(cached_blocks.empty() && size == 0);
+  std::filesystem::remove_all(directory);
+  // Each action counts one hit or miss, and the compressed plain text of an
+  // encrypted bitstream is not stored
+  BitGen_CACHE action_cache(directory, payload.size() * 8);
+  std::vector<BitGen_BITSTREAM_BOP*> bops;
+  bops.push_back(CFG_MEM_NEW(BitGen_BITSTREAM_BOP));
+  bops.back()->field.identifier = "FPGA";
+  bops.back()->field.integrity = 0x10;
+  for (uint16_t action : {0x101, 0x102}) {
+    bops.back()->actions.push_back(
+        CFG_MEM_NEW(BitGen_BITSTREAM_ACTION, action));
+    bops.back()->actions.back()->payload = payload;
+    payload[0]++;
+  }
+  CFGCrypto_KEY* signing_key = nullptr;
+  for (size_t run = 0; run < 2; run++) {
+    std::vector<uint8_t> data;
+    memset(bops.back()->field.iv, 0xA5, sizeof(bops.back()->field.iv));
+    BitGen_PACKER::generate_bitstream(bops, data, true, aes_key, signing_key,
+                                      CFG_COMPRESS_DEFAULT_LEVEL,
+                                      &action_cache);
+  }
+  CFG_ASSERT(action_cache.get_hit_count() == 2);
+  CFG_ASSERT(action_cache.get_miss_count() == 2);
+  size_t entry_count = 0;
+  for (auto& entry : std::filesystem::directory_iterator(directory)) {
+    entry_count += entry.path().extension() == ".cache" ? 1 : 0;
+  }
+  CFG_ASSERT(entry_count == 2);
+  CFG_POST_MSG("%s", action_cache.get_report().c_str());
+  CFG_MEM_DELETE(bops.back());
+  std::filesystem::remove_all(directory);
+}
+
+void test_compress_prediction() {
+  CFG_POST_MSG("Compress Prediction Test");
+  TEST_RANDOM random(0x97531ECA);
+  std::vector<BitGen_BITSTREAM_BOP*> bops;
+  bops.push_back(CFG_MEM_NEW(BitGen_BITSTREAM_BOP));
+  bops.back()->field.identifier = "FPGA";
+  bops.back()->field.integrity = 0x10;
+  std::vector<std::vector<uint8_t>> payloads(4);
+  // Predicted compressible: sequence of 0's saves blocks, small random data
+  // does not
+  payloads[0].assign(64 * 1024, 0);
+  payloads[1].resize(4096);
+  // Predicted not compressible: random data, and random data with 0's in
+  // between the 1KB samples (64 of them, 16627 bytes apart in 1MB) that the
+  // prediction looks at, which would have saved blocks
+  payloads[2].resize(1024 * 1024);
+  payloads[3].resize(1024 * 1024);
+  for (size_t i = 1; i < payloads.size(); i++) {
+    for (auto& byte : payloads[i]) {
+      byte = (uint8_t)(random());
+    }
+  }
+  for (size_t i = 0; i < payloads[3].size(); i++) {
+    if ((i % 16627) >= 1024) {
+      payloads[3][i] = 0;
+    }
+  }
+  for (auto& payload : payloads) {
+    bops.back()->actions.push_back(
+        CFG_MEM_NEW(BitGen_BITSTREAM_ACTION, (uint16_t)(0x101)));
+    bops.back()->actions.back()->payload = payload;
+  }
+  std::vector<uint8_t> aes_key;
+  CFGCrypto_KEY* key = nullptr;
+  std::vector<uint8_t> expected;
+  BitGen_PACKER::reset_compress_prediction(false);
+  BitGen_PACKER::generate_bitstream(bops, expected, true, aes_key, key);
+  CFG_ASSERT(BitGen_PACKER::get_compress_prediction_report() ==
+             "Compression prediction: 1 kept, 1 dropped (predicted "
+             "compressible), 2 skipped (predicted not compressible)");
+  // Checking compresses the skipped payload too, but does not change the
+  // bitstream. Every run starts from zero.
+  for (size_t run = 0; run < 2; run++) {
+    std::vector<uint8_t> data;
+    BitGen_PACKER::reset_compress_prediction(true);
+    BitGen_PACKER::generate_bitstream(bops, data, true, aes_key, key);
+    CFG_ASSERT(data == expected);
+    CFG_ASSERT(BitGen_PACKER::get_compress_prediction_report() ==
+               "Compression prediction: 1 kept, 1 dropped (predicted "
+               "compressible), 2 skipped (predicted not compressible), 1 of "
+               "them would have saved block(s)");
+  }
+  BitGen_PACKER::reset_compress_prediction(false);
+  CFG_MEM_DELETE(bops.back());
+}
+
+void test_checksum() {
+  CFG_POST_MSG("Checksum Test");
+  TEST_RANDOM random(0x2468ACE0);
+  // Straight 16 bits at a time Fletcher-32 as reference, on every size up to
+  // a few KB and every alignment of the vectorized loads. Throughput is
+  // measured by bitgenerator_bench.
+  std::vector<uint8_t> buffer(3 * 1024 + 16);
+  for (auto& byte : buffer) {
+    // Mostly words with the upper bit set
+    byte = (uint8_t)(random() | ((random() % 4) ? 0x80 : 0));
+  }
+  for (size_t size = 4; size <= 3 * 1024; size += (size < 256 ? 4 : 36)) {
+    for (size_t offset = 0; offset < 16; offset += (size < 256 ? 1 : 5)) {
+      const uint8_t* data = &buffer[offset];
+      uint32_t c0 = 0;
+      uint32_t c1 = 0;
+      for (size_t i = 0; i < size; i += 2) {
+        c0 += (uint32_t)(data[i]) | ((uint32_t)(data[i + 1]) << 8);
+        c1 += c0;
+      }
+      uint32_t checksum_size = 0;
+      CFG_ASSERT(BitGen_PACKER::calc_checksum(data, size, 0x10,
+                                              checksum_size) ==
+                 ((c1 << 16) | ((-(c1 + c0)) & 0x0000ffff)));
+      CFG_ASSERT(checksum_size == 4);
+    }
+  }
+}
+
+void test_hash() {
+  CFG_POST_MSG("Hash Test");
+  // Digests computed on any number of threads give the same bitstream. Each
+  // thread hashes 64 blocks at a time, the big payload is just over two of
+  // them.
+  std::vector<BitGen_BITSTREAM_BOP*> bops;
+  BitGen_BITSTREAM_BOP* bop = CFG_MEM_NEW(BitGen_BITSTREAM_BOP);
+  bop->field.identifier = "FPGA";
+  bops.push_back(bop);
+  size_t group_size = 64 * BitGen_BITSTREAM_BLOCK_SIZE;
+  for (size_t size : {(size_t)(5), 2 * group_size + 10003}) {
+    BitGen_BITSTREAM_ACTION* action =
+        CFG_MEM_NEW(BitGen_BITSTREAM_ACTION, (uint16_t)(0x101));
+    action->payload.resize(size);
+    for (size_t i = 0; i < size; i++) {
+      action->payload[i] = (uint8_t)(i * 31 + (i >> 11));
+    }
+    bop->actions.push_back(action);
+  }
+  std::vector<uint8_t> aes_key;
+  CFGCrypto_KEY* key = nullptr;
+  for (uint8_t integrity : {0x10, 0x11, 0x12}) {
+    bop->field.integrity = integrity;
+    std::vector<uint8_t> expected;
+    for (size_t thread_count : {1, 2, 3, 4}) {
+      std::vector<uint8_t> data;
+      BitGen_PACKER::generate_bitstream(bops, data, false, aes_key, key,
+                                        CFG_COMPRESS_DEFAULT_LEVEL, nullptr,
+                                        thread_count);
+      if (expected.empty()) {
+        expected = data;
+      }
+      CFG_ASSERT(data == expected);
+    }
+  }
+  while (bops.size()) {
+    CFG_MEM_DELETE(bops.back());
+    bops.pop_back();
+  }
+}
+
+void test_bop() {
+  CFG_POST_MSG("BOP Test");
+  // BOPs generated on any number of threads are put together in order and
+  // give the same bitstream. FPGA BOP does not compress and is just over two
+  // hash groups, so it is hashed on more than one thread once every BOP has
+  // a thread of its own
+  std::vector<BitGen_BITSTREAM_BOP*> bops;
+  std::vector<std::string> identifiers = {"FSBL", "FPGA", "ACPU", "UBT"};
+  size_t group_size = 64 * BitGen_BITSTREAM_BLOCK_SIZE;
+  std::vector<size_t> sizes = {3000, 2 * group_size + 10003, 5, 70000};
+  TEST_RANDOM random(0x13572468);
+  for (size_t i = 0; i < identifiers.size(); i++) {
+    BitGen_BITSTREAM_BOP* bop = CFG_MEM_NEW(BitGen_BITSTREAM_BOP);
+    bop->field.identifier = identifiers[i];
+    bop->field.integrity = (uint8_t)(0x10 + (i % 3));
+    BitGen_BITSTREAM_ACTION* action =
+        CFG_MEM_NEW(BitGen_BITSTREAM_ACTION, (uint16_t)(0x101));
+    action->payload.resize(sizes[i]);
+    for (size_t j = 0; j < sizes[i]; j++) {
+      if (identifiers[i] == "FPGA") {
+        action->payload[j] = (uint8_t)(random());
+      } else {
+        action->payload[j] = (j % 7) ? 0 : (uint8_t)(j * 31 + i);
+      }
+    }
+    bop->actions.push_back(action);
+    bops.push_back(bop);
+  }
+  std::vector<uint8_t> aes_key;
+  CFGCrypto_KEY* key = nullptr;
+  std::vector<uint8_t> expected;
+  for (size_t thread_count : {1, 2, 3, 4, 8}) {
+    std::vector<uint8_t> data;
+    BitGen_PACKER::generate_bitstream(bops, data, true, aes_key, key,
+                                      CFG_COMPRESS_DEFAULT_LEVEL, nullptr,
+                                      thread_count);
+    if (expected.empty()) {
+      expected = data;
+      // Walk the BOPs by their size
+      size_t index = 0;
+      for (auto& identifier : identifiers) {
+        CFG_ASSERT((index + BitGen_BITSTREAM_BLOCK_SIZE) <= data.size());
+        CFG_ASSERT(memcmp(&data[index], identifier.c_str(),
+                          identifier.size()) == 0);
+        uint64_t size = 0;
+        memcpy(&size, &data[index + 0x8], sizeof(size));
+        index += (size_t)(size);
+      }
+      CFG_ASSERT(index == data.size());
+      // FPGA BOP is kept as it is
+      uint64_t fsbl_size = 0;
+      uint64_t fpga_size = 0;
+      memcpy(&fsbl_size, &data[0x8], sizeof(fsbl_size));
+      memcpy(&fpga_size, &data[(size_t)(fsbl_size) + 0x8], sizeof(fpga_size));
+      CFG_ASSERT(fpga_size > (2 * group_size));
+    }
+    CFG_ASSERT(data == expected);
+  }
+  while (bops.size()) {
+    CFG_MEM_DELETE(bops.back());
+    bops.pop_back();
+  }
+}
 
 int main(int argc, const char** argv) {
   CFG_POST_MSG("This is BITGEN unit test");
+  test_decompress_engine();
+  test_cache();
+  test_compress_prediction();
+  test_checksum();
+  test_hash();
+  test_bop();
   return 0;
 }
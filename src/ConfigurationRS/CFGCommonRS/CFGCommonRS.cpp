@@ -1,8 +1,12 @@
 #include "CFGCommonRS.h"
 
 #include <algorithm>
+#include <atomic>
+#include <exception>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #if defined(_MSC_VER) || defined(__MINGW32__) || defined(__CYGWIN__)
 #include <windows.h>
 #else
@@ -253,38 +257,35 @@ std::string CFG_print_strings_to_string(const std::vector<std::string>& strings,
 
 void CFG_compress(const uint8_t* input, const size_t input_size,
                   std::vector<uint8_t>& output, size_t* header_size,
-                  const bool debug, const bool retry) {
+                  const bool debug, const CFG_COMPRESS_LEVEL level) {
   CFG_ASSERT(input != nullptr);
   CFG_ASSERT(input_size > 0);
 
-  std::vector<uint8_t> cmp_output0;
-  size_t header_size0 = 0;
-  std::vector<uint8_t> cmp_output1;
-  size_t header_size1 = 0;
-  CFG_COMPRESS::compress(input, input_size, cmp_output0, &header_size0, true,
-                         debug);
-  if (retry) {
-    CFG_COMPRESS::compress(input, input_size, cmp_output1, &header_size1, false,
-                           debug);
-    if (debug) {
-      CFG_POST_DBG("Compressed size (with followup byte support): %ld",
-                   cmp_output0.size());
-      CFG_POST_DBG("Compressed size (without followup byte support): %ld",
-                   cmp_output1.size());
-    }
-  }
-  if (retry && (cmp_output0.size() > cmp_output1.size())) {
-    output.insert(output.end(), cmp_output1.begin(), cmp_output1.end());
+  size_t original_output_size = output.size();
+  if (level == CFG_COMPRESS_MAX_LEVEL) {
+    CFG_COMPRESS::compress_optimal(input, input_size, output, header_size,
+                                   debug);
+  } else if (level == CFG_COMPRESS_DEFAULT_LEVEL) {
+    // Both follow-up byte policies are evaluated in one scan
+    CFG_COMPRESS::compress_best(input, input_size, output, header_size, debug);
   } else {
-    output.insert(output.end(), cmp_output0.begin(), cmp_output0.end());
+    CFG_COMPRESS::compress(input, input_size, output, header_size, true, debug);
   }
-  if (header_size != nullptr) {
-    if (retry && (cmp_output0.size() > cmp_output1.size())) {
-      (*header_size) = header_size1;
-    } else {
-      (*header_size) = header_size0;
-    }
+  if (debug) {
+    CFG_POST_DBG("Compressed size (level %d): %ld", level,
+                 output.size() - original_output_size);
+  }
+}
+
+CFG_COMPRESS_LEVEL CFG_get_compress_level(const std::string& level) {
+  if (level == "fast") {
+    return CFG_COMPRESS_FAST_LEVEL;
+  } else if (level == "max") {
+    return CFG_COMPRESS_MAX_LEVEL;
   }
+  CFG_ASSERT_MSG(level.empty() || level == "default",
+                 "Invalid compression level '%s'", level.c_str());
+  return CFG_COMPRESS_DEFAULT_LEVEL;
 }
 
 void CFG_decompress(const uint8_t* input, const size_t input_size,
@@ -294,23 +295,91 @@ void CFG_decompress(const uint8_t* input, const size_t input_size,
   CFG_COMPRESS::decompress(input, input_size, output, debug);
 }
 
+// Slice-by-8: table[k][i] is the LFSR value of byte i followed by k zero
+// bytes, so that 8 bytes are looked up independently and XOR-ed together
+// instead of 8 dependent lookups
+template <typename T>
+struct CFG_CRC_SLICE_TABLE {
+  CFG_CRC_SLICE_TABLE(const T* base_table) {
+    memcpy(table[0], base_table, sizeof(table[0]));
+    for (size_t k = 1; k < 8; k++) {
+      for (size_t i = 0; i < 256; i++) {
+        table[k][i] =
+            (table[k - 1][i] >> 8) ^ base_table[table[k - 1][i] & 0xFF];
+      }
+    }
+  }
+  T table[8][256];
+};
+
+// Slice table is only derived for the built-in tables, which are known to be
+// linear. Any other custom table is processed one byte at a time.
+static const CFG_CRC_SLICE_TABLE<uint16_t>* CFG_get_crc_slice_table(
+    const uint16_t* table) {
+  static const CFG_CRC_SLICE_TABLE<uint16_t> TABLE_8408(
+      CFGCommonRS_CRC_8408_TABLE);
+  static const CFG_CRC_SLICE_TABLE<uint16_t> TABLE_A001(
+      CFGCommonRS_CRC_A001_TABLE);
+  if (table == CFGCommonRS_CRC_8408_TABLE) {
+    return &TABLE_8408;
+  } else if (table == CFGCommonRS_CRC_A001_TABLE) {
+    return &TABLE_A001;
+  }
+  return nullptr;
+}
+
+static const CFG_CRC_SLICE_TABLE<uint32_t>* CFG_get_crc_slice_table(
+    const uint32_t* table) {
+  static const CFG_CRC_SLICE_TABLE<uint32_t> TABLE_04C11DB7(
+      CFGCommonRS_CRC_04C11DB7_TABLE);
+  if (table == CFGCommonRS_CRC_04C11DB7_TABLE) {
+    return &TABLE_04C11DB7;
+  }
+  return nullptr;
+}
+
+template <typename T>
+static T CFG_crc_update(T crc, const uint8_t* addr, size_t size,
+                        const T* table) {
+  const CFG_CRC_SLICE_TABLE<T>* slice = CFG_get_crc_slice_table(table);
+  if (slice != nullptr) {
+    for (; size >= 8; size -= 8, addr += 8) {
+      // LFSR is at most 8 bytes, the upper bytes of shorter one are zero
+      uint64_t lfsr = crc;
+      crc = slice->table[7][addr[0] ^ (uint8_t)(lfsr)] ^
+            slice->table[6][addr[1] ^ (uint8_t)(lfsr >> 8)] ^
+            slice->table[5][addr[2] ^ (uint8_t)(lfsr >> 16)] ^
+            slice->table[4][addr[3] ^ (uint8_t)(lfsr >> 24)] ^
+            slice->table[3][addr[4] ^ (uint8_t)(lfsr >> 32)] ^
+            slice->table[2][addr[5] ^ (uint8_t)(lfsr >> 40)] ^
+            slice->table[1][addr[6] ^ (uint8_t)(lfsr >> 48)] ^
+            slice->table[0][addr[7] ^ (uint8_t)(lfsr >> 56)];
+    }
+  }
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(uint8_t(crc) ^ addr[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
 uint16_t CFG_crc16(const uint8_t* addr, size_t size, uint16_t lfsr_init,
                    bool final_xor, const uint16_t* custom_table) {
   CFG_ASSERT(addr != nullptr && size > 0);
-  uint16_t crc(lfsr_init);
-  uint8_t table_index = 0;
-  const uint16_t* TABLE =
-      custom_table == nullptr ? CFGCommonRS_CRC_8408_TABLE : custom_table;
-  for (size_t i = 0; i < size; i++) {
-    table_index = (uint8_t(crc) ^ addr[i]) & 0xFF;
-    crc = TABLE[table_index] ^ (crc >> 8);
-  }
+  uint16_t crc = CFG_crc16_update(lfsr_init, addr, size, custom_table);
   if (final_xor) {
     crc ^= 0xFFFF;
   }
   return crc;
 }
 
+uint16_t CFG_crc16_update(uint16_t crc, const uint8_t* addr, size_t size,
+                          const uint16_t* custom_table) {
+  CFG_ASSERT(addr != nullptr || size == 0);
+  return CFG_crc_update<uint16_t>(
+      crc, addr, size,
+      custom_table == nullptr ? CFGCommonRS_CRC_8408_TABLE : custom_table);
+}
+
 uint16_t CFG_bop_A001_crc16(const uint8_t* addr, size_t size,
                             uint16_t lfsr_init, bool final_xor,
                             const uint16_t* custom_table) {
@@ -322,20 +391,21 @@ uint16_t CFG_bop_A001_crc16(const uint8_t* addr, size_t size,
 uint32_t CFG_crc32(const uint8_t* addr, size_t size, uint32_t lfsr_init,
                    bool final_xor, const uint32_t* custom_table) {
   CFG_ASSERT(addr != nullptr && size > 0);
-  uint32_t crc(lfsr_init);
-  uint8_t table_index = 0;
-  const uint32_t* TABLE =
-      custom_table == nullptr ? CFGCommonRS_CRC_04C11DB7_TABLE : custom_table;
-  for (size_t i = 0; i < size; i++) {
-    table_index = (uint8_t(crc) ^ addr[i]) & 0xFF;
-    crc = TABLE[table_index] ^ (crc >> 8);
-  }
+  uint32_t crc = CFG_crc32_update(lfsr_init, addr, size, custom_table);
   if (final_xor) {
     crc ^= 0xFFFFFFFF;
   }
   return crc;
 }
 
+uint32_t CFG_crc32_update(uint32_t crc, const uint8_t* addr, size_t size,
+                          const uint32_t* custom_table) {
+  CFG_ASSERT(addr != nullptr || size == 0);
+  return CFG_crc_update<uint32_t>(
+      crc, addr, size,
+      custom_table == nullptr ? CFGCommonRS_CRC_04C11DB7_TABLE : custom_table);
+}
+
 template <typename T>
 static void CFG_append_T(std::vector<uint8_t>& data, T value) {
   for (size_t i = 0; i < sizeof(T); i++) {
@@ -629,6 +699,53 @@ uint64_t CFG_get_unique_nano_time() {
   return time;
 }
 
+size_t CFG_get_thread_count(int max_threads) {
+  if (max_threads > 0) {
+    return (size_t)(max_threads);
+  }
+  return std::max((size_t)(std::thread::hardware_concurrency()), (size_t)(1));
+}
+
+void CFG_run_in_parallel(size_t count, size_t thread_count,
+                         const std::function<void(size_t)>& function) {
+  thread_count = std::min(thread_count, count);
+  if (thread_count <= 1) {
+    for (size_t index = 0; index < count; index++) {
+      function(index);
+    }
+    return;
+  }
+  // Every thread picks the next index until there is none left
+  std::atomic<size_t> next_index{0};
+  std::exception_ptr exception = nullptr;
+  std::mutex mutex;
+  auto worker = [&]() {
+    for (size_t index = next_index++; index < count; index = next_index++) {
+      try {
+        function(index);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (exception == nullptr) {
+          exception = std::current_exception();
+        }
+        // Stop the others from picking up more
+        next_index = count;
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (exception != nullptr) {
+    std::rethrow_exception(exception);
+  }
+}
+
 void CFG_TRACK_MEM(void* ptr, const char* filename, size_t line) {
   bool status = true;
   for (CFG_MEM_TRACKER* tracker : CFG_MEM_TRACKER_LIST) {
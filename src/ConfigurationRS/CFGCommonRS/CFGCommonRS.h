@@ -2,6 +2,7 @@
 #define CFGCommonRS_H
 
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <vector>
 
@@ -23,9 +24,21 @@ std::string CFG_convert_bytes_to_hex_string(uint8_t* data, size_t size,
 std::string CFG_print_strings_to_string(const std::vector<std::string>& strings,
                                         const std::string& seperator);
 
+enum CFG_COMPRESS_LEVEL {
+  // Greedy, single pass with follow-up byte support
+  CFG_COMPRESS_FAST_LEVEL,
+  // Greedy, best of with and without follow-up byte support
+  CFG_COMPRESS_DEFAULT_LEVEL,
+  // Minimum size (optimal parse), much slower
+  CFG_COMPRESS_MAX_LEVEL
+};
+
 void CFG_compress(const uint8_t* input, const size_t input_size,
                   std::vector<uint8_t>& output, size_t* header_size = nullptr,
-                  const bool debug = false, const bool retry = true);
+                  const bool debug = false,
+                  const CFG_COMPRESS_LEVEL level = CFG_COMPRESS_DEFAULT_LEVEL);
+
+CFG_COMPRESS_LEVEL CFG_get_compress_level(const std::string& level);
 
 void CFG_decompress(const uint8_t* input, const size_t input_size,
                     std::vector<uint8_t>& output, const bool debug = false);
@@ -44,6 +57,16 @@ uint32_t CFG_crc32(const uint8_t* addr, size_t size,
                    bool final_xor = true,
                    const uint32_t* custom_table = nullptr);
 
+// Incremental form: feed the LFSR value of previous call (or lfsr_init for the
+// first one), then apply final XOR to the last one. For example
+// CFG_crc32(data, 10) is CFG_crc32_update(CFG_crc32_update(-1, data, 4),
+// &data[4], 6) ^ 0xFFFFFFFF
+uint16_t CFG_crc16_update(uint16_t crc, const uint8_t* addr, size_t size,
+                          const uint16_t* custom_table = nullptr);
+
+uint32_t CFG_crc32_update(uint32_t crc, const uint8_t* addr, size_t size,
+                          const uint32_t* custom_table = nullptr);
+
 void CFG_append_u8(std::vector<uint8_t>& data, uint8_t value);
 
 void CFG_append_u16(std::vector<uint8_t>& data, uint16_t value);
@@ -84,6 +107,16 @@ uint64_t CFG_get_nano_time();
 
 uint64_t CFG_get_unique_nano_time();
 
+// Number of threads to run with: max_threads if it is positive, otherwise all
+// the hardware threads
+size_t CFG_get_thread_count(int max_threads);
+
+// Call function(index) for every index from 0 to count - 1 on up to
+// thread_count threads, the calling thread included. Exception thrown by any
+// of the calls is re-thrown here once all the threads are done
+void CFG_run_in_parallel(size_t count, size_t thread_count,
+                         const std::function<void(size_t)>& function);
+
 void CFG_TRACK_MEM(void* ptr, const char* filename, size_t line);
 void CFG_UNTRACK_MEM(void* ptr, const char* filename, size_t line);
 
@@ -1,13 +1,29 @@
 #include "CFGCompress.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 
 #include "CFGCommonRS.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CFG_CMP_SSE2
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
 #define CFG_CMP_MIN_REPEAT_LENGTH_SEARCH (3)
 #define CFG_CMP_MAX_REPEAT_LENGTH_SEARCH (50)
 #define CFG_CMP_MAX_REPEAT_SAME_PATTERN (100)
 #define CFG_CMP_MAX_NONE_LENGTH_FOR_REPEAT_PATTERN (2048)
+// A token never reads more than a few chunks beyond where it ends
+#define CFG_CMP_STREAM_LOOKAHEAD (4096)
+#define CFG_CMP_PREDICT_SAMPLE_SIZE (1024)
+#define CFG_CMP_PREDICT_MIN_SAMPLE_COUNT (16)
+#define CFG_CMP_PREDICT_MAX_SAMPLE_COUNT (256)
 #define CFG_CMP_NONE (0)
 #define CFG_CMP_ZERO (1)
 #define CFG_CMP_ZERO_VAR (2)
@@ -18,6 +34,43 @@
 #define CFG_CMP_VAR (7)
 #define CFG_CMP_INVALID (8)
 
+size_t CFG_COMPRESS::scan_same_byte(const uint8_t* input, const size_t size,
+                                    const uint8_t byte) {
+  size_t index = 0;
+#if defined(CFG_CMP_SSE2)
+  const __m128i pattern = _mm_set1_epi8((char)(byte));
+  for (; (index + 16) <= size; index += 16) {
+    __m128i data = _mm_loadu_si128((const __m128i*)(&input[index]));
+    uint32_t mask =
+        (uint32_t)(_mm_movemask_epi8(_mm_cmpeq_epi8(data, pattern))) ^ 0xFFFF;
+    if (mask) {
+#if defined(_MSC_VER)
+      unsigned long bit = 0;
+      _BitScanForward(&bit, mask);
+      return index + bit;
+#else
+      return index + __builtin_ctz(mask);
+#endif
+    }
+  }
+#else
+  // Portable fallback: compare 8 bytes at a time, locate the mismatch byte
+  // by byte
+  uint64_t pattern = 0x0101010101010101ULL * byte;
+  for (; (index + 8) <= size; index += 8) {
+    uint64_t data = 0;
+    memcpy(&data, &input[index], sizeof(data));
+    if (data != pattern) {
+      break;
+    }
+  }
+#endif
+  while (index < size && input[index] == byte) {
+    index++;
+  }
+  return index;
+}
+
 void CFG_COMPRESS::analyze_repeat(const uint8_t* input, const size_t input_size,
                                   size_t index, size_t& length, size_t& repeat,
                                   const uint8_t debug) {
@@ -27,50 +80,43 @@ void CFG_COMPRESS::analyze_repeat(const uint8_t* input, const size_t input_size,
   if (total_length < (2 * CFG_CMP_MIN_REPEAT_LENGTH_SEARCH)) {
     return;
   }
+  // Long sequence of same byte is left to compress_none_repeat()
+  const uint8_t* chunk0 = &input[index];
+  size_t same_byte_length =
+      1 + scan_same_byte(&chunk0[1],
+                         std::min(total_length,
+                                  (size_t)(CFG_CMP_MAX_REPEAT_SAME_PATTERN)) -
+                             1,
+                         chunk0[0]);
+  if (same_byte_length >= CFG_CMP_MAX_REPEAT_SAME_PATTERN) {
+    return;
+  }
+  // Look for the smallest chunk length that is repeated right after itself.
+  // Only the lengths where the next chunk starts with the same byte can
+  // match, memchr() jumps straight from one candidate to the next
+  size_t max_length = std::min((size_t)(CFG_CMP_MAX_REPEAT_LENGTH_SEARCH),
+                               (size_t)(total_length / 2));
   size_t temp_length = CFG_CMP_MIN_REPEAT_LENGTH_SEARCH;
-  uint8_t repeated_check_seq = 0;
-  uint8_t repeated_byte = input[index];
-  size_t repeated_check_index = index;
-  size_t repeated_check_size = 0;
-  while (temp_length <= (size_t)(total_length / 2)) {
-    if (length == 0 && temp_length > CFG_CMP_MAX_REPEAT_LENGTH_SEARCH) {
+  while (temp_length <= max_length) {
+    const uint8_t* candidate = (const uint8_t*)(memchr(
+        &chunk0[temp_length], chunk0[0], max_length - temp_length + 1));
+    if (candidate == nullptr) {
       break;
     }
-    size_t chunk0_start = index;
-    CFG_ASSERT(chunk0_start < input_size);
-    CFG_ASSERT((chunk0_start + temp_length) < input_size);
-    size_t chunk1_start = chunk0_start + temp_length;
-    CFG_ASSERT(chunk1_start < input_size);
-    CFG_ASSERT((chunk1_start + temp_length) <= input_size);
-    if (repeated_check_seq == 0) {
-      repeated_check_seq = 1;
-      for (uint32_t i = 0; i < (2 * CFG_CMP_MIN_REPEAT_LENGTH_SEARCH);
-           i++, repeated_check_index++, repeated_check_size++) {
-        if (input[repeated_check_index] != repeated_byte) {
-          repeated_check_seq = 2;
-          break;
-        }
-      }
-    } else if (repeated_check_seq == 1) {
-      if (input[repeated_check_index++] == repeated_byte &&
-          input[repeated_check_index++] == repeated_byte) {
-        repeated_check_size += 2;
-        if (repeated_check_size >= CFG_CMP_MAX_REPEAT_SAME_PATTERN) {
-          length = 0;
-          repeat = 0;
-          break;
-        }
-      } else {
-        repeated_check_seq = 2;
-      }
-    }
-    if (memcmp(&input[chunk0_start], &input[chunk1_start], temp_length) == 0) {
+    temp_length = (size_t)(candidate - chunk0);
+    CFG_ASSERT((index + 2 * temp_length) <= input_size);
+    if (memcmp(chunk0, &chunk0[temp_length], temp_length) == 0) {
       length = temp_length;
-    } else if (length) {
       break;
     }
     temp_length++;
   }
+  if (length && same_byte_length >= (2 * (length + 1))) {
+    // Two consecutive lengths can only both repeat when the data is a single
+    // byte (Fine and Wilf), so the chunk keeps growing for as long as the
+    // sequence of same byte can hold two of them
+    length = same_byte_length / 2;
+  }
   if (length) {
     // We found repeated pattern
     size_t chunk0_start = index;
@@ -249,7 +295,12 @@ size_t CFG_COMPRESS::compress_none_repeat(const uint8_t* input,
       compress_size++;
     } else if (compress_byte == input[index]) {
       if (compress_size) {
-        compress_size++;
+        // Skip over the whole sequence of same byte at once
+        size_t same_byte_length =
+            scan_same_byte(&input[index], input_size - index, compress_byte);
+        compress_size += same_byte_length;
+        index += same_byte_length;
+        continue;
       } else {
         CFG_ASSERT(uncompress_size >= 2);
         CFG_ASSERT(index >= uncompress_size);
@@ -265,13 +316,10 @@ size_t CFG_COMPRESS::compress_none_repeat(const uint8_t* input,
       if (compress_size == 1) {
         if ((input[index] == 0 || input[index] == 0xFF) &&
             ((index + 1) < input_size) && (input[index] == input[index + 1])) {
-          for (end_index = index + 1; end_index < input_size; end_index++) {
-            if (input[index] == input[end_index]) {
-              compress_size++;
-            } else {
-              break;
-            }
-          }
+          end_index = index + 1;
+          end_index += scan_same_byte(&input[end_index],
+                                      input_size - end_index, input[index]);
+          compress_size += (end_index - index - 1);
           CFG_ASSERT(compress_size >= 2);
           if (debug) {
             CFG_POST_DBG("Compress 0x%02X followed by %ld data of 0x%02X",
@@ -340,6 +388,93 @@ size_t CFG_COMPRESS::compress_none_repeat(const uint8_t* input,
   return end_index;
 }
 
+size_t CFG_COMPRESS::compress_token(const uint8_t* input,
+                                    const size_t input_size,
+                                    std::vector<uint8_t>& output, size_t index,
+                                    const bool support_followup_byte,
+                                    const uint8_t debug, bool* followup) {
+  CFG_ASSERT(index < input_size);
+  if (followup != nullptr) {
+    (*followup) = false;
+  }
+  size_t length = 0;
+  size_t repeat = 0;
+  analyze_repeat(input, input_size, index, length, repeat, debug);
+  if (length) {
+    CFG_ASSERT(repeat > 0);
+    size_t chunk_pattern =
+        analyze_chunk_pattern(input, input_size, index, length);
+    CFG_ASSERT(chunk_pattern < CFG_CMP_INVALID);
+    if (chunk_pattern == CFG_CMP_ZERO || chunk_pattern == CFG_CMP_HIGH ||
+        chunk_pattern == CFG_CMP_VAR) {
+      // There might be more 0's or FF's
+      length = length * (repeat + 1);
+      uint8_t compress_byte = chunk_pattern == CFG_CMP_VAR
+                                  ? input[index]
+                                  : (chunk_pattern == CFG_CMP_ZERO ? 0 : 0xFF);
+      index += length;
+      int followup_byte = -1;
+      size_t same_byte_length =
+          scan_same_byte(&input[index], input_size - index, compress_byte);
+      index += same_byte_length;
+      length += same_byte_length;
+      while (index < input_size) {
+        if (input[index] == compress_byte) {
+          length++;
+        } else if (chunk_pattern == CFG_CMP_VAR) {
+          break;
+        } else if (!support_followup_byte) {
+          break;
+        } else {
+          followup_byte = int(input[index]) & 0xFF;
+        }
+        index++;
+        if (followup_byte != -1) {
+          break;
+        }
+      }
+      if (followup != nullptr) {
+        (*followup) = followup_byte != -1;
+      }
+      compress_data(output, compress_byte, length, followup_byte, debug,
+                    "   ");
+    } else {
+      compress_repeat_chunk(input, input_size, output, index, chunk_pattern,
+                            length, repeat);
+      index += (length * (repeat + 1));
+      CFG_ASSERT(index <= input_size);
+      if (debug) {
+        CFG_POST_DBG("   Pattern: %ld", chunk_pattern);
+      }
+    }
+  } else {
+    CFG_ASSERT(repeat == 0);
+    index = compress_none_repeat(input, input_size, output, index, debug);
+  }
+  return index;
+}
+
+void CFG_COMPRESS::write_header(const size_t input_size,
+                                const size_t compress_size,
+                                std::vector<uint8_t>& output) {
+  const std::vector<uint8_t> header = {'C', 'F', 'G', '_', 'C', 'M', 'P', 0};
+  output.insert(output.end(), header.begin(), header.end());
+  CFG_write_variable_u64(output, (uint64_t)(input_size));
+  CFG_write_variable_u64(output, (uint64_t)(compress_size));
+}
+
+void CFG_COMPRESS::finalize(const size_t input_size,
+                            const std::vector<uint8_t>& temp_output,
+                            std::vector<uint8_t>& output,
+                            size_t* header_size) {
+  size_t original_output_size = output.size();
+  write_header(input_size, temp_output.size(), output);
+  if (header_size != nullptr) {
+    (*header_size) = output.size() - original_output_size;
+  }
+  output.insert(output.end(), temp_output.begin(), temp_output.end());
+}
+
 void CFG_COMPRESS::compress(const uint8_t* input, const size_t input_size,
                             std::vector<uint8_t>& output, size_t* header_size,
                             const bool support_followup_byte,
@@ -348,67 +483,313 @@ void CFG_COMPRESS::compress(const uint8_t* input, const size_t input_size,
   std::vector<uint8_t> temp_output;
   size_t index = 0;
   while (index < input_size) {
-    size_t length = 0;
-    size_t repeat = 0;
-    analyze_repeat(input, input_size, index, length, repeat, debug);
-    if (length) {
-      CFG_ASSERT(repeat > 0);
-      size_t chunk_pattern =
-          analyze_chunk_pattern(input, input_size, index, length);
-      CFG_ASSERT(chunk_pattern < CFG_CMP_INVALID);
-      if (chunk_pattern == CFG_CMP_ZERO || chunk_pattern == CFG_CMP_HIGH ||
-          chunk_pattern == CFG_CMP_VAR) {
-        // There might be more 0's or FF's
-        length = length * (repeat + 1);
-        uint8_t compress_byte =
-            chunk_pattern == CFG_CMP_VAR
-                ? input[index]
-                : (chunk_pattern == CFG_CMP_ZERO ? 0 : 0xFF);
-        index += length;
-        int followup_byte = -1;
-        while (index < input_size) {
-          if (input[index] == compress_byte) {
-            length++;
-          } else if (chunk_pattern == CFG_CMP_VAR) {
-            break;
-          } else if (!support_followup_byte) {
-            break;
-          } else {
-            followup_byte = int(input[index]) & 0xFF;
-          }
-          index++;
-          if (followup_byte != -1) {
-            break;
-          }
-        }
-        compress_data(temp_output, compress_byte, length, followup_byte, debug,
-                      "   ");
+    index = compress_token(input, input_size, temp_output, index,
+                           support_followup_byte, debug);
+  }
+  CFG_ASSERT(index == input_size);
+  finalize(input_size, temp_output, output, header_size);
+}
+
+size_t CFG_COMPRESS::compress_best_segment(
+    const uint8_t* input, const size_t input_size, std::vector<uint8_t>& output,
+    size_t index, std::vector<uint8_t>& followup_segment,
+    std::vector<uint8_t>& no_followup_segment, const uint8_t debug) {
+  size_t token_start = output.size();
+  bool followup = false;
+  size_t followup_index = compress_token(input, input_size, output, index,
+                                         true, debug, &followup);
+  if (followup) {
+    // Move the token out, it only belongs to the follow-up byte policy
+    followup_segment.assign(output.begin() + token_start, output.end());
+    output.resize(token_start);
+    no_followup_segment.clear();
+    size_t no_followup_index = compress_token(
+        input, input_size, no_followup_segment, index, false, debug);
+    while (followup_index != no_followup_index) {
+      if (followup_index < no_followup_index) {
+        followup_index = compress_token(input, input_size, followup_segment,
+                                        followup_index, true, debug);
       } else {
-        compress_repeat_chunk(input, input_size, temp_output, index,
-                              chunk_pattern, length, repeat);
-        index += (length * (repeat + 1));
-        CFG_ASSERT(index <= input_size);
-        if (debug) {
-          CFG_POST_DBG("   Pattern: %ld", chunk_pattern);
-        }
+        no_followup_index =
+            compress_token(input, input_size, no_followup_segment,
+                           no_followup_index, false, debug);
       }
-    } else {
-      CFG_ASSERT(repeat == 0);
-      index =
-          compress_none_repeat(input, input_size, temp_output, index, debug);
     }
+    std::vector<uint8_t>& segment =
+        followup_segment.size() <= no_followup_segment.size()
+            ? followup_segment
+            : no_followup_segment;
+    output.insert(output.end(), segment.begin(), segment.end());
+  }
+  return followup_index;
+}
+
+void CFG_COMPRESS::compress_best(const uint8_t* input, const size_t input_size,
+                                 std::vector<uint8_t>& output,
+                                 size_t* header_size, const uint8_t debug) {
+  CFG_ASSERT(input != nullptr && input_size > 0);
+  // The token only depends on where it starts. Both policies share every
+  // token until one with follow-up byte is found, then each policy goes on
+  // on its own until both reach the same index again. The smaller encoding
+  // of that segment is kept and the shared scan resumes from there.
+  std::vector<uint8_t> temp_output;
+  std::vector<uint8_t> followup_segment;
+  std::vector<uint8_t> no_followup_segment;
+  size_t index = 0;
+  while (index < input_size) {
+    index = compress_best_segment(input, input_size, temp_output, index,
+                                  followup_segment, no_followup_segment,
+                                  debug);
   }
   CFG_ASSERT(index == input_size);
-  // Finalize
-  const std::vector<uint8_t> header = {'C', 'F', 'G', '_', 'C', 'M', 'P', 0};
-  size_t original_output_size = output.size();
-  output.insert(output.end(), header.begin(), header.end());
-  CFG_write_variable_u64(output, (uint64_t)(input_size));
-  CFG_write_variable_u64(output, (uint64_t)(temp_output.size()));
-  if (header_size != nullptr) {
-    (*header_size) = output.size() - original_output_size;
+  finalize(input_size, temp_output, output, header_size);
+}
+
+// Token picked by compress_optimal() at each input index
+struct CFG_COMPRESS_TOKEN {
+  uint32_t length = 0;
+  uint32_t repeat = 0;
+  uint8_t pattern = CFG_CMP_INVALID;
+  bool repeat_chunk = false;
+};
+
+// Number of bytes written by CFG_write_variable_u64()
+static size_t CFG_COMPRESS_variable_u64_size(uint64_t value) {
+  size_t size = 1;
+  for (value >>= 7; value; value >>= 7) {
+    size++;
   }
-  output.insert(output.end(), temp_output.begin(), temp_output.end());
+  return size;
+}
+
+// Sliding window minimum of cost[j] (+ j when weighted) over [first, last].
+// The window only moves toward the start of the input, as the optimal parse
+// is solved from the end of the input.
+class CFG_COMPRESS_WINDOW {
+ public:
+  CFG_COMPRESS_WINDOW(const std::vector<uint32_t>& cost, bool weighted)
+      : m_cost(cost), m_weighted(weighted) {}
+  void reset() {
+    m_entries.clear();
+    m_front = 0;
+    m_next = (size_t)(-1);
+  }
+  bool get_min(size_t first, size_t last, size_t& min_value,
+               size_t& min_index) {
+    if (first > last) {
+      return false;
+    }
+    for (size_t j = std::min(m_next, last + 1); j-- > first;) {
+      size_t value = m_cost[j] + (m_weighted ? j : 0);
+      while (m_entries.size() > m_front && m_entries.back().first >= value) {
+        m_entries.pop_back();
+      }
+      m_entries.push_back({value, j});
+    }
+    m_next = first;
+    while (m_entries.size() > m_front && m_entries[m_front].second > last) {
+      m_front++;
+    }
+    if (m_front == m_entries.size()) {
+      reset();
+      m_next = first;
+      return false;
+    }
+    if (m_front > 4096 && m_front > (m_entries.size() / 2)) {
+      m_entries.erase(m_entries.begin(), m_entries.begin() + m_front);
+      m_front = 0;
+    }
+    min_value = m_entries[m_front].first;
+    min_index = m_entries[m_front].second;
+    return true;
+  }
+
+ private:
+  const std::vector<uint32_t>& m_cost;
+  const bool m_weighted;
+  std::vector<std::pair<size_t, size_t>> m_entries;
+  size_t m_front = 0;
+  size_t m_next = (size_t)(-1);
+};
+
+void CFG_COMPRESS::compress_optimal(const uint8_t* input,
+                                    const size_t input_size,
+                                    std::vector<uint8_t>& output,
+                                    size_t* header_size, const uint8_t debug) {
+  CFG_ASSERT(input != nullptr && input_size > 0);
+  CFG_ASSERT(input_size < (size_t)(0x80000000));
+  // Shortest path from every index to the end of the input, solved
+  // backward: cost[i] is the minimum encoded size of input[i:]. Every token
+  // the decoder knows is considered at every index. The flag size depends on
+  // the token length, so lengths are grouped by flag size and the best end
+  // of each group comes from a sliding window minimum.
+  std::vector<uint32_t> cost(input_size + 1, 0);
+  std::vector<CFG_COMPRESS_TOKEN> tokens(input_size);
+  std::vector<std::pair<size_t, size_t>> groups;
+  for (size_t flag_size = 1, first = 1; first <= input_size; flag_size++) {
+    size_t last = ((size_t)(1) << (7 * flag_size - 4)) - 1;
+    groups.push_back({first, last});
+    first = last + 1;
+  }
+  std::vector<CFG_COMPRESS_WINDOW> literal_windows(
+      groups.size(), CFG_COMPRESS_WINDOW(cost, true));
+  std::vector<CFG_COMPRESS_WINDOW> same_byte_windows(
+      groups.size(), CFG_COMPRESS_WINDOW(cost, false));
+  // matches[m] is how far input[j] == input[j + m] holds from the index
+  std::vector<uint32_t> matches(CFG_CMP_MAX_REPEAT_LENGTH_SEARCH + 1, 0);
+  size_t same_byte_end = input_size;
+  size_t next_same_byte_length = 0;
+  size_t next_same_byte_cost = 0;
+  size_t next_same_byte_token_length = 0;
+  for (size_t i = input_size; i-- > 0;) {
+    const uint8_t byte = input[i];
+    const bool zero_or_high = byte == 0 || byte == 0xFF;
+    if ((i + 1) == input_size || input[i + 1] != byte) {
+      same_byte_end = i + 1;
+      for (auto& window : same_byte_windows) {
+        window.reset();
+      }
+    }
+    const size_t same_byte_length = same_byte_end - i;
+    // Branchless, any chunk repeated right after itself is rare
+    uint32_t repeated = 0;
+    for (uint32_t m = 1; m <= CFG_CMP_MAX_REPEAT_LENGTH_SEARCH; m++) {
+      uint32_t match = (i + m) < input_size && input[i + m] == byte;
+      matches[m] = (matches[m] + 1) & -match;
+      repeated |=
+          (uint32_t)(matches[m] >= m) & (uint32_t)(m > same_byte_length);
+    }
+    size_t best_cost = (size_t)(-1);
+    CFG_COMPRESS_TOKEN best;
+    auto consider = [&](size_t candidate_cost, CFG_COMPRESS_TOKEN token) {
+      if (candidate_cost < best_cost) {
+        best_cost = candidate_cost;
+        best = token;
+      }
+    };
+    // NONE: data as it is
+    for (size_t g = 0; g < groups.size(); g++) {
+      size_t min_value = 0;
+      size_t min_index = 0;
+      if (literal_windows[g].get_min(
+              i + groups[g].first,
+              std::min(i + groups[g].second, input_size), min_value,
+              min_index)) {
+        CFG_COMPRESS_TOKEN token;
+        token.length = (uint32_t)(min_index - i);
+        token.pattern = CFG_CMP_NONE;
+        consider(g + 1 + min_value - i, token);
+      }
+    }
+    // ZERO, HIGH or VAR: sequence of same byte
+    size_t same_byte_cost = (size_t)(-1);
+    size_t same_byte_token_length = 0;
+    for (size_t g = 0; g < groups.size(); g++) {
+      size_t min_value = 0;
+      size_t min_index = 0;
+      if (same_byte_windows[g].get_min(
+              i + groups[g].first,
+              std::min(i + groups[g].second, same_byte_end), min_value,
+              min_index) &&
+          (g + 1 + min_value) < same_byte_cost) {
+        same_byte_cost = g + 1 + min_value;
+        same_byte_token_length = min_index - i;
+      }
+    }
+    CFG_ASSERT(same_byte_token_length);
+    CFG_COMPRESS_TOKEN token;
+    token.length = (uint32_t)(same_byte_token_length);
+    token.pattern = byte == 0 ? CFG_CMP_ZERO
+                              : (byte == 0xFF ? CFG_CMP_HIGH : CFG_CMP_VAR);
+    consider(same_byte_cost + (zero_or_high ? 0 : 1), token);
+    // ZERO-VAR or HIGH-VAR: whole sequence of 0's or FF's and the next byte
+    if (zero_or_high && same_byte_end < input_size) {
+      token.length = (uint32_t)(same_byte_length);
+      token.pattern = byte == 0 ? CFG_CMP_ZERO_VAR : CFG_CMP_HIGH_VAR;
+      consider(CFG_COMPRESS_variable_u64_size(same_byte_length << 4) + 1 +
+                   cost[same_byte_end + 1],
+               token);
+    }
+    // VAR-ZERO or VAR-HIGH: this byte and the 0's or FF's after it
+    if ((i + 1) < input_size && input[i + 1] != byte &&
+        (input[i + 1] == 0 || input[i + 1] == 0xFF)) {
+      token.length = (uint32_t)(next_same_byte_token_length);
+      token.pattern = input[i + 1] == 0 ? CFG_CMP_VAR_ZERO : CFG_CMP_VAR_HIGH;
+      consider(next_same_byte_cost + 1, token);
+    }
+    // Repeated chunk
+    for (size_t m = CFG_CMP_MIN_REPEAT_LENGTH_SEARCH;
+         repeated && m <= CFG_CMP_MAX_REPEAT_LENGTH_SEARCH; m++) {
+      if (matches[m] < m || same_byte_length >= m) {
+        continue;
+      }
+      size_t unit_cost = 0;
+      token.pattern = CFG_CMP_NONE;
+      if (zero_or_high && same_byte_length == (m - 1)) {
+        token.pattern = byte == 0 ? CFG_CMP_ZERO_VAR : CFG_CMP_HIGH_VAR;
+      } else if (input[i + 1] != byte &&
+                 (input[i + 1] == 0 || input[i + 1] == 0xFF) &&
+                 next_same_byte_length >= (m - 1)) {
+        token.pattern = input[i + 1] == 0 ? CFG_CMP_VAR_ZERO : CFG_CMP_VAR_HIGH;
+      }
+      if (token.pattern == CFG_CMP_NONE) {
+        unit_cost = CFG_COMPRESS_variable_u64_size((m << 4) | 0x08) + m;
+      } else {
+        unit_cost = CFG_COMPRESS_variable_u64_size(((m - 1) << 4) | 0x08) + 1;
+      }
+      token.length = (uint32_t)(m);
+      token.repeat_chunk = true;
+      size_t max_repeat = matches[m] / m;
+      for (size_t repeat = max_repeat;
+           repeat > 0 && (repeat + 2) > max_repeat; repeat--) {
+        token.repeat = (uint32_t)(repeat);
+        consider(unit_cost + CFG_COMPRESS_variable_u64_size(repeat) +
+                     cost[i + m * (repeat + 1)],
+                 token);
+      }
+      token.repeat_chunk = false;
+      token.repeat = 0;
+    }
+    CFG_ASSERT(best.pattern != CFG_CMP_INVALID);
+    CFG_ASSERT(best_cost < (size_t)(0xFFFFFFFF));
+    cost[i] = (uint32_t)(best_cost);
+    tokens[i] = best;
+    next_same_byte_length = same_byte_length;
+    next_same_byte_cost = same_byte_cost;
+    next_same_byte_token_length = same_byte_token_length;
+  }
+  // Follow the shortest path
+  std::vector<uint8_t> temp_output;
+  temp_output.reserve(cost[0]);
+  size_t index = 0;
+  while (index < input_size) {
+    const CFG_COMPRESS_TOKEN& token = tokens[index];
+    if (token.repeat_chunk) {
+      compress_repeat_chunk(input, input_size, temp_output, index,
+                            token.pattern, token.length, token.repeat);
+      index += (size_t)(token.length) * (token.repeat + 1);
+    } else if (token.pattern == CFG_CMP_NONE) {
+      pack_data(input, input_size, temp_output, index, token.length, debug);
+      index += token.length;
+    } else if (token.pattern == CFG_CMP_VAR_ZERO ||
+               token.pattern == CFG_CMP_VAR_HIGH) {
+      uint64_t flag = ((uint64_t)(token.length) << 4) | token.pattern;
+      CFG_write_variable_u64(temp_output, flag);
+      temp_output.push_back(input[index]);
+      index += (token.length + 1);
+    } else if (token.pattern == CFG_CMP_ZERO_VAR ||
+               token.pattern == CFG_CMP_HIGH_VAR) {
+      compress_data(temp_output, input[index], token.length,
+                    int(input[index + token.length]) & 0xFF, debug, "");
+      index += (token.length + 1);
+    } else {
+      compress_data(temp_output, input[index], token.length, -1, debug, "");
+      index += token.length;
+    }
+    CFG_ASSERT(index <= input_size);
+  }
+  CFG_ASSERT(temp_output.size() == cost[0]);
+  finalize(input_size, temp_output, output, header_size);
 }
 
 void CFG_COMPRESS::decompress(const uint8_t* input, const size_t input_size,
@@ -425,21 +806,25 @@ void CFG_COMPRESS::decompress(const uint8_t* input, const size_t input_size,
   CFG_ASSERT(original_size > 0);
   CFG_ASSERT(compress_size > 0);
   CFG_ASSERT((index + compress_size) <= input_size);
-  // Do not use std::vector, so that firmware can implement the same
+  // Do not use std::vector, so that firmware can implement the same:
+  // the output is sized once and every token is written with memset/memcpy
   size_t output_original_size = output.size();
+  output.resize(output_original_size + original_size);
+  uint8_t* data = &output[output_original_size];
+  size_t data_index = 0;
   size_t end_index = index + compress_size;
   while (index < end_index) {
     uint64_t flag = CFG_read_variable_u64(input, end_index, index);
     uint64_t pattern = flag & 0x7;
     uint64_t repeat = (flag & 0x8) != 0;
     size_t length = (size_t)(flag >> 4);
-    size_t temp_output_index = output.size();
+    size_t temp_output_index = data_index;
     if (pattern == CFG_CMP_NONE) {
-      for (uint64_t i = 0; i < length; i++) {
-        CFG_ASSERT(index < end_index);
-        output.push_back(input[index]);
-        index++;
-      }
+      CFG_ASSERT(length <= (end_index - index));
+      CFG_ASSERT(length <= (original_size - data_index));
+      memcpy(&data[data_index], &input[index], length);
+      data_index += length;
+      index += length;
     } else {
       uint8_t compress_byte = 0;
       if (pattern == CFG_CMP_VAR) {
@@ -450,35 +835,182 @@ void CFG_COMPRESS::decompress(const uint8_t* input, const size_t input_size,
                  pattern == CFG_CMP_HIGH_VAR) {
         compress_byte = 0xFF;
       }
-      if (pattern == CFG_CMP_VAR_ZERO || pattern == CFG_CMP_VAR_HIGH) {
+      bool var_first =
+          pattern == CFG_CMP_VAR_ZERO || pattern == CFG_CMP_VAR_HIGH;
+      bool var_last =
+          pattern == CFG_CMP_ZERO_VAR || pattern == CFG_CMP_HIGH_VAR;
+      CFG_ASSERT((length + (var_first || var_last ? 1 : 0)) <=
+                 (original_size - data_index));
+      if (var_first) {
         CFG_ASSERT(index < end_index);
-        output.push_back(input[index]);
+        data[data_index++] = input[index];
         index++;
       }
-      for (size_t i = 0; i < length; i++) {
-        output.push_back(compress_byte);
-      }
-      if (pattern == CFG_CMP_ZERO_VAR || pattern == CFG_CMP_HIGH_VAR) {
+      memset(&data[data_index], compress_byte, length);
+      data_index += length;
+      if (var_last) {
         CFG_ASSERT(index < end_index);
-        output.push_back(input[index]);
+        data[data_index++] = input[index];
         index++;
       }
-      if (pattern == CFG_CMP_VAR_ZERO || pattern == CFG_CMP_VAR_HIGH ||
-          pattern == CFG_CMP_ZERO_VAR || pattern == CFG_CMP_HIGH_VAR) {
+      if (var_first || var_last) {
         length++;
       }
     }
-    CFG_ASSERT(length == (output.size() - temp_output_index));
+    CFG_ASSERT(length == (data_index - temp_output_index));
     if (repeat) {
       size_t repeat_size =
           (size_t)(CFG_read_variable_u64(input, end_index, index));
+      CFG_ASSERT(length == 0 ||
+                 repeat_size <= ((original_size - data_index) / length));
       for (uint64_t i = 0; i < repeat_size; i++) {
-        output.insert(output.end(), output.begin() + temp_output_index,
-                      output.begin() + temp_output_index + length);
+        memcpy(&data[data_index], &data[temp_output_index], length);
+        data_index += length;
       }
     }
   }
   CFG_ASSERT(index == end_index);
-  size_t uncompress_size = output.size() - output_original_size;
-  CFG_ASSERT(uncompress_size == original_size);
-}
\ No newline at end of file
+  CFG_ASSERT(data_index == original_size);
+}
+bool CFG_COMPRESS::predict_compressible(const uint8_t* input,
+                                        const size_t input_size) {
+  CFG_ASSERT(input != nullptr);
+  // Small input is cheap to compress anyway
+  size_t sample_count = input_size / (16 * CFG_CMP_PREDICT_SAMPLE_SIZE);
+  if (sample_count < CFG_CMP_PREDICT_MIN_SAMPLE_COUNT) {
+    return true;
+  }
+  sample_count = std::min(sample_count,
+                          (size_t)(CFG_CMP_PREDICT_MAX_SAMPLE_COUNT));
+  size_t stride = (input_size - CFG_CMP_PREDICT_SAMPLE_SIZE) /
+                  (sample_count - 1);
+  std::vector<size_t> histogram(256, 0);
+  std::vector<size_t> sample_histogram(256);
+  for (size_t i = 0; i < sample_count; i++) {
+    const uint8_t* sample = &input[i * stride];
+    std::fill(sample_histogram.begin(), sample_histogram.end(), 0);
+    // Sequence of same byte, or chunk repeated right after itself, both show
+    // up as byte equal to one of the previous few bytes. Random data only
+    // does so for 1/256 of the bytes per distance.
+    size_t repeat_count = 0;
+    for (size_t j = 0; j < CFG_CMP_PREDICT_SAMPLE_SIZE; j++) {
+      sample_histogram[sample[j]]++;
+      if (j >= 4 && (sample[j] == sample[j - 1] || sample[j] == sample[j - 2] ||
+                     sample[j] == sample[j - 3] ||
+                     sample[j] == sample[j - 4])) {
+        repeat_count++;
+      }
+    }
+    if (repeat_count > (4 * 4 * CFG_CMP_PREDICT_SAMPLE_SIZE / 256)) {
+      return true;
+    }
+    // Random sample has no byte value that is much more frequent
+    for (size_t j = 0; j < 256; j++) {
+      if (sample_histogram[j] > (8 * CFG_CMP_PREDICT_SAMPLE_SIZE / 256)) {
+        return true;
+      }
+      histogram[j] += sample_histogram[j];
+    }
+  }
+  // Entropy of all the samples together, random data is very close to 8 bits
+  double entropy = 0;
+  double total = (double)(sample_count * CFG_CMP_PREDICT_SAMPLE_SIZE);
+  for (auto& count : histogram) {
+    if (count) {
+      double p = count / total;
+      entropy -= p * std::log2(p);
+    }
+  }
+  return entropy < 7.9;
+}
+
+CFG_COMPRESS_STREAM::CFG_COMPRESS_STREAM(const uint8_t debug)
+    : m_debug(debug), m_retry_size(2 * CFG_CMP_STREAM_LOOKAHEAD) {}
+
+CFG_COMPRESS_STREAM::~CFG_COMPRESS_STREAM() {
+  if (m_input.size()) {
+    memset(&m_input[0], 0, m_input.size());
+  }
+  if (m_output.size()) {
+    memset(&m_output[0], 0, m_output.size());
+  }
+}
+
+void CFG_COMPRESS_STREAM::feed(const uint8_t* input, const size_t input_size) {
+  CFG_ASSERT(!m_finished);
+  CFG_ASSERT(input != nullptr && input_size > 0);
+  // Drop the input that had been compressed before it grows
+  if (m_input_index && m_input_index >= (m_input.size() - m_input_index)) {
+    memset(&m_input[0], 0, m_input_index);
+    m_input.erase(m_input.begin(), m_input.begin() + m_input_index);
+    m_input_index = 0;
+  }
+  m_input.insert(m_input.end(), input, input + input_size);
+  m_input_size += input_size;
+  compress(false);
+}
+
+void CFG_COMPRESS_STREAM::finish() {
+  CFG_ASSERT(!m_finished);
+  CFG_ASSERT(m_input_size > 0);
+  compress(true);
+  CFG_ASSERT(m_input_index == m_input.size());
+  memset(&m_input[0], 0, m_input.size());
+  m_input.clear();
+  m_input_index = 0;
+  m_finished = true;
+}
+
+void CFG_COMPRESS_STREAM::compress(const bool last) {
+  while (m_input_index < m_input.size()) {
+    size_t pending_size = m_input.size() - m_input_index;
+    if (!last && pending_size < m_retry_size) {
+      break;
+    }
+    size_t output_size = m_output.size();
+    size_t index = CFG_COMPRESS::compress_best_segment(
+        &m_input[0], m_input.size(), m_output, m_input_index,
+        m_followup_segment, m_no_followup_segment, m_debug);
+    if (!last && (index + CFG_CMP_STREAM_LOOKAHEAD) > m_input.size()) {
+      // The segment might have been cut by the end of the input fed so far.
+      // Throw it away and try again once the pending input doubles, so that
+      // a long segment is not compressed over and over.
+      m_output.resize(output_size);
+      m_retry_size = 2 * pending_size;
+      break;
+    }
+    m_retry_size = 2 * CFG_CMP_STREAM_LOOKAHEAD;
+    m_output_size += m_output.size() - output_size;
+    m_input_index = index;
+  }
+}
+
+size_t CFG_COMPRESS_STREAM::get_available_size() const {
+  return m_output.size() - m_output_index;
+}
+
+size_t CFG_COMPRESS_STREAM::drain(uint8_t* output, const size_t output_size) {
+  CFG_ASSERT(output != nullptr);
+  size_t size = std::min(output_size, m_output.size() - m_output_index);
+  if (size) {
+    memcpy(output, &m_output[m_output_index], size);
+    m_output_index += size;
+  }
+  // Drop the output that had been drained once it is most of the buffer
+  if (m_output_index && m_output_index >= (m_output.size() - m_output_index)) {
+    memset(&m_output[0], 0, m_output_index);
+    m_output.erase(m_output.begin(), m_output.begin() + m_output_index);
+    m_output_index = 0;
+  }
+  return size;
+}
+
+void CFG_COMPRESS_STREAM::get_header(std::vector<uint8_t>& header) const {
+  CFG_ASSERT(m_finished);
+  CFG_COMPRESS::write_header(m_input_size, m_output_size, header);
+}
+
+size_t CFG_COMPRESS_STREAM::get_max_header_size() {
+  // Identifier, version and two variable length 64 bits sizes
+  return 8 + 10 + 10;
+}
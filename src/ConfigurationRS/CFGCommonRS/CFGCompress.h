@@ -12,13 +12,54 @@ class CFG_COMPRESS {
                        size_t* header_size = nullptr,
                        const bool support_followup_byte = false,
                        const uint8_t debug = 0);
+  // Same as compress() with and without follow-up byte support, but done in
+  // a single scan that keeps the smaller encoding of every segment where the
+  // two differ. Never bigger than the smaller of the two.
+  static void compress_best(const uint8_t* input, const size_t input_size,
+                            std::vector<uint8_t>& output,
+                            size_t* header_size = nullptr,
+                            const uint8_t debug = 0);
+  // Minimum size encoding: shortest path parse over all the token types,
+  // instead of committing to the first pattern found
+  static void compress_optimal(const uint8_t* input, const size_t input_size,
+                               std::vector<uint8_t>& output,
+                               size_t* header_size = nullptr,
+                               const uint8_t debug = 0);
   static void decompress(const uint8_t* input, const size_t input_size,
                          std::vector<uint8_t>& output, const uint8_t debug = 0);
+  // Cheap guess whether compression is worth trying, from the entropy and
+  // the sequences of same byte of evenly spread samples. Only data that looks
+  // random in every sample is predicted as not compressible.
+  static bool predict_compressible(const uint8_t* input,
+                                   const size_t input_size);
 
  private:
+  friend class CFG_COMPRESS_STREAM;
   static void analyze_repeat(const uint8_t* input, const size_t input_size,
                              size_t index, size_t& length, size_t& repeat,
                              const uint8_t debug);
+  // Number of leading bytes of input[0:size] equal to byte, 16 bytes at a
+  // time when SSE2 is available
+  static size_t scan_same_byte(const uint8_t* input, const size_t size,
+                               const uint8_t byte);
+  static size_t compress_token(const uint8_t* input, const size_t input_size,
+                               std::vector<uint8_t>& output, size_t index,
+                               const bool support_followup_byte,
+                               const uint8_t debug, bool* followup = nullptr);
+  // One segment of compress_best(): a token shared by both follow-up byte
+  // policies, or the smaller encoding of the two policies until they meet
+  static size_t compress_best_segment(const uint8_t* input,
+                                      const size_t input_size,
+                                      std::vector<uint8_t>& output,
+                                      size_t index,
+                                      std::vector<uint8_t>& followup_segment,
+                                      std::vector<uint8_t>& no_followup_segment,
+                                      const uint8_t debug);
+  static void write_header(const size_t input_size, const size_t compress_size,
+                           std::vector<uint8_t>& output);
+  static void finalize(const size_t input_size,
+                       const std::vector<uint8_t>& temp_output,
+                       std::vector<uint8_t>& output, size_t* header_size);
   static size_t analyze_chunk_pattern(const uint8_t* input,
                                       const size_t input_size, size_t index,
                                       size_t length);
@@ -39,4 +80,39 @@ class CFG_COMPRESS {
                         size_t length, const bool debug);
 };
 
+// Push-style version of CFG_COMPRESS::compress_best(). Input is fed in
+// pieces of any size and the compressed data is drained as soon as it can no
+// longer change, so only a window of the input and of the output is kept.
+// The header carries both sizes and is only known after finish(), the
+// drained data excludes it. Header followed by the drained data is the same
+// as compress_best() of the whole input.
+class CFG_COMPRESS_STREAM {
+ public:
+  CFG_COMPRESS_STREAM(const uint8_t debug = 0);
+  ~CFG_COMPRESS_STREAM();
+  void feed(const uint8_t* input, const size_t input_size);
+  void finish();
+  size_t get_available_size() const;
+  size_t drain(uint8_t* output, const size_t output_size);
+  void get_header(std::vector<uint8_t>& header) const;
+  size_t get_input_size() const { return m_input_size; }
+  size_t get_output_size() const { return m_output_size; }
+  // Largest header get_header() can return
+  static size_t get_max_header_size();
+
+ private:
+  void compress(const bool last);
+  const uint8_t m_debug = 0;
+  std::vector<uint8_t> m_input;
+  size_t m_input_index = 0;
+  size_t m_retry_size = 0;
+  std::vector<uint8_t> m_output;
+  size_t m_output_index = 0;
+  std::vector<uint8_t> m_followup_segment;
+  std::vector<uint8_t> m_no_followup_segment;
+  size_t m_input_size = 0;
+  size_t m_output_size = 0;
+  bool m_finished = false;
+};
+
 #endif
@@ -0,0 +1,63 @@
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+#include "CFGCommonRS.h"
+#include "CFGCommonRS_test_helper.h"
+#include "CFGCompress.h"
+
+void bench_compression(const std::string& name,
+                       const std::vector<uint8_t>& input) {
+  const std::vector<std::string> levels = {"fast", "default", "max"};
+  size_t fast_size = 0;
+  auto begin = std::chrono::steady_clock::now();
+  bool compressible =
+      CFG_COMPRESS::predict_compressible(&input[0], input.size());
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+  CFG_POST_MSG("Predict %s: %s in %.3f ms", name.c_str(),
+               compressible ? "compressible" : "not compressible",
+               elapsed * 1000);
+  for (auto& level : levels) {
+    std::vector<uint8_t> output;
+    std::vector<uint8_t> output_output;
+    begin = std::chrono::steady_clock::now();
+    CFG_compress(&input[0], input.size(), output, nullptr, false,
+                 CFG_get_compress_level(level));
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            begin)
+                  .count();
+    CFG_decompress(&output[0], output.size(), output_output, false);
+    CFG_ASSERT(input == output_output);
+    if (fast_size == 0) {
+      fast_size = output.size();
+    }
+    CFG_POST_MSG(
+        "Compress %s (%s): %ld -> %ld bytes (ratio %.2f%%, %.2f%% smaller "
+        "than fast) in %.3f ms (%.1f MB/s)",
+        name.c_str(), level.c_str(), input.size(), output.size(),
+        output.size() * 100.0 / input.size(),
+        ((double)(fast_size) - output.size()) * 100.0 / fast_size,
+        elapsed * 1000, input.size() / elapsed / (1024 * 1024));
+  }
+}
+
+int main(int argc, const char** argv) {
+  CFG_POST_MSG("This is CFGCommon benchmark");
+  TEST_RANDOM random(0x12345678);
+  for (auto& type : {"fabric", "sparse", "unused", "random"}) {
+    bench_compression(CFG_print("synthetic %s", type),
+                      CFG_generate_test_data(type, 4 * 1024 * 1024, random));
+  }
+  // Optionally benchmark real bitstream(s): <bench> <bitstream file> ...
+  for (int i = 1; i < argc; i++) {
+    std::ifstream file(argv[i], std::ios::binary);
+    CFG_ASSERT_MSG(file.is_open(), "Fail to open %s", argv[i]);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+                              std::istreambuf_iterator<char>());
+    CFG_ASSERT(data.size());
+    bench_compression(argv[i], data);
+  }
+  return 0;
+}
@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <chrono>
+
 #include "CFGCommonRS.h"
+#include "CFGCommonRS_test_helper.h"
+#include "CFGCompress.h"
 
 void test_case_compression(uint32_t& index, std::vector<uint8_t> input) {
   CFG_POST_MSG("********************** Test Case #%d **********************",
@@ -6,13 +11,35 @@ void test_case_compression(uint32_t& index, std::vector<uint8_t> input) {
   std::vector<uint8_t> output;
   std::vector<uint8_t> output_output;
   size_t header_size = 0;
-  CFG_compress(&input[0], input.size(), output, &header_size, true, false);
+  CFG_compress(&input[0], input.size(), output, &header_size, true,
+               CFG_COMPRESS_FAST_LEVEL);
   CFG_ASSERT(header_size < output.size());
   CFG_decompress(&output[0], output.size(), output_output, true);
   CFG_ASSERT(input.size() == output_output.size());
   CFG_ASSERT(memcmp(&input[0], &output_output[0], input.size()) == 0);
   CFG_POST_MSG("!!! Result: Input (%ld) vs Output (%ld) [Header Size: %ld]",
                input.size(), output.size() - header_size, header_size);
+  // Single scan of both follow-up byte policies is never bigger than the
+  // smaller of the two
+  std::vector<uint8_t> best_output;
+  std::vector<uint8_t> no_followup_output;
+  CFG_compress(&input[0], input.size(), best_output, nullptr, false,
+               CFG_COMPRESS_DEFAULT_LEVEL);
+  CFG_COMPRESS::compress(&input[0], input.size(), no_followup_output, nullptr,
+                         false);
+  CFG_ASSERT(best_output.size() <= output.size());
+  CFG_ASSERT(best_output.size() <= no_followup_output.size());
+  output_output.clear();
+  CFG_decompress(&best_output[0], best_output.size(), output_output, false);
+  CFG_ASSERT(input == output_output);
+  // Optimal parse is never bigger than the greedy one
+  std::vector<uint8_t> max_output;
+  CFG_compress(&input[0], input.size(), max_output, nullptr, false,
+               CFG_COMPRESS_MAX_LEVEL);
+  CFG_ASSERT(max_output.size() <= best_output.size());
+  output_output.clear();
+  CFG_decompress(&max_output[0], max_output.size(), output_output, false);
+  CFG_ASSERT(input == output_output);
   CFG_POST_MSG("***********************************************************");
   index++;
 }
@@ -47,6 +74,117 @@ void test_compression() {
       index, {1, 2, 3, 3, 4, 5, 6, 0, 0, 1, 2, 3, 4, 4, 5, 6, 6, 0, 0});
 }
 
+void test_compression_stream() {
+  CFG_POST_MSG("Compression Stream Test");
+  TEST_RANDOM random(0x2468ACE1);
+  // Long sequences (longer than what the stream looks ahead), repeated
+  // chunks and random data
+  std::vector<uint8_t> input;
+  while (input.size() < (size_t)(1024 * 1024)) {
+    uint32_t type = random() % 4;
+    if (type == 0) {
+      input.insert(input.end(), 1 + (random() % 20000),
+                   (uint8_t)((random() % 2) ? 0 : random()));
+    } else if (type == 1) {
+      std::vector<uint8_t> chunk(3 + (random() % 48), 0);
+      chunk[random() % chunk.size()] = (uint8_t)(random());
+      for (size_t i = 0, repeat = 2 + (random() % 200); i < repeat; i++) {
+        input.insert(input.end(), chunk.begin(), chunk.end());
+      }
+    } else {
+      for (size_t i = 0, size = 1 + (random() % 512); i < size; i++) {
+        input.push_back((uint8_t)(random()));
+      }
+    }
+  }
+  std::vector<uint8_t> expected;
+  CFG_compress(&input[0], input.size(), expected, nullptr, false,
+               CFG_COMPRESS_DEFAULT_LEVEL);
+  // Same result regardless of how the input is fed and the output drained
+  for (size_t chunk_size : {1, 7, 2048, 65536, 0}) {
+    CFG_COMPRESS_STREAM stream;
+    std::vector<uint8_t> data;
+    uint8_t buffer[2048];
+    size_t index = 0;
+    while (index < input.size()) {
+      size_t size = chunk_size ? chunk_size : (1 + (random() % 100000));
+      size = std::min(size, input.size() - index);
+      stream.feed(&input[index], size);
+      index += size;
+      while (stream.get_available_size()) {
+        size = stream.drain(buffer, 1 + (random() % sizeof(buffer)));
+        data.insert(data.end(), buffer, buffer + size);
+      }
+    }
+    stream.finish();
+    while (size_t size = stream.drain(buffer, sizeof(buffer))) {
+      data.insert(data.end(), buffer, buffer + size);
+    }
+    std::vector<uint8_t> output;
+    stream.get_header(output);
+    CFG_ASSERT(output.size() <= CFG_COMPRESS_STREAM::get_max_header_size());
+    output.insert(output.end(), data.begin(), data.end());
+    CFG_ASSERT(stream.get_input_size() == input.size());
+    CFG_ASSERT(stream.get_output_size() == data.size());
+    CFG_ASSERT(output == expected);
+  }
+}
+
+void test_compress_prediction() {
+  CFG_POST_MSG("Compress Prediction Test");
+  TEST_RANDOM random(0x13579BDF);
+  std::vector<uint8_t> input(1024 * 1024);
+  for (auto& byte : input) {
+    byte = (uint8_t)(random());
+  }
+  CFG_ASSERT(!CFG_COMPRESS::predict_compressible(&input[0], input.size()));
+  // Prediction is right: random data does not save anything
+  std::vector<uint8_t> output;
+  CFG_compress(&input[0], input.size(), output, nullptr, false,
+               CFG_COMPRESS_DEFAULT_LEVEL);
+  CFG_ASSERT(output.size() >= input.size());
+  // Small input is always worth trying
+  CFG_ASSERT(CFG_COMPRESS::predict_compressible(&input[0], 4096));
+  // Some sequences of same byte
+  std::vector<uint8_t> temp = input;
+  memset(&temp[256 * 1024], 0, 128 * 1024);
+  CFG_ASSERT(CFG_COMPRESS::predict_compressible(&temp[0], temp.size()));
+  // Repeated chunk
+  temp = input;
+  for (size_t i = 512 * 1024; i < temp.size(); i++) {
+    temp[i] = temp[i - 37];
+  }
+  CFG_ASSERT(CFG_COMPRESS::predict_compressible(&temp[0], temp.size()));
+  // Few bits per byte
+  temp = input;
+  for (auto& byte : temp) {
+    byte &= 0x3F;
+  }
+  CFG_ASSERT(CFG_COMPRESS::predict_compressible(&temp[0], temp.size()));
+}
+
+void test_compression_levels() {
+  CFG_POST_MSG("Compression Level Test");
+  // Every level gives back the input, and a higher level is never bigger.
+  // Throughput of bigger input is measured by cfgcommonrs_bench.
+  TEST_RANDOM random(0x12345678);
+  for (auto& type : {"fabric", "sparse", "unused", "random"}) {
+    std::vector<uint8_t> input =
+        CFG_generate_test_data(type, 64 * 1024 + 3, random);
+    size_t previous_size = 0;
+    for (auto level : {CFG_COMPRESS_FAST_LEVEL, CFG_COMPRESS_DEFAULT_LEVEL,
+                       CFG_COMPRESS_MAX_LEVEL}) {
+      std::vector<uint8_t> output;
+      std::vector<uint8_t> output_output;
+      CFG_compress(&input[0], input.size(), output, nullptr, false, level);
+      CFG_decompress(&output[0], output.size(), output_output, false);
+      CFG_ASSERT(input == output_output);
+      CFG_ASSERT(previous_size == 0 || output.size() <= previous_size);
+      previous_size = output.size();
+    }
+  }
+}
+
 void test_crc() {
   CFG_POST_MSG("CRC Test");
   uint16_t expected_crc16 = 0xA161;
@@ -57,11 +195,104 @@ void test_crc() {
       "\x00\x00\x00\x00\x00\x00\x00\x00"));
   uint16_t crc16 = CFG_bop_A001_crc16(data, 62);
   CFG_ASSERT(crc16 == expected_crc16);
+  // Less than 8 bytes is always done one byte at a time, use it as reference
+  // for every size, alignment and split of incremental update
+  TEST_RANDOM random(0x13579BDF);
+  std::vector<uint8_t> input(4096 + 8);
+  for (auto& byte : input) {
+    byte = (uint8_t)(random());
+  }
+  for (size_t size = 1; size < 300; size += (size < 40 ? 1 : 37)) {
+    for (size_t offset = 0; offset < 8; offset++) {
+      const uint8_t* addr = &input[offset];
+      uint16_t expected_8408 = 0xFFFF;
+      uint16_t expected_a001 = 0;
+      uint32_t expected_crc32 = 0xFFFFFFFF;
+      for (size_t i = 0; i < size; i++) {
+        expected_8408 = CFG_crc16_update(expected_8408, &addr[i], 1);
+        expected_a001 = CFG_bop_A001_crc16(&addr[i], 1, expected_a001);
+        expected_crc32 = CFG_crc32_update(expected_crc32, &addr[i], 1);
+      }
+      CFG_ASSERT(CFG_crc16(addr, size) == (expected_8408 ^ 0xFFFF));
+      CFG_ASSERT(CFG_bop_A001_crc16(addr, size) == expected_a001);
+      CFG_ASSERT(CFG_crc32(addr, size) == (expected_crc32 ^ 0xFFFFFFFF));
+      size_t split = random() % size;
+      uint32_t crc32 = CFG_crc32_update(0xFFFFFFFF, addr, split);
+      crc32 = CFG_crc32_update(crc32, &addr[split], size - split);
+      CFG_ASSERT(crc32 == expected_crc32);
+    }
+  }
+  // Throughput of byte by byte versus slice-by-8
+  std::vector<uint8_t> bitstream(16 * 1024 * 1024);
+  for (auto& byte : bitstream) {
+    byte = (uint8_t)(random());
+  }
+  auto begin = std::chrono::steady_clock::now();
+  uint32_t expected_crc32 = 0xFFFFFFFF;
+  for (auto& byte : bitstream) {
+    expected_crc32 = CFG_crc32_update(expected_crc32, &byte, 1);
+  }
+  double byte_elapsed = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - begin)
+                            .count();
+  begin = std::chrono::steady_clock::now();
+  uint32_t crc32 = CFG_crc32_update(0xFFFFFFFF, &bitstream[0],
+                                    bitstream.size());
+  double slice_elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - begin)
+                             .count();
+  CFG_ASSERT(crc32 == expected_crc32);
+  CFG_POST_MSG("CRC32 of %ld bytes: %.1f MB/s byte by byte, %.1f MB/s sliced",
+               bitstream.size(), bitstream.size() / byte_elapsed / 1048576,
+               bitstream.size() / slice_elapsed / 1048576);
+}
+
+void test_run_in_parallel() {
+  CFG_POST_MSG("Run In Parallel Test");
+  CFG_ASSERT(CFG_get_thread_count(3) == 3);
+  CFG_ASSERT(CFG_get_thread_count(0) >= 1);
+  for (size_t thread_count : {1, 2, 3, 8}) {
+    // Every index is called exactly once
+    std::vector<int> calls(100, 0);
+    CFG_run_in_parallel(calls.size(), thread_count,
+                        [&](size_t index) { calls[index]++; });
+    CFG_ASSERT(calls == std::vector<int>(calls.size(), 1));
+    // Exception from any thread reaches the caller
+    bool thrown = false;
+    try {
+      CFG_run_in_parallel(calls.size(), thread_count, [&](size_t index) {
+        if (index == 37) {
+          throw std::runtime_error("index 37");
+        }
+      });
+    } catch (std::exception& e) {
+      thrown = std::string(e.what()) == "index 37";
+    }
+    CFG_ASSERT(thrown);
+  }
+}
+
+void test_run_by_thread_count() {
+  CFG_POST_MSG("Run By Thread Count Test");
+  // Thread count doubles up to at least the minimum
+  std::vector<size_t> thread_counts;
+  CFG_run_by_thread_count(
+      "Thread count",
+      [&](size_t thread_count) { thread_counts.push_back(thread_count); }, 4);
+  CFG_ASSERT(thread_counts.size() >= 3);
+  for (size_t i = 0; i < thread_counts.size(); i++) {
+    CFG_ASSERT(thread_counts[i] == ((size_t)(1) << i));
+  }
 }
 
 int main(int argc, const char** argv) {
   CFG_POST_MSG("This is CFGCommon unit test");
   test_compression();
+  test_compression_stream();
+  test_compress_prediction();
+  test_compression_levels();
   test_crc();
+  test_run_in_parallel();
+  test_run_by_thread_count();
   return 0;
 }
@@ -0,0 +1,78 @@
+#include "CFGCommonRS_test_helper.h"
+
+#include <algorithm>
+
+#include "CFGCommonRS/CFGCommonRS.h"
+
+std::vector<uint8_t> CFG_generate_test_data(const std::string& type,
+                                            size_t size, TEST_RANDOM& random) {
+  std::vector<uint8_t> data;
+  if (type == "fabric") {
+    std::vector<uint8_t> tile(4096);
+    for (auto& byte : tile) {
+      byte = (random() % 16) == 0 ? (uint8_t)(random()) : 0;
+    }
+    for (size_t i = 0; i < size; i++) {
+      if ((random() % 256) == 0) {
+        data.push_back((uint8_t)(random()));
+      } else {
+        data.push_back(tile[i % tile.size()]);
+      }
+    }
+  } else if (type == "sparse") {
+    for (size_t i = 0; i < size; i++) {
+      data.push_back((random() % 64) == 0 ? (uint8_t)(1 << (random() % 8))
+                                          : 0);
+    }
+  } else if (type == "unused") {
+    while (data.size() < size) {
+      data.insert(data.end(), 64 + (random() % 8192),
+                  (random() % 2) ? 0 : 0xFF);
+      for (size_t i = 0, count = 1 + (random() % 16); i < count; i++) {
+        data.push_back((uint8_t)(random()));
+      }
+    }
+    data.resize(size);
+  } else if (type == "token") {
+    while (data.size() < size) {
+      uint32_t token = random() % 4;
+      if (token == 0) {
+        data.insert(data.end(), 1 + (random() % 4096),
+                    (uint8_t)((random() % 3) == 0 ? random() : 0));
+      } else if (token == 1) {
+        std::vector<uint8_t> chunk(3 + (random() % 48), 0xFF);
+        chunk[random() % chunk.size()] = (uint8_t)(random());
+        for (size_t i = 0, repeat = 2 + (random() % 64); i < repeat; i++) {
+          data.insert(data.end(), chunk.begin(), chunk.end());
+        }
+      } else {
+        for (size_t i = 0, count = 1 + (random() % 256); i < count; i++) {
+          data.push_back((uint8_t)(random()));
+        }
+      }
+    }
+    data.resize(size);
+  } else {
+    CFG_ASSERT(type == "random");
+    data.resize(size);
+    for (auto& byte : data) {
+      byte = (uint8_t)(random());
+    }
+  }
+  return data;
+}
+
+void CFG_run_by_thread_count(const std::string& name,
+                             const std::function<void(size_t)>& function,
+                             size_t min_thread_count) {
+  size_t hardware_threads = CFG_get_thread_count(0);
+  for (size_t thread_count = 1;
+       thread_count <= std::max(hardware_threads, min_thread_count);
+       thread_count *= 2) {
+    CFG_TIME time_begin = CFG_time_begin();
+    function(thread_count);
+    CFG_POST_MSG("%s, %ld thread(s)%s: %.3f ms", name.c_str(), thread_count,
+                 thread_count > hardware_threads ? " (over hardware)" : "",
+                 CFG_time_elapse(time_begin) * 1000);
+  }
+}
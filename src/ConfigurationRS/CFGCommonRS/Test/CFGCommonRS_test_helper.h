@@ -0,0 +1,46 @@
+#ifndef CFGCommonRS_TEST_HELPER_H
+#define CFGCommonRS_TEST_HELPER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Helpers shared by the unit test and benchmark executables of the
+// configuration subsystems. Not part of any subsystem library.
+
+// Xorshift32, the same random numbers on every platform
+class TEST_RANDOM {
+ public:
+  TEST_RANDOM(uint32_t seed) : m_seed(seed) {}
+  uint32_t operator()() {
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    return m_seed;
+  }
+
+ private:
+  uint32_t m_seed;
+};
+
+// Synthetic configuration data for the compression tests and benchmarks
+//   fabric: frames that are mostly zero with a few programmed bits, and
+//           repeated tiles of the same configuration
+//   sparse: a few single bits set here and there
+//   unused: long sequences of 0's or FF's between a few bytes of data
+//   random: random (or encrypted) data, predicted not compressible
+//   token:  every token type of the compression: sequences of 0's, FF's
+//           and other bytes, repeated chunks and plain data
+std::vector<uint8_t> CFG_generate_test_data(const std::string& type,
+                                            size_t size, TEST_RANDOM& random);
+
+// Call function(thread_count) with 1, 2, 4, ... threads up to all the hardware
+// threads but at least up to min_thread_count, and post how long each call
+// takes. Used to check that multi-threaded code gives the same result with
+// any number of threads
+void CFG_run_by_thread_count(const std::string& name,
+                             const std::function<void(size_t)>& function,
+                             size_t min_thread_count = 4);
+
+#endif
@@ -1,5 +1,7 @@
 #include "CFGOpenSSL.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <streambuf>
 #include <string>
@@ -25,13 +27,15 @@
 #include "openssl/sha.h"
 
 #define MIN_PASSPHRASE_SIZE (13)
+#define CFGOpenSSL_CTR_MIN_THREAD_SIZE (256 * 1024)
 const std::vector<CFGOpenSSL_KEY_INFO> CFGOpenSSL_KEY_INFO_DATABASE = {
     CFGOpenSSL_KEY_INFO(NID_X9_62_prime256v1, NID_X9_62_id_ecPublicKey,
                         "prime256v1", 32, NID_sha256, 32, 0x10),
     CFGOpenSSL_KEY_INFO(NID_rsa, NID_rsaEncryption, "rsa2048", 256, NID_sha256,
                         32, 0x20)};
 
-static bool m_openssl_init = false;
+// Digests are computed from multiple threads
+static std::atomic<bool> m_openssl_init{false};
 
 static void memory_clean(std::string& passphrase, EVP_PKEY*& evp_key,
                          PKCS8_PRIV_KEY_INFO*& p8inf, X509_SIG*& p8) {
@@ -202,56 +206,12 @@ void CFGOpenSSL::ctr_encrypt(const uint8_t* plain_data, uint8_t* cipher_data,
   CFG_ASSERT(key_size == 16 || key_size == 32);
   CFG_ASSERT(iv != nullptr);
   CFG_ASSERT(iv_size == 16);
-  init_openssl();
-
-  // encrypt
-#if APP_USE_1_1_x_OPENSSL
-  AES_KEY aes_key;
-  unsigned char ecount_buf[16] = {0};
-  unsigned char internal_iv[16] = {0};
-  unsigned int aes_num(0);
-  CFG_ASSERT(sizeof(internal_iv) == iv_size);
-  memcpy(internal_iv, iv, sizeof(internal_iv));
-  CFG_ASSERT(AES_set_encrypt_key(key, key_size * 8, &aes_key) == 0);
-  CRYPTO_ctr128_encrypt(plain_data, cipher_data, data_size, &aes_key,
-                        internal_iv, ecount_buf, &aes_num,
-                        (block128_f)AES_encrypt);
+  CFGOpenSSL_CTR ctr(key, key_size);
+  ctr.set_iv(iv, iv_size);
+  ctr.update(plain_data, cipher_data, data_size);
   if (returned_iv != nullptr) {
-    memcpy(returned_iv, internal_iv, iv_size);
+    ctr.get_iv(returned_iv);
   }
-  memset(internal_iv, 0, sizeof(internal_iv));
-#else
-  // This piece of code is written (and tested working) which is compatible
-  // with 3.0
-  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-  CFG_ASSERT(ctx != nullptr);
-  unsigned char internal_iv[16] = {0};
-  CFG_ASSERT(sizeof(internal_iv) == iv_size);
-  memcpy(internal_iv, iv, sizeof(internal_iv));
-  // Init
-  if (key_size == 16) {
-    CFG_ASSERT(EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, key, iv));
-  } else {
-    CFG_ASSERT(EVP_EncryptInit_ex(ctx, EVP_aes_256_ctr(), NULL, key, iv));
-  }
-  // Update (should be able to check overflow if the data_size is too big
-  int cipher_data_size = 0;
-  CFG_ASSERT(EVP_EncryptUpdate(ctx, cipher_data, &cipher_data_size, plain_data,
-                               int(data_size)));
-  CFG_ASSERT((size_t)(cipher_data_size) == data_size);
-  // Finalize
-  // Pernally do not think CTR has any final size (unlike GCM)
-  // Hence make sure final_data_size == 0
-  int final_data_size = 0;
-  unsigned char final_dummy[128] = {0};
-  CFG_ASSERT(EVP_EncryptFinal_ex(ctx, final_dummy, &final_data_size));
-  CFG_ASSERT(final_data_size == 0);
-  if (returned_iv != nullptr) {
-    memcpy(returned_iv, internal_iv, iv_size);
-  }
-  memset(internal_iv, 0, sizeof(internal_iv));
-  EVP_CIPHER_CTX_free(ctx);
-#endif
 }
 
 void CFGOpenSSL::gen_private_pem(const std::string& key_type,
@@ -369,6 +329,196 @@ void CFGOpenSSL::ctr_decrypt(const uint8_t* cipher_data, uint8_t* plain_data,
               returned_iv);
 }
 
+CFGOpenSSL_CTR::CFGOpenSSL_CTR(const uint8_t* key, size_t key_size,
+                               size_t max_threads)
+    : m_max_threads(max_threads) {
+  CFG_ASSERT(key != nullptr);
+  CFG_ASSERT(key_size == 16 || key_size == 32);
+  CFG_ASSERT(m_max_threads > 0);
+  CFGOpenSSL::init_openssl();
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+  CFG_ASSERT(ctx != nullptr);
+  // Key only, IV is set later
+  CFG_ASSERT(EVP_EncryptInit_ex(
+      ctx, key_size == 16 ? EVP_aes_128_ctr() : EVP_aes_256_ctr(), NULL, key,
+      NULL));
+  m_ctx = ctx;
+}
+
+CFGOpenSSL_CTR::CFGOpenSSL_CTR(const CFGOpenSSL_CTR* key_ctr,
+                               size_t max_threads)
+    : m_max_threads(max_threads) {
+  CFG_ASSERT(key_ctr != nullptr);
+  CFG_ASSERT(m_max_threads > 0);
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+  CFG_ASSERT(ctx != nullptr);
+  if (!EVP_CIPHER_CTX_copy(ctx, (EVP_CIPHER_CTX*)(key_ctr->m_ctx))) {
+    EVP_CIPHER_CTX_free(ctx);
+    CFG_INTERNAL_ERROR("Fail to copy AES-CTR context");
+  }
+  m_ctx = ctx;
+}
+
+CFGOpenSSL_CTR::~CFGOpenSSL_CTR() {
+  // Free also cleanses the key schedule
+  EVP_CIPHER_CTX_free((EVP_CIPHER_CTX*)(m_ctx));
+  for (auto& ctx : m_worker_ctxs) {
+    EVP_CIPHER_CTX_free((EVP_CIPHER_CTX*)(ctx));
+  }
+  memset(m_iv, 0, sizeof(m_iv));
+}
+
+void CFGOpenSSL_CTR::set_iv(const uint8_t* iv, size_t iv_size) {
+  CFG_ASSERT(iv != nullptr);
+  CFG_ASSERT(iv_size == sizeof(m_iv));
+  CFG_ASSERT(
+      EVP_EncryptInit_ex((EVP_CIPHER_CTX*)(m_ctx), NULL, NULL, NULL, iv));
+  memcpy(m_iv, iv, sizeof(m_iv));
+  m_has_iv = true;
+  m_size = 0;
+}
+
+void CFGOpenSSL_CTR::update(const uint8_t* input, uint8_t* output,
+                            size_t size) {
+  CFG_ASSERT(input != nullptr);
+  CFG_ASSERT(output != nullptr);
+  CFG_ASSERT(size > 0);
+  CFG_ASSERT(m_has_iv);
+  CFG_TIME time_begin = CFG_time_begin();
+  size_t thread_count = get_thread_count(size);
+  if (thread_count > 1) {
+    // Equal parts, each a multiple of AES block
+    size_t part_size = ((size / thread_count) + 15) & ~(size_t)(15);
+    std::vector<CFGOpenSSL_CTR_PIECE> pieces;
+    for (size_t index = 0; index < size; index += part_size) {
+      pieces.push_back({&input[index], &output[index],
+                        std::min(part_size, size - index)});
+    }
+    update_in_parallel(pieces, thread_count);
+  } else {
+    update_ctx(m_ctx, input, output, size);
+  }
+  m_size += size;
+  m_total_size += size;
+  m_total_nano_time += CFG_nano_time_elapse(time_begin);
+}
+
+void CFGOpenSSL_CTR::update(const std::vector<CFGOpenSSL_CTR_PIECE>& pieces) {
+  CFG_ASSERT(pieces.size());
+  CFG_ASSERT(m_has_iv);
+  size_t size = 0;
+  for (size_t i = 0; i < pieces.size(); i++) {
+    CFG_ASSERT(pieces[i].input != nullptr);
+    CFG_ASSERT(pieces[i].output != nullptr);
+    CFG_ASSERT(pieces[i].size > 0);
+    CFG_ASSERT((i + 1) == pieces.size() || (pieces[i].size % 16) == 0);
+    size += pieces[i].size;
+  }
+  CFG_TIME time_begin = CFG_time_begin();
+  size_t thread_count = get_thread_count(size);
+  if (thread_count > 1) {
+    update_in_parallel(pieces, thread_count);
+  } else {
+    for (auto& piece : pieces) {
+      update_ctx(m_ctx, piece.input, piece.output, piece.size);
+    }
+  }
+  m_size += size;
+  m_total_size += size;
+  m_total_nano_time += CFG_nano_time_elapse(time_begin);
+}
+
+void CFGOpenSSL_CTR::get_iv(uint8_t* iv) {
+  CFG_ASSERT(iv != nullptr);
+  CFG_ASSERT(m_has_iv);
+  // Partial AES block still uses up a counter
+  add_counter(m_iv, (m_size + 15) / 16, iv);
+}
+
+size_t CFGOpenSSL_CTR::get_thread_count(size_t size) {
+  // Counter of the parts can only be derived when the stream so far stops at
+  // AES block boundary. Small part is not worth a thread
+  if (m_max_threads <= 1 || (m_size % 16) != 0) {
+    return 1;
+  }
+  return std::min(m_max_threads, size / CFGOpenSSL_CTR_MIN_THREAD_SIZE);
+}
+
+void CFGOpenSSL_CTR::update_in_parallel(
+    const std::vector<CFGOpenSSL_CTR_PIECE>& pieces, size_t thread_count) {
+  CFG_ASSERT(thread_count > 1);
+  CFG_ASSERT((m_size % 16) == 0);
+  size_t size = 0;
+  for (auto& piece : pieces) {
+    size += piece.size;
+  }
+  // Group the pieces into parts of about the same size. Each part is first
+  // piece index and its offset in the stream
+  std::vector<std::pair<size_t, size_t>> parts;
+  size_t offset = 0;
+  for (size_t i = 0; i < pieces.size(); i++) {
+    if (parts.empty() || offset >= ((size * parts.size()) / thread_count)) {
+      parts.push_back({i, offset});
+    }
+    offset += pieces[i].size;
+  }
+  size_t part_count = parts.size();
+  parts.push_back({pieces.size(), size});
+  while ((m_worker_ctxs.size() + 1) < part_count) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    CFG_ASSERT(ctx != nullptr);
+    CFG_ASSERT(EVP_CIPHER_CTX_copy(ctx, (EVP_CIPHER_CTX*)(m_ctx)));
+    m_worker_ctxs.push_back(ctx);
+  }
+  CFG_run_in_parallel(part_count, thread_count, [&](size_t part) {
+    // Last part goes through m_ctx, so that the next update() carries on
+    void* ctx = (part + 1) == part_count ? m_ctx : m_worker_ctxs[part];
+    uint8_t counter[16];
+    add_counter(m_iv, (m_size + parts[part].second) / 16, counter);
+    CFG_ASSERT(EVP_EncryptInit_ex((EVP_CIPHER_CTX*)(ctx), NULL, NULL, NULL,
+                                  counter));
+    memset(counter, 0, sizeof(counter));
+    for (size_t i = parts[part].first; i < parts[part + 1].first; i++) {
+      update_ctx(ctx, pieces[i].input, pieces[i].output, pieces[i].size);
+    }
+  });
+}
+
+void CFGOpenSSL_CTR::update_ctx(void* ctx, const uint8_t* input,
+                                uint8_t* output, size_t size) {
+  for (size_t index = 0; index < size;) {
+    // EVP takes int size
+    int update_size = (int)(std::min(size - index, (size_t)(0x40000000)));
+    int output_size = 0;
+    CFG_ASSERT(EVP_EncryptUpdate((EVP_CIPHER_CTX*)(ctx), &output[index],
+                                 &output_size, &input[index], update_size));
+    CFG_ASSERT(output_size == update_size);
+    index += (size_t)(update_size);
+  }
+}
+
+void CFGOpenSSL_CTR::add_counter(const uint8_t* iv, uint64_t count,
+                                 uint8_t* counter) {
+  // Counter is big endian 128 bits
+  uint8_t temp[16];
+  memcpy(temp, iv, sizeof(temp));
+  for (size_t i = sizeof(temp); i-- > 0 && count;) {
+    count += temp[i];
+    temp[i] = (uint8_t)(count);
+    count >>= 8;
+  }
+  memcpy(counter, temp, sizeof(temp));
+  memset(temp, 0, sizeof(temp));
+}
+
+double CFGOpenSSL_CTR::get_throughput() {
+  if (m_total_nano_time == 0) {
+    return 0;
+  }
+  return (double)(m_total_size) * 1000000000.0 /
+         (double)(m_total_nano_time) / (1024 * 1024);
+}
+
 const CFGOpenSSL_KEY_INFO* CFGOpenSSL::get_key_info(int nid, int size) {
   const CFGOpenSSL_KEY_INFO* key_info = nullptr;
   for (auto& c : CFGOpenSSL_KEY_INFO_DATABASE) {
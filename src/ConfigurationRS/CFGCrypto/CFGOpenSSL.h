@@ -29,6 +29,58 @@ struct CFGOpenSSL_KEY_INFO {
 
 class CFGCrypto_KEY;
 
+// One piece of the stream to CFGOpenSSL_CTR::update()
+struct CFGOpenSSL_CTR_PIECE {
+  const uint8_t* input;
+  uint8_t* output;
+  size_t size;
+};
+
+// AES-CTR context: the key is expanded once and the counter carries on from
+// one update() to the next, so that a stream can be encrypted (or decrypted)
+// piece by piece. set_iv() restarts the counter and keeps the key. It goes
+// through EVP, which uses AES-NI when the CPU supports it.
+// With max_threads more than one, big update() is split at AES block
+// boundaries and the parts run on their own threads, each starting from the
+// counter derived from the IV. The output is the same as single thread.
+class CFGOpenSSL_CTR {
+ public:
+  CFGOpenSSL_CTR(const uint8_t* key, size_t key_size, size_t max_threads = 1);
+  // Same key as key_ctr, its key schedule is copied instead of expanded again
+  CFGOpenSSL_CTR(const CFGOpenSSL_CTR* key_ctr, size_t max_threads = 1);
+  // Owns the EVP contexts, not copyable
+  CFGOpenSSL_CTR(const CFGOpenSSL_CTR&) = delete;
+  CFGOpenSSL_CTR& operator=(const CFGOpenSSL_CTR&) = delete;
+  ~CFGOpenSSL_CTR();
+  void set_iv(const uint8_t* iv, size_t iv_size);
+  void update(const uint8_t* input, uint8_t* output, size_t size);
+  // Same as update() of the pieces one after another. Every piece except the
+  // last must be a multiple of AES block
+  void update(const std::vector<CFGOpenSSL_CTR_PIECE>& pieces);
+  // Counter of the next AES block
+  void get_iv(uint8_t* iv);
+  uint64_t get_total_size() { return m_total_size; }
+  // MB/s of all the update() so far
+  double get_throughput();
+
+ private:
+  size_t get_thread_count(size_t size);
+  void update_in_parallel(const std::vector<CFGOpenSSL_CTR_PIECE>& pieces,
+                          size_t thread_count);
+  static void update_ctx(void* ctx, const uint8_t* input, uint8_t* output,
+                         size_t size);
+  static void add_counter(const uint8_t* iv, uint64_t count, uint8_t* counter);
+  void* m_ctx = nullptr;
+  // Contexts of the other threads, copied from m_ctx when first needed
+  std::vector<void*> m_worker_ctxs;
+  const size_t m_max_threads;
+  uint8_t m_iv[16] = {0};
+  bool m_has_iv = false;
+  uint64_t m_size = 0;
+  uint64_t m_total_size = 0;
+  uint64_t m_total_nano_time = 0;
+};
+
 class CFGOpenSSL {
  public:
   static void init_openssl();
@@ -0,0 +1,32 @@
+#include "CFGCommonRS/CFGCommonRS.h"
+#include "CFGOpenSSL.h"
+
+void bench_ctr() {
+  std::vector<uint8_t> stream(64 * 1024 * 1024);
+  for (size_t i = 0; i < stream.size(); i++) {
+    stream[i] = (uint8_t)(i * 13);
+  }
+  std::vector<uint8_t> cipher(stream.size());
+  std::vector<uint8_t> iv(16, 0);
+  iv[14] = 0xCC;
+  // 1, 2, 4, ... up to all the hardware threads
+  size_t hardware_threads = CFG_get_thread_count(0);
+  for (size_t key_size : {16, 32}) {
+    std::vector<uint8_t> key(key_size, 0x5A);
+    for (size_t thread_count = 1; thread_count <= hardware_threads;
+         thread_count *= 2) {
+      CFGOpenSSL_CTR ctr(&key[0], key.size(), thread_count);
+      ctr.set_iv(&iv[0], iv.size());
+      ctr.update(&stream[0], &cipher[0], stream.size());
+      CFG_POST_MSG("AES-%ld-CTR of %ld bytes, %ld thread(s): %.1f MB/s",
+                   key_size * 8, stream.size(), thread_count,
+                   ctr.get_throughput());
+    }
+  }
+}
+
+int main(int argc, const char** argv) {
+  CFG_POST_MSG("This is CFGCRYPTO benchmark");
+  bench_ctr();
+  return 0;
+}
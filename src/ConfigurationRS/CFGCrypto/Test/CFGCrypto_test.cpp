@@ -1,4 +1,7 @@
+#include <algorithm>
+
 #include "CFGCommonRS/CFGCommonRS.h"
+#include "CFGCommonRS/Test/CFGCommonRS_test_helper.h"
 #include "CFGCrypto_key.h"
 #include "CFGOpenSSL.h"
 
@@ -67,6 +70,69 @@ void test_encryption() {
   for (size_t i = 0; i < data_size; i++) {
     CFG_ASSERT(plain[i] == (uint8_t)(i));
   }
+  // Same key schedule and counter carries on across update() of any size
+  CFGOpenSSL_CTR ctr(&key[0], key.size());
+  ctr.set_iv(&iv[0], iv.size());
+  for (size_t i = 0; i < data_size; i += 5) {
+    ctr.update(&data[i], &cipher[i], std::min(data_size - i, (size_t)(5)));
+  }
+  for (size_t i = 0; i < data_size; i++) {
+    CFG_ASSERT(cipher[i] == expected_cipher[i]);
+  }
+  // Context that copies the key schedule of another one
+  CFGOpenSSL_CTR copy_ctr(&ctr);
+  copy_ctr.set_iv(&iv[0], iv.size());
+  copy_ctr.update(&data[0], &cipher[0], data_size);
+  for (size_t i = 0; i < data_size; i++) {
+    CFG_ASSERT(cipher[i] == expected_cipher[i]);
+  }
+  // Counter of next AES block, partial block uses one up
+  std::vector<uint8_t> next_iv(16);
+  ctr.get_iv(&next_iv[0]);
+  std::vector<uint8_t> expected_iv = iv;
+  expected_iv[15] = 3;
+  CFG_ASSERT(next_iv == expected_iv);
+  // Carry
+  iv.assign(16, 0xFF);
+  iv[0] = 0x12;
+  CFGOpenSSL::ctr_encrypt(&data[0], &cipher[0], 32, &key[0], key.size(),
+                          &iv[0], iv.size(), &next_iv[0]);
+  expected_iv.assign(16, 0);
+  expected_iv[0] = 0x13;
+  expected_iv[15] = 1;
+  CFG_ASSERT(next_iv == expected_iv);
+  // Multi-threaded: 2KB pieces or one big buffer that are split over the
+  // threads give exactly the single thread output, and the counter still
+  // carries on. Just big enough to be split over 4 threads
+  std::vector<uint8_t> stream(1024 * 1024 + 100);
+  for (size_t i = 0; i < stream.size(); i++) {
+    stream[i] = (uint8_t)(i * 13);
+  }
+  std::vector<uint8_t> expected_stream(stream.size());
+  CFGOpenSSL::ctr_encrypt(&stream[0], &expected_stream[0], stream.size(),
+                          &key[0], key.size(), &iv[0], iv.size(),
+                          &expected_iv[0]);
+  std::vector<uint8_t> stream_cipher(stream.size());
+  CFG_run_by_thread_count("AES-CTR", [&](size_t thread_count) {
+    CFGOpenSSL_CTR parallel_ctr(&key[0], key.size(), thread_count);
+    parallel_ctr.set_iv(&iv[0], iv.size());
+    parallel_ctr.update(&stream[0], &stream_cipher[0], 32);
+    std::vector<CFGOpenSSL_CTR_PIECE> pieces;
+    for (size_t i = 32; i < stream.size(); i += 2048) {
+      pieces.push_back({&stream[i], &stream_cipher[i],
+                        std::min(stream.size() - i, (size_t)(2048))});
+    }
+    parallel_ctr.update(pieces);
+    CFG_ASSERT(stream_cipher == expected_stream);
+    parallel_ctr.get_iv(&next_iv[0]);
+    CFG_ASSERT(next_iv == expected_iv);
+    stream_cipher.assign(stream.size(), 0);
+    parallel_ctr.set_iv(&iv[0], iv.size());
+    parallel_ctr.update(&stream[0], &stream_cipher[0], stream.size() - 7);
+    parallel_ctr.update(&stream[stream.size() - 7],
+                        &stream_cipher[stream.size() - 7], 7);
+    CFG_ASSERT(stream_cipher == expected_stream);
+  });
 }
 
 void test_signing() {
@@ -3,12 +3,15 @@
 #include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
 #include "OclaHelpers.h"
 #include "OclaJtagAdapter.h"
+#include "OclaRegisterShadow.h"
 
 #define MAX_IO_INPUT_REG (2)
 #define MAX_IO_OUTPUT_REG (2)
 
-EioIP::EioIP(OclaJtagAdapter *adapter, uint32_t baseaddr)
+EioIP::EioIP(OclaJtagAdapter *adapter, uint32_t baseaddr,
+             OclaRegisterShadow *shadow)
     : m_adapter(adapter),
+      m_shadow(shadow),
       m_baseaddr(baseaddr),
       m_ctrl(0),
       m_type(0),
@@ -36,9 +39,21 @@ eio_prs_mode EioIP::get_prs_mode() const {
 
 void EioIP::set_prs_mode(eio_prs_mode mode) {
   CFG_ASSERT(m_adapter != nullptr);
+  uint32_t ctrl = m_ctrl;
   CFG_set_bitfield_u32(m_ctrl, EIO_CTRL_PRS_Pos, EIO_CTRL_PRS_Width,
                        (uint32_t)(mode));
-  m_adapter->write(m_baseaddr + EIO_CTRL, m_ctrl);
+  // skip the write when the register already holds the value
+  if (m_shadow != nullptr) {
+    if (m_ctrl == ctrl) {
+      return;
+    }
+    m_shadow->update(m_baseaddr + EIO_CTRL, m_ctrl);
+  }
+  if (m_adapter->is_queuing()) {
+    m_adapter->queue_write(m_baseaddr + EIO_CTRL, m_ctrl);
+  } else {
+    m_adapter->write(m_baseaddr + EIO_CTRL, m_ctrl);
+  }
 }
 
 void EioIP::write_output_bits(std::vector<uint32_t> values, uint32_t length) {
@@ -46,14 +61,18 @@ void EioIP::write_output_bits(std::vector<uint32_t> values, uint32_t length) {
   CFG_ASSERT(length > 0);
   CFG_ASSERT(length <= MAX_IO_OUTPUT_REG);
   CFG_ASSERT(values.size() >= length);
+  OclaTransactionBatch batch{m_adapter};
   for (uint32_t i = 0; i < length; i++) {
-    m_adapter->write(m_baseaddr + EIO_AXI_DAT_OUT + (i << 2), values[i]);
+    m_adapter->queue_write(m_baseaddr + EIO_AXI_DAT_OUT + (i << 2), values[i]);
   }
+  m_adapter->flush();
 }
 
 std::vector<uint32_t> EioIP::read_bits(uint32_t addr, uint32_t length) {
+  // flush together with the probe read selection write queued by caller
   std::vector<uint32_t> values{};
-  auto result = m_adapter->read(addr, length, 4);
+  m_adapter->queue_read(addr, length, 4);
+  auto result = m_adapter->flush();
   for (auto &r : result) {
     values.push_back(r.data);
   }
@@ -65,6 +84,7 @@ std::vector<uint32_t> EioIP::readback_output_bits(uint32_t length) {
   CFG_ASSERT(length > 0);
   CFG_ASSERT(length <= MAX_IO_OUTPUT_REG);
   // make sure probe read selection bit is set (Read Probe-Out-Register)
+  OclaTransactionBatch batch{m_adapter};
   if (get_prs_mode() == eio_prs_mode::PROBE_IN) {
     set_prs_mode(eio_prs_mode::PROBE_OUT);
   }
@@ -76,6 +96,7 @@ std::vector<uint32_t> EioIP::read_input_bits(uint32_t length) {
   CFG_ASSERT(length > 0);
   CFG_ASSERT(length <= MAX_IO_INPUT_REG);
   // make sure probe read selection bit is clear (Read Probe-In-Register)
+  OclaTransactionBatch batch{m_adapter};
   if (get_prs_mode() == eio_prs_mode::PROBE_OUT) {
     set_prs_mode(eio_prs_mode::PROBE_IN);
   }
@@ -84,8 +105,25 @@ std::vector<uint32_t> EioIP::read_input_bits(uint32_t length) {
 
 void EioIP::read_registers() {
   CFG_ASSERT(m_adapter != nullptr);
-  m_ctrl = m_adapter->read(m_baseaddr + EIO_CTRL);
-  m_type = m_adapter->read(m_baseaddr + EIO_IP_TYPE);
-  m_version = m_adapter->read(m_baseaddr + EIO_IP_VERSION);
-  m_id = m_adapter->read(m_baseaddr + EIO_IP_ID);
+
+  // only read the registers which are not found in the shadow
+  uint32_t *values[] = {&m_ctrl, &m_type, &m_version, &m_id};
+  uint32_t offsets[] = {EIO_CTRL, EIO_IP_TYPE, EIO_IP_VERSION, EIO_IP_ID};
+  std::vector<uint32_t> misses{};
+  OclaTransactionBatch batch{m_adapter};
+  for (uint32_t i = 0; i < 4; i++) {
+    if (m_shadow == nullptr ||
+        !m_shadow->lookup(m_baseaddr + offsets[i], *values[i])) {
+      m_adapter->queue_read(m_baseaddr + offsets[i]);
+      misses.push_back(i);
+    }
+  }
+  auto result = m_adapter->flush();
+  CFG_ASSERT(result.size() == misses.size());
+  for (uint32_t i = 0; i < misses.size(); i++) {
+    *values[misses[i]] = result[i].data;
+    if (m_shadow != nullptr) {
+      m_shadow->update(m_baseaddr + offsets[misses[i]], result[i].data);
+    }
+  }
 }
@@ -20,12 +20,14 @@
 #define EIO_CTRL_PRS_Msk (((1u << EIO_CTRL_PRS_Width) - 1) << EIO_CTRL_PRS_Pos)
 
 class OclaJtagAdapter;
+class OclaRegisterShadow;
 
 enum eio_prs_mode { PROBE_IN = 0, PROBE_OUT = 1 };
 
 class EioIP {
  public:
-  EioIP(OclaJtagAdapter *adapter, uint32_t baseaddr);
+  EioIP(OclaJtagAdapter *adapter, uint32_t baseaddr,
+        OclaRegisterShadow *shadow = nullptr);
   ~EioIP();
   std::string get_type() const;
   uint32_t get_version() const;
@@ -40,6 +42,7 @@ class EioIP {
   std::vector<uint32_t> read_bits(uint32_t addr, uint32_t length);
   void read_registers();
   OclaJtagAdapter *m_adapter;
+  OclaRegisterShadow *m_shadow;
   uint32_t m_baseaddr;
   uint32_t m_ctrl;
   uint32_t m_type;
@@ -1,21 +1,49 @@
 #include "Ocla.h"
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <map>
+#include <mutex>
+#include <thread>
 
 #include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
 #include "EioIP.h"
+#include "OclaFstWaveformWriter.h"
 #include "OclaHelpers.h"
 #include "OclaIP.h"
 #include "OclaJtagAdapter.h"
 
 #define EIO_IP_TYPE_STRING "EIO"
+#define OCLA_WAVEFORM_MAX_CHUNKS (2)
+
+// messages of the functions that OclaMultiCapture runs on its threads
+#define OCLA_POST_MSG(...) \
+  post_message(OCLA_MESSAGE_INFO, CFG_print(__VA_ARGS__))
+#define OCLA_POST_ERR(...) \
+  post_message(OCLA_MESSAGE_ERROR, CFG_print(__VA_ARGS__))
 
 std::vector<OclaDebugSession> Ocla::m_sessions{};
+std::mutex Ocla::m_sessions_mutex{};
 
 Ocla::Ocla(OclaJtagAdapter *adapter) : m_adapter(adapter) {}
 
 Ocla::~Ocla() {}
 
+void Ocla::set_message_handler(ocla_message_handler handler) {
+  m_message_handler = handler;
+}
+
+void Ocla::copy_session() {
+  std::lock_guard<std::mutex> lock(m_sessions_mutex);
+  m_session_copy = m_sessions;
+  m_use_session_copy = true;
+}
+
+void Ocla::post_message(ocla_message_type type, const std::string &message) {
+  ocla_post_message(m_message_handler, type, message);
+}
+
 void Ocla::configure(uint32_t domain_id, std::string mode,
                      std::string condition, uint32_t sample_size) {
   CFG_ASSERT(m_adapter != nullptr);
@@ -114,7 +142,7 @@ void Ocla::add_trigger(uint32_t domain_id, uint32_t probe_id,
   }
 
   // check compare width limit
-  OclaIP ocla_ip{m_adapter, instance->get_baseaddr()};
+  OclaIP ocla_ip{m_adapter, instance->get_baseaddr(), &m_shadow};
   if (compare_width > ocla_ip.get_max_compare_value_size()) {
     CFG_POST_ERR("Compare width exceeded the width limit (%d)",
                  ocla_ip.get_max_compare_value_size());
@@ -244,7 +272,7 @@ void Ocla::edit_trigger(uint32_t domain_id, uint32_t trigger_index,
   }
 
   // check compare width limit
-  OclaIP ocla_ip{m_adapter, instance->get_baseaddr()};
+  OclaIP ocla_ip{m_adapter, instance->get_baseaddr(), &m_shadow};
   if (compare_width > ocla_ip.get_max_compare_value_size()) {
     CFG_POST_ERR("Compare width exceeded the width limit (%d)",
                  ocla_ip.get_max_compare_value_size());
@@ -332,7 +360,7 @@ bool Ocla::get_hier_objects(uint32_t session_id, OclaDebugSession *&session,
                             uint32_t probe_id, OclaProbe **probe,
                             std::string signal_name, OclaSignal **signal) {
   if (!get_session(session_id, session)) {
-    CFG_POST_ERR("Debug session is not loaded.");
+    OCLA_POST_ERR("Debug session is not loaded.");
     return false;
   }
 
@@ -347,7 +375,7 @@ bool Ocla::get_hier_objects(uint32_t session_id, OclaDebugSession *&session,
     }
 
     if (!found) {
-      CFG_POST_ERR("Clock domain %d not found", domain_id);
+      OCLA_POST_ERR("Clock domain %d not found", domain_id);
       return false;
     }
   }
@@ -363,7 +391,7 @@ bool Ocla::get_hier_objects(uint32_t session_id, OclaDebugSession *&session,
     }
 
     if (!found) {
-      CFG_POST_ERR("Probe %d not found", probe_id);
+      OCLA_POST_ERR("Probe %d not found", probe_id);
       return false;
     }
   }
@@ -390,7 +418,7 @@ bool Ocla::get_hier_objects(uint32_t session_id, OclaDebugSession *&session,
     }
 
     if (!found) {
-      CFG_POST_ERR("Signal '%s' not found", signal_name.c_str());
+      OCLA_POST_ERR("Signal '%s' not found", signal_name.c_str());
       return false;
     }
   }
@@ -569,7 +597,7 @@ void Ocla::show_instance_info() {
   CFG_POST_MSG("User design loaded   : %s", session->get_filepath().c_str());
 
   for (auto const &instance : session->get_instances()) {
-    OclaIP ocla_ip{m_adapter, instance.get_baseaddr()};
+    OclaIP ocla_ip{m_adapter, instance.get_baseaddr(), &m_shadow};
 
     CFG_POST_MSG("OCLA %d", instance.get_index() + 1);
     CFG_POST_MSG("  Base address       : 0x%08x", instance.get_baseaddr());
@@ -645,17 +673,152 @@ bool Ocla::get_waveform(uint32_t domain_id, oc_waveform_t &output) {
   std::map<uint32_t, ocla_data> sample_data{};
 
   for (auto &instance : domain->get_instances()) {
-    OclaIP ocla_ip{m_adapter, instance.get_baseaddr()};
+    OclaIP ocla_ip{m_adapter, instance.get_baseaddr(), &m_shadow};
     sample_data[instance.get_index()] = ocla_ip.get_data();
   }
 
   // transform flat sample data into logical format by probes and signals
+  demux_waveform(domain, sample_data, output);
+
+  return true;
+}
+
+bool Ocla::write_waveform(uint32_t domain_id, std::string filepath,
+                          uint32_t chunk_size) {
+  CFG_ASSERT(m_adapter != nullptr);
+  CFG_ASSERT(chunk_size > 0);
+
+  OclaDebugSession *session = nullptr;
+  OclaDomain *domain = nullptr;
+
+  if (!get_hier_objects(1, session, domain_id, &domain)) {
+    return false;
+  }
+
+  CFG_TIME time_begin = CFG_time_begin();
+  std::vector<OclaIP> ocla_ips{};
+  std::map<uint32_t, ocla_data> sample_data{};
+  uint32_t max_depth = 0;
+
+  for (auto &instance : domain->get_instances()) {
+    ocla_ips.push_back(OclaIP{m_adapter, instance.get_baseaddr(), &m_shadow});
+    auto info = ocla_ips.back().get_data_info();
+    max_depth = std::max(max_depth, info.depth);
+    sample_data[instance.get_index()] = info;
+  }
+
+  // the probes and signals of the waveform define the fst variables
+  OclaFstWaveformWriter writer{};
+  oc_waveform_t header{};
+  demux_waveform(domain, sample_data, header);
+  if (!writer.open(header, filepath)) {
+    OCLA_POST_ERR("Fail to create output file '%s'", filepath.c_str());
+    return false;
+  }
+
+  // chunks are read and demuxed on this thread while the previous chunk is
+  // written by the writer thread. at most OCLA_WAVEFORM_MAX_CHUNKS chunks are
+  // in flight to bound the memory usage. a failure of the writer thread
+  // stops the reading and is rethrown on this thread.
+  std::deque<std::pair<uint64_t, oc_waveform_t>> chunks{};
+  std::mutex mutex{};
+  std::condition_variable cond{};
+  bool done = false;
+  std::exception_ptr error = nullptr;
+
+  std::thread writer_thread([&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cond.wait(lock, [&]() { return done || !chunks.empty(); });
+      if (chunks.empty()) {
+        break;
+      }
+      auto chunk = std::move(chunks.front());
+      chunks.pop_front();
+      cond.notify_all();
+      lock.unlock();
+      try {
+        writer.write_samples(chunk.second, chunk.first);
+      } catch (...) {
+        lock.lock();
+        error = std::current_exception();
+        done = true;
+        chunks.clear();
+        cond.notify_all();
+        break;
+      }
+      lock.lock();
+    }
+  });
+
+  auto finish = [&]() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    cond.notify_all();
+    writer_thread.join();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    writer.close();
+  };
+
+  try {
+    for (uint32_t line = 0; line < max_depth; line += chunk_size) {
+      uint32_t idx = 0;
+      for (auto &instance : domain->get_instances()) {
+        auto &data = sample_data[instance.get_index()];
+        uint32_t num_lines =
+            line < data.depth ? std::min(chunk_size, data.depth - line) : 0;
+        ocla_ips[idx++].read_data(data, num_lines);
+      }
+
+      oc_waveform_t chunk{};
+      demux_waveform(domain, sample_data, chunk);
+
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [&]() {
+        return error || chunks.size() < OCLA_WAVEFORM_MAX_CHUNKS;
+      });
+      if (error) {
+        break;
+      }
+      chunks.push_back({line, std::move(chunk)});
+      cond.notify_all();
+    }
+  } catch (...) {
+    // the writer thread is always joined, but an error of the writer (or of
+    // closing the file) must not replace the error of the reading
+    try {
+      finish();
+    } catch (...) {
+    }
+    throw;
+  }
+
+  finish();
+  OCLA_POST_MSG("Waveform written: %llu bytes in %.3f seconds",
+                (unsigned long long)writer.get_bytes_written(),
+                CFG_time_elapse(time_begin));
+  return true;
+}
+
+void Ocla::demux_waveform(OclaDomain *domain,
+                          std::map<uint32_t, ocla_data> &sample_data,
+                          oc_waveform_t &output) {
+  CFG_ASSERT(domain != nullptr);
+
   std::vector<oc_probe_t> probes{};
 
   for (auto &probe : domain->get_probes()) {
     oc_probe_t probe_data{};
 
     auto &data = sample_data[probe.get_instance_index()];
+    uint32_t depth = data.values.size() / std::max(data.words_per_line, 1u);
+    std::vector<uint32_t> bitpos{};
+    std::vector<uint32_t> bitwidth{};
+    std::vector<uint32_t *> outputs{};
 
     for (auto &signal : probe.get_signals()) {
       oc_signal_t signal_data{};
@@ -664,29 +827,30 @@ bool Ocla::get_waveform(uint32_t domain_id, oc_waveform_t &output) {
       signal_data.bitwidth = signal.get_bitwidth();
       signal_data.bitpos = signal.get_bitpos();
       signal_data.words_per_line = ((signal.get_bitwidth() - 1) / 32) + 1;
-      signal_data.depth = data.depth;
+      signal_data.depth = depth;
+      signal_data.type = signal.get_type();
       signal_data.values.assign(signal_data.words_per_line * signal_data.depth,
                                 0);
 
-      // copy sample
-      for (uint32_t i = 0; i < data.depth; i++) {
-        CFG_copy_bits_vec32(
-            &data.values.at(i * data.words_per_line), signal_data.bitpos,
-            &signal_data.values.at(i * signal_data.words_per_line), 0,
-            signal_data.bitwidth);
-      }
-
       probe_data.signal_list.push_back(signal_data);
     }
 
+    // split the samples into all signals of the probe in a single pass
+    for (auto &signal_data : probe_data.signal_list) {
+      bitpos.push_back(signal_data.bitpos);
+      bitwidth.push_back(signal_data.bitwidth);
+      outputs.push_back(signal_data.values.data());
+    }
+    CFG_demux_bits_vec32(data.values.data(), data.words_per_line, depth,
+                         bitpos, bitwidth, outputs);
+
     probe_data.probe_id = probe.get_index();
+    probe_data.instance_index = probe.get_instance_index();
     probes.push_back(probe_data);
   }
 
   output.domain_id = domain->get_index();
   output.probes = probes;
-
-  return true;
 }
 
 bool Ocla::get_status(uint32_t domain_id, uint32_t &status) {
@@ -718,12 +882,48 @@ bool Ocla::get_status(uint32_t domain_id, uint32_t &status) {
   // NOTE:
   // Assuming multiple instances for SINGLE clock domain will be daisy chained.
   // So only query the status of the first instance.
-  OclaIP ocla_ip{m_adapter, instance->get_baseaddr()};
+  OclaIP ocla_ip{m_adapter, instance->get_baseaddr(), &m_shadow};
   status = (uint32_t)ocla_ip.get_status();
 
   return true;
 }
 
+bool Ocla::wait(uint32_t domain_id, uint32_t timeout_ms, uint32_t &status,
+                const std::function<bool(uint32_t elapsed_ms)> &callback) {
+  CFG_ASSERT(m_adapter != nullptr);
+
+  OclaDebugSession *session = nullptr;
+  OclaDomain *domain = nullptr;
+  OclaInstance *instance = nullptr;
+
+  if (!get_hier_objects(1, session, domain_id, &domain)) {
+    return false;
+  }
+
+  // verify once for the whole wait, only OCSR is polled afterward
+  if (!verify(session)) {
+    return false;
+  }
+
+  for (auto &elem : domain->get_instances()) {
+    instance = &elem;
+    break;
+  }
+
+  if (!instance) {
+    OCLA_POST_MSG("No instance found for clock domain %d", domain_id);
+    return false;
+  }
+
+  // NOTE:
+  // Assuming multiple instances for SINGLE clock domain will be daisy chained.
+  // So only query the status of the first instance.
+  OclaIP ocla_ip{m_adapter, instance->get_baseaddr(), &m_shadow};
+  status = (uint32_t)ocla_ip.wait_for_data(timeout_ms, callback);
+
+  return true;
+}
+
 void Ocla::program(OclaDomain *domain) {
   CFG_ASSERT(m_adapter != nullptr);
   CFG_ASSERT(domain != nullptr);
@@ -738,25 +938,39 @@ void Ocla::program(OclaDomain *domain) {
   trig_cfg.compare_width = 0;
   trig_cfg.probe_num = 0;
 
+  // latch the registers of all the instances before queuing any write
+  std::vector<OclaIP> ocla_ips{};
+  for (auto &instance : domain->get_instances()) {
+    ocla_ips.push_back(
+        OclaIP{m_adapter, instance.get_baseaddr(), &m_shadow});
+  }
+
+  // program all the instances of the domain in a single batch
+  OclaTransactionBatch batch{m_adapter};
+
+  uint32_t idx = 0;
   for (auto instance : domain->get_instances()) {
-    OclaIP ocla_ip{m_adapter, instance.get_baseaddr()};
+    OclaIP &ocla_ip = ocla_ips[idx++];
+    std::vector<ocla_trigger_config> channels(ocla_ip.get_trigger_count(),
+                                              trig_cfg);
     uint32_t ch = 0;
 
     // program ip operation modes
     ocla_ip.configure(cfg);
 
-    // clear all channel config on the ip
-    for (uint32_t i = 0; i < ocla_ip.get_trigger_count(); i++) {
-      ocla_ip.configure_channel(i, trig_cfg);
-    }
-
-    // program trigger config
+    // program trigger config, the remaining channels are cleared
     for (auto trig : domain->get_triggers()) {
       if (instance.get_index() == trig.instance_index) {
-        ocla_ip.configure_channel(ch++, trig.cfg);
+        CFG_ASSERT(ch < channels.size());
+        channels[ch++] = trig.cfg;
       }
     }
+    for (uint32_t i = 0; i < channels.size(); i++) {
+      ocla_ip.configure_channel(i, channels[i]);
+    }
   }
+
+  m_adapter->flush();
 }
 
 bool Ocla::verify(OclaDebugSession *session) {
@@ -767,17 +981,17 @@ bool Ocla::verify(OclaDebugSession *session) {
 
   for (auto &domain : session->get_clock_domains()) {
     for (auto &instance : domain.get_instances()) {
-      OclaIP ocla_ip{m_adapter, instance.get_baseaddr()};
+      OclaIP ocla_ip{m_adapter, instance.get_baseaddr(), &m_shadow};
 
       if (ocla_ip.get_type() != instance.get_type()) {
-        CFG_POST_ERR("Could not detect instance %d at 0x%08x",
-                     instance.get_index(), instance.get_baseaddr());
+        OCLA_POST_ERR("Could not detect instance %d at 0x%08x",
+                      instance.get_index(), instance.get_baseaddr());
         ++error_count;
         continue;
       }
 
       if (ocla_ip.get_version() != instance.get_version()) {
-        CFG_POST_ERR(
+        OCLA_POST_ERR(
             "Instance %d version mismatched (expected=0x%x, actual=0x%x)",
             instance.get_index(), instance.get_version(),
             ocla_ip.get_version());
@@ -785,13 +999,14 @@ bool Ocla::verify(OclaDebugSession *session) {
       }
 
       if (ocla_ip.get_id() != instance.get_id()) {
-        CFG_POST_ERR("Instance %d ID mismatched (expected=0x%x, actual=0x%x)",
-                     instance.get_index(), instance.get_id(), ocla_ip.get_id());
+        OCLA_POST_ERR("Instance %d ID mismatched (expected=0x%x, actual=0x%x)",
+                      instance.get_index(), instance.get_id(),
+                      ocla_ip.get_id());
         ++error_count;
       }
 
       if (ocla_ip.get_memory_depth() != instance.get_memory_depth()) {
-        CFG_POST_ERR(
+        OCLA_POST_ERR(
             "Instance %d memory depth mismatched (expected=%d, actual=%d)",
             instance.get_index(), instance.get_memory_depth(),
             ocla_ip.get_memory_depth());
@@ -799,7 +1014,7 @@ bool Ocla::verify(OclaDebugSession *session) {
       }
 
       if (ocla_ip.get_number_of_probes() != instance.get_num_of_probes()) {
-        CFG_POST_ERR(
+        OCLA_POST_ERR(
             "Instance %d no. of probes mismatched (expected=%d, actual=%d)",
             instance.get_index(), instance.get_num_of_probes(),
             ocla_ip.get_number_of_probes());
@@ -809,17 +1024,17 @@ bool Ocla::verify(OclaDebugSession *session) {
   }
 
   for (auto &instance : session->get_eio_instances()) {
-    EioIP eio{m_adapter, instance.get_baseaddr()};
+    EioIP eio{m_adapter, instance.get_baseaddr(), &m_shadow};
     if (eio.get_type() != EIO_IP_TYPE_STRING) {
-      CFG_POST_ERR("Could not detect EIO instance %d at 0x%08x",
-                   instance.get_index(), instance.get_baseaddr());
+      OCLA_POST_ERR("Could not detect EIO instance %d at 0x%08x",
+                    instance.get_index(), instance.get_baseaddr());
       ++error_count;
       continue;
     }
   }
 
   if (error_count > 0) {
-    CFG_POST_ERR("IP Verification failed");
+    OCLA_POST_ERR("IP Verification failed");
     return false;
   }
 
@@ -843,7 +1058,7 @@ bool Ocla::start(uint32_t domain_id) {
   }
 
   if (domain->get_triggers().empty()) {
-    CFG_POST_ERR("No trigger configuration setup");
+    OCLA_POST_ERR("No trigger configuration setup");
     return false;
   }
 
@@ -853,7 +1068,7 @@ bool Ocla::start(uint32_t domain_id) {
   }
 
   if (!instance) {
-    CFG_POST_ERR("No instance found for clock domain %d", domain_id);
+    OCLA_POST_ERR("No instance found for clock domain %d", domain_id);
     return false;
   }
 
@@ -864,7 +1079,7 @@ bool Ocla::start(uint32_t domain_id) {
   // NOTE:
   // Assuming multiple instances for SINGLE clock domain will be daisy chained.
   // So only start the first instance.
-  OclaIP ocla_ip{m_adapter, instance->get_baseaddr()};
+  OclaIP ocla_ip{m_adapter, instance->get_baseaddr(), &m_shadow};
   ocla_ip.start();
 
   return true;
@@ -890,6 +1105,7 @@ void Ocla::start_session(std::string filepath) {
   OclaDebugSession session{};
 
   if (session.load(filepath, error_messages)) {
+    std::lock_guard<std::mutex> lock(m_sessions_mutex);
     m_sessions.push_back(session);
   } else {
     // print loading/parsing error message if any returned
@@ -906,6 +1122,7 @@ void Ocla::stop_session() {
     CFG_POST_ERR("Debug session is not loaded");
     return;
   }
+  std::lock_guard<std::mutex> lock(m_sessions_mutex);
   m_sessions.clear();
 }
 
@@ -931,8 +1148,9 @@ bool Ocla::find_eio_signals(std::vector<eio_signal_t> &signal_list,
 }
 
 bool Ocla::get_session(uint32_t session_id, OclaDebugSession *&session) {
-  if (session_id > 0 && m_sessions.size() >= session_id) {
-    session = &m_sessions[session_id - 1];
+  auto &sessions = m_use_session_copy ? m_session_copy : m_sessions;
+  if (session_id > 0 && sessions.size() >= session_id) {
+    session = &sessions[session_id - 1];
     return true;
   }
   return false;
@@ -1035,7 +1253,7 @@ bool Ocla::set_io(std::vector<std::string> signal_list) {
     return false;
   }
 
-  EioIP eio{m_adapter, instance->get_baseaddr()};
+  EioIP eio{m_adapter, instance->get_baseaddr(), &m_shadow};
   uint32_t num_words = instance->get_num_words(IO_OUTPUT);
   uint32_t i = 0;
   auto output = eio.readback_output_bits(num_words);
@@ -1106,7 +1324,7 @@ bool Ocla::get_io(std::vector<std::string> signal_list,
   }
 
   // read io
-  EioIP eio{m_adapter, instance->get_baseaddr()};
+  EioIP eio{m_adapter, instance->get_baseaddr(), &m_shadow};
   auto result = eio.read_input_bits((msb_pos / 32) + 1);
 
   // transform result
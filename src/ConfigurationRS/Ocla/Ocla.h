@@ -2,10 +2,15 @@
 #define __OCLA_H__
 
 #include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "OclaDebugSession.h"
+#include "OclaJtagAdapter.h"
+#include "OclaRegisterShadow.h"
 
 class OclaJtagAdapter;
 class OclaWaveformWriter;
@@ -18,11 +23,13 @@ struct oc_signal_t {
   uint32_t bitpos;
   uint32_t words_per_line;
   uint32_t depth;
+  oc_signal_type_t type;
 };
 
 struct oc_probe_t {
   std::vector<oc_signal_t> signal_list;
   uint32_t probe_id;
+  uint32_t instance_index;
 };
 
 struct oc_waveform_t {
@@ -51,7 +58,11 @@ class Ocla {
                     uint32_t compare_width);
   void remove_trigger(uint32_t domain_id, uint32_t trigger_index);
   bool get_waveform(uint32_t domain_id, oc_waveform_t &output);
+  bool write_waveform(uint32_t domain_id, std::string filepath,
+                      uint32_t chunk_size = 1024);
   bool get_status(uint32_t domain_id, uint32_t &status);
+  bool wait(uint32_t domain_id, uint32_t timeout_ms, uint32_t &status,
+            const std::function<bool(uint32_t elapsed_ms)> &callback = nullptr);
   bool start(uint32_t domain_id);
   void start_session(std::string filepath);
   bool set_io(std::vector<std::string> signal_list);
@@ -60,10 +71,27 @@ class Ocla {
   void stop_session();
   void show_info();
   void show_instance_info();
+  // messages are posted with CFG_POST_MSG/CFG_POST_ERR unless a handler is
+  // set, e.g. to hand them over to another thread
+  void set_message_handler(ocla_message_handler handler);
+  // use a copy of the loaded debug session from now on, so that the session
+  // can be loaded or unloaded by the command thread while this object is used
+  // by another thread
+  void copy_session();
 
  private:
+  // the debug session is shared by all the Ocla objects. it is loaded and
+  // unloaded from the command thread, other threads work on a copy of it
+  // (see copy_session)
   static std::vector<OclaDebugSession> m_sessions;
+  static std::mutex m_sessions_mutex;
+  std::vector<OclaDebugSession> m_session_copy{};
+  bool m_use_session_copy = false;
   OclaJtagAdapter *m_adapter;
+  OclaRegisterShadow m_shadow;
+  ocla_message_handler m_message_handler{};
+
+  void post_message(ocla_message_type type, const std::string &message);
 
   bool get_session(uint32_t session_id, OclaDebugSession *&session);
   bool get_hier_objects(uint32_t session_id, OclaDebugSession *&session,
@@ -80,6 +108,9 @@ class Ocla {
   void show_signal_table(std::vector<OclaSignal> &signal_list);
   void show_eio_signal_table(std::vector<eio_signal_t> &signal_list);
   void program(OclaDomain *domain);
+  void demux_waveform(OclaDomain *domain,
+                      std::map<uint32_t, ocla_data> &sample_data,
+                      oc_waveform_t &output);
   bool verify(OclaDebugSession *session);
   bool find_eio_signals(std::vector<eio_signal_t> &signal_list,
                         std::vector<std::string> signal_names,
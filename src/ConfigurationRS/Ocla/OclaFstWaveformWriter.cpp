@@ -2,9 +2,12 @@
 
 #include <time.h>
 
+#include <algorithm>
+#include <filesystem>
 #include <iostream>
 #include <map>
 #include <string>
+#include <tuple>
 
 #include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
 #include "fstapi.h"
@@ -15,63 +18,125 @@
 #define FST_TS_NS -9
 #define FST_TS_PS -12
 
-struct fst_signal_var_t {
-  fstHandle handle;
-  oc_signal_t& signal;
-};
+OclaFstWaveformWriter::OclaFstWaveformWriter()
+    : m_fst(nullptr), m_bytes_written(0) {}
+
+OclaFstWaveformWriter::~OclaFstWaveformWriter() { close(); }
 
 bool OclaFstWaveformWriter::write(oc_waveform_t& waveform,
                                   std::string filepath) {
-  std::vector<fst_signal_var_t> fst_signals{};
-  uint32_t max_depth = 0;
+  if (!open(waveform, filepath)) {
+    return false;
+  }
+  write_samples(waveform, 0);
+  close();
+  return true;
+}
 
-  void* fst = fstWriterCreate(filepath.c_str(), /* use_compressed_hier */ 1);
-  if (!fst) {
-    CFG_POST_ERR("Fail to create output file '%s'", filepath.c_str());
+bool OclaFstWaveformWriter::open(oc_waveform_t& waveform,
+                                 std::string filepath) {
+  close();
+
+  m_bytes_written = 0;
+  m_fst = fstWriterCreate(filepath.c_str(), /* use_compressed_hier */ 1);
+  if (!m_fst) {
     return false;
   }
+  m_filepath = filepath;
 
   // create header info
-  fstWriterSetPackType(fst, FST_WR_PT_LZ4);
-  fstWriterSetTimescale(fst, FST_TS_NS);
-  fstWriterSetComment(fst, "Created by RapidSilicon OCLA Debugger Tool");
-  fstWriterSetDate(fst, CFG_get_time().c_str());
+  fstWriterSetPackType(m_fst, FST_WR_PT_LZ4);
+  fstWriterSetTimescale(m_fst, FST_TS_NS);
+  fstWriterSetComment(m_fst, "Created by RapidSilicon OCLA Debugger Tool");
+  fstWriterSetDate(m_fst, CFG_get_time().c_str());
 
   // create signal groups
-  fstWriterSetScope(fst, FST_ST_VCD_PROGRAM, "OCLA Debugger", NULL);
+  fstWriterSetScope(m_fst, FST_ST_VCD_PROGRAM, "OCLA Debugger", NULL);
   std::string name =
       std::string("Clock Domain ") + std::to_string(waveform.domain_id);
-  fstWriterSetScope(fst, FST_ST_VCD_MODULE, name.c_str(), NULL);
+  fstWriterSetScope(m_fst, FST_ST_VCD_MODULE, name.c_str(), NULL);
+
+  // signals sampling the same bits of an instance share one fst variable
+  std::map<std::tuple<uint32_t, uint32_t, uint32_t>, fstHandle> vars{};
 
   // create signals variables for each probe
   for (auto& probe : waveform.probes) {
     std::string probe_name =
         std::string("Probe ") + std::to_string(probe.probe_id);
-    fstWriterSetScope(fst, FST_ST_VCD_FUNCTION, probe_name.c_str(), NULL);
+    fstWriterSetScope(m_fst, FST_ST_VCD_FUNCTION, probe_name.c_str(), NULL);
 
     for (auto& signal : probe.signal_list) {
-      max_depth = std::max(max_depth, signal.depth);
-      fstHandle var = fstWriterCreateVar(fst, FST_VT_VCD_WIRE, FST_VD_INPUT,
+      auto key = std::make_tuple(probe.instance_index, signal.bitpos,
+                                 signal.bitwidth);
+      auto it = vars.find(key);
+      fstHandle alias = it == vars.end() ? 0 : it->second;
+      fstHandle var = fstWriterCreateVar(m_fst, FST_VT_VCD_WIRE, FST_VD_INPUT,
                                          signal.bitwidth, signal.name.c_str(),
-                                         /* alias */ 0);
-      fst_signals.push_back({var, signal});
+                                         alias);
+      if (alias == 0) {
+        vars[key] = var;
+      }
+      m_vars.push_back({var, alias != 0, signal.type == CONSTANT, false, {}});
     }
-    fstWriterSetUpscope(fst);
+    fstWriterSetUpscope(m_fst);
   }
 
-  // write waveform
-  for (uint32_t i = 0; i < max_depth; i++) {
-    fstWriterEmitTimeChange(fst, i);
-    for (auto& var : fst_signals) {
-      if (i < var.signal.depth) {
-        fstWriterEmitValueChangeVec32(
-            fst, var.handle, var.signal.bitwidth,
-            &var.signal.values.at(i * var.signal.words_per_line));
+  return true;
+}
+
+void OclaFstWaveformWriter::write_samples(oc_waveform_t& chunk,
+                                          uint64_t time) {
+  CFG_ASSERT(m_fst != nullptr);
+
+  std::vector<std::pair<fst_var_t*, oc_signal_t*>> fst_signals{};
+  uint32_t max_depth = 0;
+
+  for (auto& probe : chunk.probes) {
+    for (auto& signal : probe.signal_list) {
+      CFG_ASSERT(fst_signals.size() < m_vars.size());
+      fst_var_t* var = &m_vars[fst_signals.size()];
+      max_depth = std::max(max_depth, signal.depth);
+      // aliases share the value changes of their target
+      if (!var->is_alias) {
+        fst_signals.push_back({var, &signal});
+      } else {
+        fst_signals.push_back({nullptr, nullptr});
       }
     }
   }
 
-  fstWriterClose(fst);
+  // write waveform, only the values that changed since the last emit
+  for (uint32_t i = 0; i < max_depth; i++) {
+    fstWriterEmitTimeChange(m_fst, time + i);
+    for (auto& [var, signal] : fst_signals) {
+      if (var == nullptr || i >= signal->depth) {
+        continue;
+      }
+      if (var->emitted && var->is_constant) {
+        continue;
+      }
+      const uint32_t* value = &signal->values.at(i * signal->words_per_line);
+      if (var->emitted &&
+          std::equal(var->last_value.begin(), var->last_value.end(), value)) {
+        continue;
+      }
+      fstWriterEmitValueChangeVec32(m_fst, var->handle, signal->bitwidth,
+                                    value);
+      var->last_value.assign(value, value + signal->words_per_line);
+      var->emitted = true;
+    }
+  }
+}
 
-  return true;
+void OclaFstWaveformWriter::close() {
+  if (m_fst != nullptr) {
+    fstWriterClose(m_fst);
+    m_fst = nullptr;
+    std::error_code ec;
+    m_bytes_written = std::filesystem::file_size(m_filepath, ec);
+    if (ec) {
+      m_bytes_written = 0;
+    }
+  }
+  m_vars.clear();
 }
@@ -1,11 +1,39 @@
 #ifndef __OCLAFSTWAVEFORMWRITER_H__
 #define __OCLAFSTWAVEFORMWRITER_H__
 
+#include "Configuration/CFGCommon/CFGCommon.h"
 #include "Ocla.h"
 
 class OclaFstWaveformWriter {
  public:
+  OclaFstWaveformWriter();
+  ~OclaFstWaveformWriter();
   bool write(oc_waveform_t &waveform, std::string filepath);
+
+  // Streaming interface. open() creates the signal variables of the waveform
+  // (signal values are not used), write_samples() appends the samples of a
+  // chunk with the same probes and signals starting at the given time and
+  // close() finalizes the file. Only value changes are emitted, constant
+  // signals are emitted once and signals sampling the same probe bits are
+  // written as aliases of the first one. The writer posts no messages, the
+  // caller reports the failures and the result.
+  bool open(oc_waveform_t &waveform, std::string filepath);
+  void write_samples(oc_waveform_t &chunk, uint64_t time);
+  void close();
+  uint64_t get_bytes_written() const { return m_bytes_written; }
+
+ private:
+  struct fst_var_t {
+    uint32_t handle;
+    bool is_alias;
+    bool is_constant;
+    bool emitted;
+    std::vector<uint32_t> last_value;
+  };
+  void *m_fst;
+  std::string m_filepath;
+  std::vector<fst_var_t> m_vars;
+  uint64_t m_bytes_written;
 };
 
 #endif  //__OCLAFSTWAVEFORMWRITER_H__
@@ -82,16 +82,80 @@ void CFG_write_bit_vec32(uint32_t* data, uint32_t pos, uint32_t value) {
   }
 }
 
+// read up to 32 bits starting at bit 'pos'. only touches the words that hold
+// the requested bits
+static inline uint32_t read_bits_u32(const uint32_t* data, uint32_t pos,
+                                     uint32_t nbits) {
+  uint32_t shift = pos % 32;
+  const uint32_t* p = data + (pos / 32);
+  uint32_t value = p[0] >> shift;
+  if (shift != 0 && shift + nbits > 32) {
+    value |= p[1] << (32 - shift);
+  }
+  return nbits < 32 ? value & ((1u << nbits) - 1) : value;
+}
+
+// write the lower 'nbits' (1 to 32) of value at bit 'pos'
+static inline void write_bits_u32(uint32_t* data, uint32_t pos,
+                                  uint32_t nbits, uint32_t value) {
+  uint32_t shift = pos % 32;
+  uint32_t* p = data + (pos / 32);
+  uint64_t mask = (nbits < 32 ? (1ull << nbits) - 1 : 0xffffffffull) << shift;
+  uint64_t bits = (uint64_t)value << shift;
+  p[0] = (p[0] & ~(uint32_t)mask) | ((uint32_t)bits & (uint32_t)mask);
+  if (shift + nbits > 32) {
+    p[1] = (p[1] & ~(uint32_t)(mask >> 32)) |
+           ((uint32_t)(bits >> 32) & (uint32_t)(mask >> 32));
+  }
+}
+
 void CFG_copy_bits_vec32(uint32_t* data, uint32_t pos, uint32_t* output,
                          uint32_t output_pos, uint32_t nbits) {
   // callee should make sure data ptr not out of bound
   CFG_ASSERT(data != nullptr);
   CFG_ASSERT(output != nullptr);
-  // naive implementation that does the copying bit by bit.
-  // this is still ok for small dataset.
-  for (uint32_t i = 0; i < nbits; i++) {
-    CFG_write_bit_vec32(output, output_pos + i,
-                        CFG_read_bit_vec32(data, pos + i));
+  // copy up to 32 bits at a time
+  while (nbits > 0) {
+    uint32_t n = nbits < 32 ? nbits : 32;
+    write_bits_u32(output, output_pos, n, read_bits_u32(data, pos, n));
+    pos += n;
+    output_pos += n;
+    nbits -= n;
+  }
+}
+
+void CFG_demux_bits_vec32(uint32_t* data, uint32_t words_per_line,
+                          uint32_t depth, const std::vector<uint32_t>& bitpos,
+                          const std::vector<uint32_t>& bitwidth,
+                          const std::vector<uint32_t*>& outputs) {
+  CFG_ASSERT(depth == 0 || data != nullptr);
+  CFG_ASSERT(bitpos.size() == bitwidth.size());
+  CFG_ASSERT(bitpos.size() == outputs.size());
+
+  std::vector<uint32_t> words(bitwidth.size(), 0);
+  for (size_t j = 0; j < bitwidth.size(); j++) {
+    CFG_ASSERT(bitwidth[j] > 0);
+    CFG_ASSERT(depth == 0 ||
+               bitpos[j] + bitwidth[j] <= words_per_line * 32);
+    CFG_ASSERT(depth == 0 || outputs[j] != nullptr);
+    words[j] = ((bitwidth[j] - 1) / 32) + 1;
+  }
+
+  // visit every sample line once and scatter it into all the fields. the
+  // output samples are word aligned so whole words are stored at once.
+  for (uint32_t i = 0; i < depth; i++) {
+    const uint32_t* line = data + (size_t(i) * words_per_line);
+    for (size_t j = 0; j < bitwidth.size(); j++) {
+      uint32_t* out = outputs[j] + (size_t(i) * words[j]);
+      uint32_t pos = bitpos[j];
+      uint32_t nbits = bitwidth[j];
+      for (uint32_t k = 0; k < words[j]; k++) {
+        uint32_t n = nbits < 32 ? nbits : 32;
+        out[k] = read_bits_u32(line, pos, n);
+        pos += n;
+        nbits -= n;
+      }
+    }
   }
 }
 
@@ -213,6 +277,28 @@ uint32_t CFG_parse_signal(std::string& signal_str, std::string& name,
 }
 
 // helpers to convert enum to string and vice versa
+void ocla_post_message(const ocla_message_handler &handler,
+                       ocla_message_type type, const std::string &message) {
+  if (handler) {
+    handler(type, message);
+    return;
+  }
+  switch (type) {
+    case OCLA_MESSAGE_DEBUG:
+      CFG_POST_DBG("%s", message.c_str());
+      break;
+    case OCLA_MESSAGE_INFO:
+      CFG_POST_MSG("%s", message.c_str());
+      break;
+    case OCLA_MESSAGE_WARNING:
+      CFG_POST_WARNING("%s", message.c_str());
+      break;
+    case OCLA_MESSAGE_ERROR:
+      CFG_POST_ERR("%s", message.c_str());
+      break;
+  }
+}
+
 std::string convert_ocla_trigger_mode_to_string(ocla_trigger_mode mode,
                                                 std::string defval) {
   if (ocla_trigger_mode_to_string_map.find(mode) !=
@@ -3,8 +3,10 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "OclaIP.h"
+#include "OclaJtagAdapter.h"
 
 #define OCLA_SIGNAL_PATTERN_1 (1)  // pattern 1: count[13:2]
 #define OCLA_SIGNAL_PATTERN_2 (2)  // pattern 2: 4'0000
@@ -14,6 +16,10 @@
 #define OCLA_SIGNAL_PATTERN_6 (6)  // pattern 6: start=0x1
 #define OCLA_SIGNAL_PATTERN_7 (7)  // pattern 7: #3=123
 
+// posts the message with the handler if any, otherwise with CFG_POST_*
+void ocla_post_message(const ocla_message_handler &handler,
+                       ocla_message_type type, const std::string &message);
+
 std::string convert_ocla_trigger_mode_to_string(
     ocla_trigger_mode mode, std::string defval = "(unknown)");
 
@@ -54,6 +60,14 @@ void CFG_write_bit_vec32(uint32_t *data, uint32_t pos, uint32_t value);
 void CFG_copy_bits_vec32(uint32_t *src, uint32_t pos, uint32_t *dest,
                          uint32_t dest_pos, uint32_t nbits);
 
+// Split 'depth' sample lines of 'words_per_line' words into bit fields. The
+// samples of field i are written to outputs[i], one sample per
+// ((bitwidth[i] - 1) / 32) + 1 words.
+void CFG_demux_bits_vec32(uint32_t *data, uint32_t words_per_line,
+                          uint32_t depth, const std::vector<uint32_t> &bitpos,
+                          const std::vector<uint32_t> &bitwidth,
+                          const std::vector<uint32_t *> &outputs);
+
 uint32_t CFG_parse_signal(std::string &signal_str, std::string &name,
                           uint32_t &bit_start, uint32_t &bit_end,
                           uint32_t &bit_width, uint64_t *value = nullptr);
@@ -1,11 +1,16 @@
 #include "OclaIP.h"
 
+#include <algorithm>
+
 #include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
 #include "OclaHelpers.h"
 #include "OclaJtagAdapter.h"
+#include "OclaRegisterShadow.h"
 
-OclaIP::OclaIP(OclaJtagAdapter *adapter, uint32_t base_addr)
+OclaIP::OclaIP(OclaJtagAdapter *adapter, uint32_t base_addr,
+               OclaRegisterShadow *shadow)
     : m_adapter(adapter),
+      m_shadow(shadow),
       m_base_addr(base_addr),
       m_type(0),
       m_version(0),
@@ -18,7 +23,7 @@ OclaIP::OclaIP(OclaJtagAdapter *adapter, uint32_t base_addr)
   read_registers();
 }
 
-OclaIP::OclaIP() : m_adapter(nullptr), m_base_addr(0) {}
+OclaIP::OclaIP() : m_adapter(nullptr), m_shadow(nullptr), m_base_addr(0) {}
 
 OclaIP::~OclaIP() {}
 
@@ -28,6 +33,34 @@ ocla_status OclaIP::get_status() const {
   return (ocla_status)((ocsr & OCSR_DA_Msk) >> OCSR_DA_Pos);
 }
 
+ocla_status OclaIP::wait_for_data(
+    uint32_t timeout_ms,
+    const std::function<bool(uint32_t elapsed_ms)> &callback) const {
+  CFG_ASSERT(m_adapter != nullptr);
+
+  CFG_TIME time_begin = CFG_time_begin();
+  uint32_t interval = OCLA_WAIT_MIN_INTERVAL_MS;
+
+  // poll OCSR with exponential backoff so that a trigger firing early is
+  // noticed early while a long wait does not flood the jtag link
+  while (true) {
+    ocla_status status = get_status();
+    if (status == DATA_AVAILABLE) {
+      return status;
+    }
+    uint32_t elapsed = (uint32_t)(CFG_nano_time_elapse(time_begin) / 1000000);
+    if (elapsed >= timeout_ms) {
+      return status;
+    }
+    // let the caller process its events or cancel the wait
+    if (callback && !callback(elapsed)) {
+      return status;
+    }
+    CFG_sleep_ms(std::min(interval, timeout_ms - elapsed));
+    interval = std::min(interval * 2, (uint32_t)OCLA_WAIT_MAX_INTERVAL_MS);
+  }
+}
+
 uint32_t OclaIP::get_trigger_count() const {
   uint32_t tc = (m_ocsr & OCSR_TC_Msk) >> OCSR_TC_Pos;
   return tc + 1;
@@ -73,7 +106,7 @@ void OclaIP::configure(ocla_config &cfg) {
   // full
   CFG_set_bitfield_u32(m_tmtr, TMTR_NS_Pos, TMTR_NS_Width, cfg.sample_size);
 
-  m_adapter->write(m_base_addr + TMTR, m_tmtr);
+  write_registers({{TMTR, m_tmtr}});
 }
 
 void OclaIP::configure_channel(uint32_t channel, ocla_trigger_config &cfg) {
@@ -109,14 +142,21 @@ void OclaIP::configure_channel(uint32_t channel, ocla_trigger_config &cfg) {
   }
 
   m_chregs[channel] = reg;
-  m_adapter->write(m_base_addr + TSSR + (channel * 0x30), reg.tssr);
-  m_adapter->write(m_base_addr + TCUR + (channel * 0x30), reg.tcur);
-  m_adapter->write(m_base_addr + TDCR + (channel * 0x30), reg.tdcr);
+  write_registers({{TSSR + (channel * 0x30), reg.tssr},
+                   {TCUR + (channel * 0x30), reg.tcur},
+                   {TDCR + (channel * 0x30), reg.tdcr}});
 }
 
 void OclaIP::reset() {
   CFG_ASSERT(m_adapter != nullptr);
-  m_adapter->write(m_base_addr + OCCR, (1u << OCCR_SR_Pos));
+  write_registers({{OCCR, (1u << OCCR_SR_Pos)}});
+
+  // all configuration registers are back to their default values, read them
+  // again so that get_config() and get_channel_config() are up to date
+  if (m_shadow != nullptr) {
+    m_shadow->invalidate(m_base_addr, TSSR + (get_trigger_count() * 0x30));
+  }
+  read_config_registers();
 }
 
 void OclaIP::start() {
@@ -127,14 +167,16 @@ void OclaIP::start() {
     In case of back to back activation, it requires a dummy write to the OCCR
     register before setting ST bit for the start samplling to work.
   */
-  m_adapter->write(m_base_addr + OCCR, 0);
-
-  m_adapter->write(m_base_addr + OCCR, (1u << OCCR_ST_Pos));
+  write_registers({{OCCR, 0}, {OCCR, (1u << OCCR_ST_Pos)}});
 }
 
 ocla_data OclaIP::get_data() const {
-  CFG_ASSERT(m_adapter != nullptr);
+  ocla_data data = get_data_info();
+  read_data(data, data.depth);
+  return data;
+}
 
+ocla_data OclaIP::get_data_info() const {
   ocla_data data;
 
   if (m_tmtr & TMTR_FNS_Msk) {
@@ -145,39 +187,119 @@ ocla_data OclaIP::get_data() const {
 
   data.width = get_number_of_probes();
   data.words_per_line = ((data.width - 1) / 32) + 1;
+  return data;
+}
+
+void OclaIP::read_data(ocla_data &data, uint32_t num_lines) const {
+  CFG_ASSERT(m_adapter != nullptr);
+
+  // TBDR streams the acquisition data, each call continues from where the
+  // previous one stopped
+  data.values.clear();
+  if (num_lines == 0) {
+    return;
+  }
   auto result =
-      m_adapter->read(m_base_addr + TBDR, data.depth * data.words_per_line);
+      m_adapter->read(m_base_addr + TBDR, num_lines * data.words_per_line);
+  data.values.reserve(result.size());
   for (auto const &value : result) {
     data.values.push_back(value.data);
   }
-  return data;
 }
 
 void OclaIP::read_registers() {
   CFG_ASSERT(m_adapter != nullptr);
 
   // latch all read-only registers
-  m_type = m_adapter->read(m_base_addr + IP_TYPE);
-  m_version = m_adapter->read(m_base_addr + IP_VERSION);
-  m_id = m_adapter->read(m_base_addr + IP_ID);
-  m_uidp0 = m_adapter->read(m_base_addr + UIDP0);
-  m_uidp1 = m_adapter->read(m_base_addr + UIDP1);
-  m_ocsr = m_adapter->read(m_base_addr + OCSR);
+  // NOTE: only the TC and MCVS fields of the latched OCSR are used, DA is
+  // always read from the IP by get_status()
+  std::vector<uint32_t> values{};
+  latch_registers({IP_TYPE, IP_VERSION, IP_ID, UIDP0, UIDP1, OCSR}, values);
+  m_type = values[0];
+  m_version = values[1];
+  m_id = values[2];
+  m_uidp0 = values[3];
+  m_uidp1 = values[4];
+  m_ocsr = values[5];
+
+  read_config_registers();
+}
 
-  // latch the global configuration register
-  m_tmtr = m_adapter->read(m_base_addr + TMTR);
+void OclaIP::read_config_registers() {
+  CFG_ASSERT(m_adapter != nullptr);
 
-  // latch all channle configuration registers
+  // latch the global and all channel configuration registers
+  std::vector<uint32_t> offsets{TMTR};
+  for (uint32_t i = 0; i < get_trigger_count(); i++) {
+    for (uint32_t offset : {TSSR, TCUR, TDCR, MASK}) {
+      offsets.push_back(offset + (i * 0x30));
+    }
+  }
+  std::vector<uint32_t> values{};
+  latch_registers(offsets, values);
+  m_tmtr = values[0];
+  m_chregs.clear();
   for (uint32_t i = 0; i < get_trigger_count(); i++) {
     ocla_channel_register reg{};
-    reg.tssr = m_adapter->read(m_base_addr + TSSR + (i * 0x30));
-    reg.tcur = m_adapter->read(m_base_addr + TCUR + (i * 0x30));
-    reg.tdcr = m_adapter->read(m_base_addr + TDCR + (i * 0x30));
-    reg.mask = m_adapter->read(m_base_addr + MASK + (i * 0x30));
+    reg.tssr = values[1 + i * 4];
+    reg.tcur = values[1 + i * 4 + 1];
+    reg.tdcr = values[1 + i * 4 + 2];
+    reg.mask = values[1 + i * 4 + 3];
     m_chregs.push_back(reg);
   }
 }
 
+void OclaIP::latch_registers(const std::vector<uint32_t> &offsets,
+                             std::vector<uint32_t> &values) {
+  CFG_ASSERT(!m_adapter->is_queuing());
+
+  // only read the registers which are not found in the shadow. OCSR is a
+  // status register, it is never shadowed
+  std::vector<size_t> misses{};
+  values.assign(offsets.size(), 0);
+  OclaTransactionBatch batch{m_adapter};
+  for (size_t i = 0; i < offsets.size(); i++) {
+    if (m_shadow == nullptr || offsets[i] == OCSR ||
+        !m_shadow->lookup(m_base_addr + offsets[i], values[i])) {
+      m_adapter->queue_read(m_base_addr + offsets[i]);
+      misses.push_back(i);
+    }
+  }
+  auto result = m_adapter->flush();
+  CFG_ASSERT(result.size() == misses.size());
+  for (size_t i = 0; i < misses.size(); i++) {
+    values[misses[i]] = result[i].data;
+    if (m_shadow != nullptr && offsets[misses[i]] != OCSR) {
+      m_shadow->update(m_base_addr + offsets[misses[i]], result[i].data);
+    }
+  }
+}
+
+void OclaIP::write_registers(
+    const std::vector<std::pair<uint32_t, uint32_t>> &regs) {
+  CFG_ASSERT(m_adapter != nullptr);
+
+  // join the batch opened by the caller if any, otherwise issue the writes as
+  // a batch of its own
+  OclaTransactionBatch batch{m_adapter};
+  for (auto &reg : regs) {
+    // skip the write when the register already holds the value. OCCR is a
+    // command register, every write to it has to reach the ip
+    if (m_shadow != nullptr && reg.first != OCCR) {
+      uint32_t value = 0;
+      if (m_shadow->lookup(m_base_addr + reg.first, value) &&
+          value == reg.second) {
+        continue;
+      }
+      m_shadow->update(m_base_addr + reg.first, reg.second);
+    }
+    m_adapter->queue_write(m_base_addr + reg.first, reg.second);
+  }
+  if (batch.is_own_batch()) {
+    m_adapter->flush();
+  }
+}
+
 ocla_config OclaIP::get_config() const {
   ocla_config cfg;
 
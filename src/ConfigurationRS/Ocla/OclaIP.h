@@ -2,7 +2,9 @@
 #define __OCLAIP_H__
 
 #include <cstdint>
+#include <functional>
 #include <string>
+#include <utility>
 #include <vector>
 
 #define IP_TYPE (0x00)     // [RO] This register hold the IP Type "ocla"
@@ -95,7 +97,12 @@
 #define OCCR_SR_Width (1)
 #define OCCR_SR_Msk (((1u << OCCR_SR_Width) - 1) << OCCR_SR_Pos)
 
+// status polling interval of wait_for_data(), doubled after every poll
+#define OCLA_WAIT_MIN_INTERVAL_MS (1)
+#define OCLA_WAIT_MAX_INTERVAL_MS (200)
+
 class OclaJtagAdapter;
+class OclaRegisterShadow;
 
 enum ocla_status { NA = 0, DATA_AVAILABLE = 1 };
 
@@ -155,7 +162,8 @@ struct ocla_channel_register {
 class OclaIP {
  public:
   OclaIP();
-  OclaIP(OclaJtagAdapter *adapter, uint32_t base_addr);
+  OclaIP(OclaJtagAdapter *adapter, uint32_t base_addr,
+         OclaRegisterShadow *shadow = nullptr);
   virtual ~OclaIP();
   void configure(ocla_config &cfg);
   void configure_channel(uint32_t channel, ocla_trigger_config &trig_cfg);
@@ -164,6 +172,9 @@ class OclaIP {
   ocla_config get_config() const;
   ocla_trigger_config get_channel_config(uint32_t channel) const;
   ocla_status get_status() const;
+  ocla_status wait_for_data(
+      uint32_t timeout_ms,
+      const std::function<bool(uint32_t elapsed_ms)> &callback = nullptr) const;
   uint32_t get_number_of_probes() const;
   uint32_t get_memory_depth() const;
   uint32_t get_trigger_count() const;
@@ -172,11 +183,18 @@ class OclaIP {
   std::string get_type() const;
   uint32_t get_id() const;
   ocla_data get_data() const;
+  ocla_data get_data_info() const;
+  void read_data(ocla_data &data, uint32_t num_lines) const;
   uint32_t get_base_addr() const { return m_base_addr; }
 
  private:
   void read_registers();
+  void read_config_registers();
+  void latch_registers(const std::vector<uint32_t> &offsets,
+                       std::vector<uint32_t> &values);
+  void write_registers(const std::vector<std::pair<uint32_t, uint32_t>> &regs);
   OclaJtagAdapter *m_adapter;
+  OclaRegisterShadow *m_shadow;
   uint32_t m_base_addr;
   uint32_t m_type;
   uint32_t m_version;
@@ -2,6 +2,8 @@
 #define __OCLAJTAGADAPTER_H__
 
 #include <cstdint>
+#include <functional>
+#include <string>
 #include <vector>
 
 #include "Configuration/HardwareManager/Device.h"
@@ -13,6 +15,24 @@ struct jtag_read_result {
   uint32_t status;
 };
 
+struct jtag_transaction {
+  bool is_write;
+  uint32_t address;
+  uint32_t data;
+  uint32_t num_reads;
+  uint32_t increase_by;
+};
+
+enum ocla_message_type {
+  OCLA_MESSAGE_DEBUG = 0,
+  OCLA_MESSAGE_INFO,
+  OCLA_MESSAGE_WARNING,
+  OCLA_MESSAGE_ERROR
+};
+
+typedef std::function<void(ocla_message_type type, const std::string &message)>
+    ocla_message_handler;
+
 class OclaJtagAdapter {
  public:
   virtual ~OclaJtagAdapter(){};
@@ -23,6 +43,89 @@ class OclaJtagAdapter {
                                              uint32_t increase_by = 0) = 0;
   virtual void set_target_device(FOEDAG::Device device,
                                  std::vector<FOEDAG::Tap> taplist) = 0;
+
+  // messages of the adapter are posted with CFG_POST_* unless a handler is
+  // set, e.g. when the adapter is used from another thread
+  void set_message_handler(ocla_message_handler handler) {
+    m_message_handler = handler;
+  }
+
+  // Transaction queue. Transactions queued after begin_transactions() are
+  // issued in order by flush(), which returns the results of all the queued
+  // reads. Adapter that can issue a whole batch in a single round trip should
+  // override flush(). The default implementation issues them one by one.
+  void begin_transactions() {
+    m_transactions.clear();
+    m_queuing = true;
+  }
+  void queue_write(uint32_t addr, uint32_t data) {
+    m_transactions.push_back({true, addr, data, 0, 0});
+  }
+  void queue_read(uint32_t base_addr, uint32_t num_reads = 1,
+                  uint32_t increase_by = 0) {
+    m_transactions.push_back({false, base_addr, 0, num_reads, increase_by});
+  }
+  bool is_queuing() const { return m_queuing; }
+  // drops the queued transactions and leaves queuing mode without issuing
+  // anything
+  void cancel_transactions() { take_transactions(); }
+  virtual std::vector<jtag_read_result> flush() {
+    std::vector<jtag_read_result> results{};
+    auto transactions = take_transactions();
+    for (auto& t : transactions) {
+      if (t.is_write) {
+        write(t.address, t.data);
+      } else if (t.num_reads == 1 && t.increase_by == 0) {
+        results.push_back({t.address, read(t.address), 0});
+      } else {
+        auto values = read(t.address, t.num_reads, t.increase_by);
+        results.insert(results.end(), values.begin(), values.end());
+      }
+    }
+    return results;
+  }
+
+ protected:
+  const ocla_message_handler &get_message_handler() const {
+    return m_message_handler;
+  }
+  std::vector<jtag_transaction> take_transactions() {
+    std::vector<jtag_transaction> transactions{};
+    transactions.swap(m_transactions);
+    m_queuing = false;
+    return transactions;
+  }
+
+ private:
+  ocla_message_handler m_message_handler{};
+  std::vector<jtag_transaction> m_transactions{};
+  bool m_queuing = false;
+};
+
+// Scoped batch of transactions. It joins the batch that is already open,
+// otherwise it opens one of its own, which is cancelled if the scope is left
+// before flush() (e.g. something throws) so the adapter never stays in
+// queuing mode
+class OclaTransactionBatch {
+ public:
+  explicit OclaTransactionBatch(OclaJtagAdapter *adapter)
+      : m_adapter(adapter), m_own_batch(!adapter->is_queuing()) {
+    if (m_own_batch) {
+      m_adapter->begin_transactions();
+    }
+  }
+  OclaTransactionBatch(const OclaTransactionBatch &) = delete;
+  OclaTransactionBatch &operator=(const OclaTransactionBatch &) = delete;
+  ~OclaTransactionBatch() {
+    if (m_own_batch && m_adapter->is_queuing()) {
+      m_adapter->cancel_transactions();
+    }
+  }
+  bool is_own_batch() const { return m_own_batch; }
+
+ private:
+  OclaJtagAdapter *m_adapter;
+  bool m_own_batch;
 };
 
 #endif  //__OCLAJTAGADAPTER_H__
@@ -0,0 +1,157 @@
+#include "OclaMultiCapture.h"
+
+#include <thread>
+
+#include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
+#include "Ocla.h"
+#include "OclaHelpers.h"
+
+static const char *ocla_capture_state_to_string(ocla_capture_state state) {
+  switch (state) {
+    case CAPTURE_IDLE:
+      return "idle";
+    case CAPTURE_ARMED:
+      return "armed";
+    case CAPTURE_TRIGGERED:
+      return "triggered";
+    case CAPTURE_DONE:
+      return "done";
+    case CAPTURE_FAILED:
+      return "failed";
+    case CAPTURE_TIMEOUT:
+      return "timeout";
+  }
+  return "(unknown)";
+}
+
+OclaMultiCapture::OclaMultiCapture(std::vector<ocla_capture_target> targets)
+    : m_targets(targets),
+      m_results(targets.size(), {CAPTURE_IDLE, 0.0f, 0.0f, 0.0f}) {}
+
+OclaMultiCapture::~OclaMultiCapture() {}
+
+bool OclaMultiCapture::run(uint32_t timeout_ms) {
+  CFG_TIME time_begin = CFG_time_begin();
+  std::vector<std::thread> threads{};
+  uint32_t pending = (uint32_t)m_targets.size();
+
+  for (uint32_t i = 0; i < m_targets.size(); i++) {
+    CFG_ASSERT(m_targets[i].adapter != nullptr);
+    m_results[i] = {CAPTURE_IDLE, 0.0f, 0.0f, 0.0f};
+    threads.push_back(std::thread(&OclaMultiCapture::capture, this, i,
+                                  timeout_ms));
+  }
+
+  // report the progress from this thread as the state of the targets change
+  while (pending > 0) {
+    std::vector<capture_event> events{};
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [&]() { return !m_events.empty(); });
+      events.swap(m_events);
+    }
+    for (auto &event : events) {
+      auto &name = m_targets[event.index].name;
+      if (!event.message.empty()) {
+        ocla_post_message(nullptr, event.type,
+                          "[" + name + "] " + event.message);
+        continue;
+      }
+      CFG_POST_MSG("[%s] %s", name.c_str(),
+                   ocla_capture_state_to_string(event.state));
+      if (event.state >= CAPTURE_DONE) {
+        --pending;
+      }
+    }
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  // shared timing report
+  bool status = true;
+  for (uint32_t i = 0; i < m_targets.size(); i++) {
+    auto &r = m_results[i];
+    CFG_POST_MSG(
+        "[%s] %s: arm %.3f s, wait %.3f s, download %.3f s, output '%s'",
+        m_targets[i].name.c_str(), ocla_capture_state_to_string(r.state),
+        r.arm_time, r.wait_time, r.download_time,
+        m_targets[i].output_filepath.c_str());
+    status = status && r.state == CAPTURE_DONE;
+  }
+  CFG_POST_MSG("Captured %d target(s) in %.3f seconds",
+               (uint32_t)m_targets.size(), CFG_time_elapse(time_begin));
+  return status;
+}
+
+void OclaMultiCapture::capture(uint32_t index, uint32_t timeout_ms) {
+  auto &target = m_targets[index];
+  Ocla ocla{target.adapter};
+  auto handler = [this, index](ocla_message_type type,
+                               const std::string &message) {
+    post_message(index, type, message);
+  };
+  ocla.set_message_handler(handler);
+  ocla.copy_session();
+  target.adapter->set_message_handler(handler);
+  do_capture(ocla, index, timeout_ms);
+  target.adapter->set_message_handler(nullptr);
+}
+
+void OclaMultiCapture::do_capture(Ocla &ocla, uint32_t index,
+                                  uint32_t timeout_ms) {
+  auto &target = m_targets[index];
+  auto &result = m_results[index];
+  try {
+    CFG_TIME time_begin = CFG_time_begin();
+    if (!ocla.start(target.domain_id)) {
+      set_state(index, CAPTURE_FAILED);
+      return;
+    }
+    result.arm_time = CFG_time_elapse(time_begin);
+    set_state(index, CAPTURE_ARMED);
+
+    time_begin = CFG_time_begin();
+    uint32_t status = 0;
+    if (!ocla.wait(target.domain_id, timeout_ms, status)) {
+      set_state(index, CAPTURE_FAILED);
+      return;
+    }
+    result.wait_time = CFG_time_elapse(time_begin);
+    if (!status) {
+      set_state(index, CAPTURE_TIMEOUT);
+      return;
+    }
+    set_state(index, CAPTURE_TRIGGERED);
+
+    time_begin = CFG_time_begin();
+    if (!ocla.write_waveform(target.domain_id, target.output_filepath)) {
+      set_state(index, CAPTURE_FAILED);
+      return;
+    }
+    result.download_time = CFG_time_elapse(time_begin);
+    set_state(index, CAPTURE_DONE);
+  } catch (...) {
+    // an assertion in one target must not bring the other captures down
+    set_state(index, CAPTURE_FAILED);
+  }
+}
+
+void OclaMultiCapture::set_state(uint32_t index, ocla_capture_state state) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_results[index].state = state;
+    m_events.push_back({index, state, OCLA_MESSAGE_INFO, ""});
+  }
+  m_cond.notify_one();
+}
+
+void OclaMultiCapture::post_message(uint32_t index, ocla_message_type type,
+                                    const std::string &message) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_events.push_back({index, CAPTURE_IDLE, type, message});
+  }
+  m_cond.notify_one();
+}
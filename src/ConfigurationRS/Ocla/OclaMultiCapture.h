@@ -0,0 +1,74 @@
+#ifndef __OCLAMULTICAPTURE_H__
+#define __OCLAMULTICAPTURE_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "OclaJtagAdapter.h"
+
+class Ocla;
+
+struct ocla_capture_target {
+  std::string name;
+  OclaJtagAdapter *adapter;
+  uint32_t domain_id;
+  std::string output_filepath;
+};
+
+enum ocla_capture_state {
+  CAPTURE_IDLE = 0,
+  CAPTURE_ARMED,
+  CAPTURE_TRIGGERED,
+  CAPTURE_DONE,
+  CAPTURE_FAILED,
+  CAPTURE_TIMEOUT
+};
+
+struct ocla_capture_result {
+  ocla_capture_state state;
+  float arm_time;
+  float wait_time;
+  float download_time;
+};
+
+// Runs the capture of several targets (one adapter per cable/device) at the
+// same time. Each target is armed, waited for and its waveform streamed to its
+// own output file on a thread of its own while the calling thread reports the
+// progress. The capture threads post no messages, their state changes and
+// messages (including the ones of the adapters) are queued and posted by run()
+// on the calling thread. Each capture works on its own copy of the loaded
+// debug session.
+class OclaMultiCapture {
+ public:
+  OclaMultiCapture(std::vector<ocla_capture_target> targets);
+  ~OclaMultiCapture();
+  bool run(uint32_t timeout_ms);
+  const std::vector<ocla_capture_result> &get_results() const {
+    return m_results;
+  }
+
+ private:
+  // state change of a target (empty message) or message of its capture
+  struct capture_event {
+    uint32_t index;
+    ocla_capture_state state;
+    ocla_message_type type;
+    std::string message;
+  };
+
+  void capture(uint32_t index, uint32_t timeout_ms);
+  void do_capture(Ocla &ocla, uint32_t index, uint32_t timeout_ms);
+  void set_state(uint32_t index, ocla_capture_state state);
+  void post_message(uint32_t index, ocla_message_type type,
+                    const std::string &message);
+  std::vector<ocla_capture_target> m_targets;
+  std::vector<ocla_capture_result> m_results;
+  std::vector<capture_event> m_events;
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+};
+
+#endif  //__OCLAMULTICAPTURE_H__
@@ -1,42 +1,161 @@
 #include "OclaOpenocdAdapter.h"
 
 #include <cassert>
+#include <cstring>
 #include <iomanip>
-#include <regex>
 #include <sstream>
 #include <vector>
 
 #include "Configuration/HardwareManager/OpenocdHelper.h"
 #include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
+#include "OclaHelpers.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET ocla_socket_t;
+#define OCLA_INVALID_SOCKET INVALID_SOCKET
+#define OCLA_SEND_FLAGS (0)
+#define ocla_close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+typedef int ocla_socket_t;
+#define OCLA_INVALID_SOCKET (-1)
+#define OCLA_SEND_FLAGS (MSG_NOSIGNAL)
+#define ocla_close_socket close
+#endif
+
+// openocd tcl rpc terminates every command and every response with 0x1a
+#define OCLA_TCL_TERMINATOR ('\x1a')
+#define OCLA_SESSION_CONNECT_TIMEOUT_MS (10000)
+#define OCLA_SESSION_POLL_MS (20)
+
+static bool ocla_socket_init() {
+#ifdef _WIN32
+  static bool initialized = false;
+  if (!initialized) {
+    WSADATA wsa_data;
+    initialized = WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+  }
+  return initialized;
+#else
+  return true;
+#endif
+}
+
+static uint16_t ocla_find_free_port() {
+  // let the OS pick an unused local port, then release it for openocd
+  uint16_t port = 0;
+  ocla_socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+  if (s != OCLA_INVALID_SOCKET) {
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(s, (sockaddr *)&addr, sizeof(addr)) == 0 &&
+        getsockname(s, (sockaddr *)&addr, &len) == 0) {
+      port = ntohs(addr.sin_port);
+    }
+    ocla_close_socket(s);
+  }
+  return port;
+}
+
+static void ocla_set_socket_timeout(int64_t s, uint32_t timeout_ms) {
+  // send and recv give up once nothing moves for timeout_ms
+#ifdef _WIN32
+  DWORD timeout = timeout_ms;
+#else
+  timeval timeout{};
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+#endif
+  setsockopt((ocla_socket_t)s, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout,
+             sizeof(timeout));
+  setsockopt((ocla_socket_t)s, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout,
+             sizeof(timeout));
+}
+
+static int64_t ocla_connect(uint16_t port) {
+  ocla_socket_t s = socket(AF_INET, SOCK_STREAM, 0);
+  if (s == OCLA_INVALID_SOCKET) {
+    return -1;
+  }
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(s, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    ocla_close_socket(s);
+    return -1;
+  }
+  return (int64_t)s;
+}
+
+static inline bool ocla_decode_hex(const char *p, uint32_t digits,
+                                   uint32_t &value) {
+  value = 0;
+  for (uint32_t i = 0; i < digits; i++) {
+    char c = p[i];
+    if (c >= '0' && c <= '9') {
+      value = (value << 4) | uint32_t(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value = (value << 4) | uint32_t(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      value = (value << 4) | uint32_t(c - 'A' + 10);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline bool ocla_decode_dec(const char *&p, const char *end,
+                                   uint32_t &value) {
+  // decimal number terminated by a space, p is moved past the space
+  const char *start = p;
+  value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = (value * 10) + uint32_t(*p - '0');
+    p++;
+  }
+  if (p == start || p == end || *p != ' ') {
+    return false;
+  }
+  p++;
+  return true;
+}
+
+static std::string ocla_to_cmdline(const std::string &tcl) {
+  // escape tcl script so that it survives the shell as a single -c argument
+  std::string escaped{};
+  for (auto c : tcl) {
+    if (c == '\\' || c == '"' || c == '$') {
+      escaped.push_back('\\');
+    }
+    escaped.push_back(c);
+  }
+  return " -c \"" + escaped + "\"";
+}
 
 OclaOpenocdAdapter::OclaOpenocdAdapter(std::string openocd)
     : FOEDAG::OpenocdAdapter(openocd), m_openocd(openocd) {}
 
-OclaOpenocdAdapter::~OclaOpenocdAdapter() {}
+OclaOpenocdAdapter::~OclaOpenocdAdapter() { stop_session(); }
 
 void OclaOpenocdAdapter::write(uint32_t addr, uint32_t data) {
-  // ocla jtag write via openocd command
-  // -----------------------------------
-  // irscan ocla 0x04
-  // drscan ocla 1 0x1 1 0x1 32 <addr> 32 <data> 2 0x0
-  // irscan ocla 0x08
-  // drscan ocla 32 0x0 2 0x0
-
   std::string output;
-  std::stringstream ss;
-  uint32_t i = m_device.tap.index;
-
-  ss << " -c \"set addr [format 0x%08x " << addr << "];"
-     << "set data [format 0x%08x " << data << "];"
-     << "irscan tap" << i << ".tap 0x04;"
-     << "drscan tap" << i << ".tap 1 0x1 1 0x1 32 \\$addr 32 \\$data 2 0x0;"
-     << "irscan tap" << i << ".tap 0x08;"
-     << "set res [drscan tap" << i << ".tap 32 0x0 2 0x0];"
-     << "echo \\\"\\$addr \\$res\\\";\"";
-
-  CFG_ASSERT_MSG(execute_command(ss.str(), output) == 0, "cmdexec error: %s",
-                 output.c_str());
-  parse(output);
+
+  CFG_ASSERT_MSG(
+      execute_tcl(build_tcl_call({true, addr, data, 0, 0}), output) == 0,
+      "cmdexec error: %s", output.c_str());
+  std::vector<jtag_read_result> values{};
+  parse(output, values);
 }
 
 uint32_t OclaOpenocdAdapter::read(uint32_t addr) {
@@ -47,37 +166,118 @@ uint32_t OclaOpenocdAdapter::read(uint32_t addr) {
 std::vector<jtag_read_result> OclaOpenocdAdapter::read(uint32_t base_addr,
                                                        uint32_t num_reads,
                                                        uint32_t increase_by) {
-  // ocla jtag read via openocd command
-  // ----------------------------------
-  // irscan ocla 0x04
-  // drscan ocla 1 0x1 1 0x0 32 <addr> 32 0x0 2 0x0
-  // irscan ocla 0x08
-  // drscan ocla 32 <data> 2 0x0
-
   std::string output;
-  std::stringstream ss;
 
-  ss << build_tcl_proc(m_device.index) << " -c \"ocla_read " << std::hex
-     << std::showbase << base_addr << std::dec << std::noshowbase << " "
-     << num_reads << " " << increase_by << ";\"";
-
-  CFG_ASSERT_MSG(execute_command(ss.str(), output) == 0, "cmdexec error: %s",
-                 output.c_str());
-  auto values = parse(output);
+  CFG_ASSERT_MSG(
+      execute_tcl(build_tcl_call({false, base_addr, 0, num_reads, increase_by}),
+                  output) == 0,
+      "cmdexec error: %s", output.c_str());
+  std::vector<jtag_read_result> values{};
+  values.reserve(num_reads);
+  parse(output, values);
   CFG_ASSERT_MSG(values.size() == num_reads,
                  "values size is not equal to read requests");
   return values;
 }
 
-std::string OclaOpenocdAdapter::build_tcl_proc(uint32_t tap_index) {
+std::vector<jtag_read_result> OclaOpenocdAdapter::flush() {
+  auto transactions = take_transactions();
+  if (transactions.empty()) {
+    return {};
+  }
+
+  // lower the whole batch into a single tcl script which concatenates the
+  // output of every transaction in queued order
+  std::string output;
+  std::string tcl = "join [list";
+  uint32_t expected = 0;
+  for (auto &t : transactions) {
+    tcl += " [" + build_tcl_call(t) + "]";
+    expected += t.is_write ? 1 : t.num_reads;
+  }
+  tcl += "] \"\"";
+
+  CFG_ASSERT_MSG(execute_tcl(tcl, output) == 0, "cmdexec error: %s",
+                 output.c_str());
+  std::vector<jtag_read_result> values{};
+  values.reserve(expected);
+  parse(output, values);
+  CFG_ASSERT_MSG(values.size() == expected,
+                 "values size is not equal to queued transactions");
+
+  // drop the echo of the writes, keep only the read results
+  std::vector<jtag_read_result> results{};
+  auto it = values.begin();
+  for (auto &t : transactions) {
+    if (t.is_write) {
+      ++it;
+    } else {
+      results.insert(results.end(), it, it + t.num_reads);
+      it += t.num_reads;
+    }
+  }
+  return results;
+}
+
+std::string OclaOpenocdAdapter::build_tcl_call(
+    const jtag_transaction &transaction) {
   std::ostringstream ss;
-  ss << " -c \"proc ocla_read {addr {n 1} {c 0}} { for {set i 0} {\\$i < \\$n} "
-        "{incr i} {; set addr [format 0x%08x \\$addr]; irscan tap"
-     << tap_index << ".tap 0x04; drscan tap" << tap_index
-     << ".tap 1 0x1 1 0x0 32 \\$addr 32 0x0 2 0x0; irscan tap" << tap_index
-     << ".tap 0x08; set res [drscan tap" << tap_index
-     << ".tap 32 0x0 2 0x0]; echo \\\"\\$addr \\$res\\\"; incr addr \\$c; }; "
-        "};\"";
+  if (transaction.is_write) {
+    ss << "ocla_write " << std::hex << std::showbase << transaction.address
+       << " " << transaction.data;
+  } else {
+    // bulk reads come back as a single hex blob record
+    ss << (m_hex_blob && transaction.num_reads > 1 ? "ocla_read_blob "
+                                                    : "ocla_read ")
+       << std::hex << std::showbase << transaction.address
+       << std::dec << std::noshowbase << " " << transaction.num_reads << " "
+       << transaction.increase_by;
+  }
+  return ss.str();
+}
+
+std::string OclaOpenocdAdapter::build_tcl_proc() {
+  // ocla jtag write via openocd command
+  // -----------------------------------
+  // irscan ocla 0x04
+  // drscan ocla 1 0x1 1 0x1 32 <addr> 32 <data> 2 0x0
+  // irscan ocla 0x08
+  // drscan ocla 32 0x0 2 0x0
+  //
+  // ocla jtag read via openocd command
+  // ----------------------------------
+  // irscan ocla 0x04
+  // drscan ocla 1 0x1 1 0x0 32 <addr> 32 0x0 2 0x0
+  // irscan ocla 0x08
+  // drscan ocla 32 <data> 2 0x0
+  //
+  // ocla_write and ocla_read return one "<addr> <data> <status>" line per
+  // transaction. ocla_read_blob returns a single record for all the reads
+  // "@<addr> <n> <c> <data><status><data><status>..."
+  std::ostringstream ss;
+  uint32_t w = m_device.tap.index;
+  uint32_t r = m_device.index;
+
+  ss << "proc ocla_write {addr data} { set addr [format 0x%08x $addr]; "
+        "set data [format 0x%08x $data]; irscan tap"
+     << w << ".tap 0x04; drscan tap" << w
+     << ".tap 1 0x1 1 0x1 32 $addr 32 $data 2 0x0; irscan tap" << w
+     << ".tap 0x08; set res [drscan tap" << w
+     << ".tap 32 0x0 2 0x0]; return \"$addr $res\\n\" }; ";
+  ss << "proc ocla_read {addr {n 1} {c 0}} { set out \"\"; for {set i 0} "
+        "{$i < $n} {incr i} { set addr [format 0x%08x $addr]; irscan tap"
+     << r << ".tap 0x04; drscan tap" << r
+     << ".tap 1 0x1 1 0x0 32 $addr 32 0x0 2 0x0; irscan tap" << r
+     << ".tap 0x08; set res [drscan tap" << r
+     << ".tap 32 0x0 2 0x0]; append out \"$addr $res\\n\"; incr addr $c }; "
+        "return $out }; ";
+  ss << "proc ocla_read_blob {addr {n 1} {c 0}} { set out [format "
+        "\"@0x%08x %d %d \" $addr $n $c]; for {set i 0} {$i < $n} {incr i} "
+        "{ set addr [format 0x%08x $addr]; irscan tap"
+     << r << ".tap 0x04; drscan tap" << r
+     << ".tap 1 0x1 1 0x0 32 $addr 32 0x0 2 0x0; irscan tap" << r
+     << ".tap 0x08; append out [string map {\" \" \"\"} [drscan tap" << r
+     << ".tap 32 0x0 2 0x0]]; incr addr $c }; return \"$out\\n\" }";
   return ss.str();
 }
 
@@ -100,33 +300,217 @@ int OclaOpenocdAdapter::execute_command(const std::string &cmd,
   return res;
 }
 
-std::vector<jtag_read_result> OclaOpenocdAdapter::parse(
-    const std::string &output) {
-  std::stringstream ss(output);
-  std::string s;
-  std::cmatch matches;
-  std::vector<jtag_read_result> values;
-
-  while (std::getline(ss, s)) {
-    // look for text format (in hex): 0xNNNNNNNN xxxxxxxx yy
-    if (std::regex_search(
-            s.c_str(), matches,
-            std::regex("^0x([0-9A-F]{8}) ([0-9A-F]{8}) ([0-9A-F]{2})$",
-                       std::regex::icase)) == true) {
-      jtag_read_result res{};
-      res.address = (uint32_t)stoul(matches[1], 0, 16);
-      res.data = (uint32_t)stoul(matches[2], 0, 16);
-      res.status = (uint32_t)stoul(matches[3], 0, 16);
+int OclaOpenocdAdapter::execute_tcl(const std::string &tcl,
+                                    std::string &output) {
+  if (m_session_mode && !m_session_failed && m_session_socket < 0) {
+    if (!start_session()) {
+      m_session_failed = true;
+      ocla_post_message(
+          get_message_handler(), OCLA_MESSAGE_WARNING,
+          "Failed to start openocd session. Fallback to one openocd process "
+          "per transaction");
+    }
+  }
+
+  if (m_session_socket >= 0) {
+    // catch tcl error so that failure is reported back as status code
+    std::string response{};
+    if (session_transact("format \"%d\\n%s\" [catch {" + tcl +
+                             "} ocla_res] $ocla_res",
+                         response)) {
+      size_t pos = response.find('\n');
+      output = pos == std::string::npos ? "" : response.substr(pos + 1);
+      return response.compare(0, pos, "0") == 0 ? 0 : -1;
+    }
+    // openocd is gone or does not answer in time, the transaction is issued
+    // again by its own openocd process
+    reset_session();
+    m_session_failed = true;
+    ocla_post_message(get_message_handler(), OCLA_MESSAGE_WARNING,
+                      "openocd session does not respond. Fallback to one "
+                      "openocd process per transaction");
+  }
+
+  return execute_command(
+      ocla_to_cmdline(build_tcl_proc()) + ocla_to_cmdline("echo [" + tcl + "]"),
+      output);
+}
+
+void OclaOpenocdAdapter::set_session_mode(bool enable) {
+  if (!enable) {
+    stop_session();
+  }
+  m_session_mode = enable;
+  m_session_failed = false;
+}
+
+void OclaOpenocdAdapter::set_session_timeout(uint32_t timeout_ms) {
+  CFG_ASSERT(timeout_ms > 0);
+  m_session_timeout_ms = timeout_ms;
+  if (m_session_socket >= 0) {
+    ocla_set_socket_timeout(m_session_socket, m_session_timeout_ms);
+  }
+}
+
+bool OclaOpenocdAdapter::is_session_active() const {
+  return m_session_socket >= 0;
+}
+
+bool OclaOpenocdAdapter::start_session() {
+  if (!ocla_socket_init()) {
+    return false;
+  }
+
+  uint16_t port = ocla_find_free_port();
+  if (port == 0) {
+    return false;
+  }
+
+  std::ostringstream ss;
+  ss << "OPENOCD_DEBUG_LEVEL=-3 " << m_openocd << " -l /dev/stdout"
+     << " -d2";
+  ss << build_cable_config(m_device.cable) << build_tap_config(m_taplist)
+     << build_target_config(m_device);
+  ss << " -c \"gdb_port disabled\" -c \"telnet_port disabled\""
+     << " -c \"tcl_port " << port << "\"";
+  ss << " -c \"init\"";
+
+  // openocd keeps running in the background until shutdown is requested
+  std::string cmd = ss.str();
+  m_session_stop = false;
+  m_session_exited = false;
+  m_session_output.clear();
+  m_session_thread = std::thread([this, cmd]() {
+    CFG_execute_cmd(cmd, m_session_output, nullptr, m_session_stop);
+    m_session_exited = true;
+  });
+
+  // wait for the tcl server to come up (or openocd to fail)
+  uint32_t elapsed = 0;
+  while (m_session_socket < 0 && !m_session_exited &&
+         elapsed < OCLA_SESSION_CONNECT_TIMEOUT_MS) {
+    m_session_socket = ocla_connect(port);
+    if (m_session_socket < 0) {
+      CFG_sleep_ms(OCLA_SESSION_POLL_MS);
+      elapsed += OCLA_SESSION_POLL_MS;
+    }
+  }
+  if (m_session_socket >= 0) {
+    ocla_set_socket_timeout(m_session_socket, m_session_timeout_ms);
+  }
+
+  std::string output{};
+  if (m_session_socket < 0 || !session_transact(build_tcl_proc(), output)) {
+    stop_session();
+    ocla_post_message(get_message_handler(), OCLA_MESSAGE_DEBUG,
+                      "openocd session log: " + m_session_output);
+    return false;
+  }
+  return true;
+}
+
+void OclaOpenocdAdapter::stop_session() {
+  if (m_session_socket >= 0) {
+    // openocd might drop the connection before replying, ignore the result
+    std::string output{};
+    session_transact("shutdown", output);
+  }
+  reset_session();
+}
+
+void OclaOpenocdAdapter::reset_session() {
+  // close the connection without shutdown, then wait for openocd to go
+  if (m_session_socket >= 0) {
+    ocla_close_socket((ocla_socket_t)m_session_socket);
+    m_session_socket = -1;
+  }
+  if (m_session_thread.joinable()) {
+    m_session_stop = true;
+    m_session_thread.join();
+  }
+}
+
+bool OclaOpenocdAdapter::session_transact(const std::string &tcl,
+                                          std::string &output) {
+  ocla_socket_t s = (ocla_socket_t)m_session_socket;
+  std::string request = tcl + OCLA_TCL_TERMINATOR;
+  size_t sent = 0;
+
+  while (sent < request.size()) {
+    int n = send(s, request.data() + sent, int(request.size() - sent),
+                 OCLA_SEND_FLAGS);
+    if (n <= 0) {
+      return false;
+    }
+    sent += size_t(n);
+  }
+
+  char buffer[4096];
+  output.clear();
+  while (true) {
+    int n = recv(s, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      return false;
+    }
+    output.append(buffer, size_t(n));
+    if (output.back() == OCLA_TCL_TERMINATOR) {
+      output.pop_back();
+      return true;
+    }
+  }
+}
+
+void OclaOpenocdAdapter::parse(const std::string &output,
+                               std::vector<jtag_read_result> &values) {
+  const char *p = output.data();
+  const char *end = p + output.size();
+
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    size_t len = eol - p;
+    jtag_read_result res{};
+
+    if (len == 22 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') &&
+        p[10] == ' ' && p[19] == ' ' &&
+        ocla_decode_hex(p + 2, 8, res.address) &&
+        ocla_decode_hex(p + 11, 8, res.data) &&
+        ocla_decode_hex(p + 20, 2, res.status)) {
+      // text format (in hex): 0xNNNNNNNN xxxxxxxx yy
       values.push_back(res);
+    } else if (len > 12 && p[0] == '@' && p[1] == '0' &&
+               (p[2] == 'x' || p[2] == 'X') && p[11] == ' ' &&
+               ocla_decode_hex(p + 3, 8, res.address)) {
+      // hex blob format: @0xNNNNNNNN <n> <c> xxxxxxxxyyxxxxxxxxyy...
+      const char *q = p + 12;
+      uint32_t n = 0;
+      uint32_t c = 0;
+      if (ocla_decode_dec(q, eol, n) && ocla_decode_dec(q, eol, c) &&
+          size_t(eol - q) == size_t(n) * 10) {
+        for (uint32_t i = 0; i < n; i++, q += 10) {
+          if (!ocla_decode_hex(q, 8, res.data) ||
+              !ocla_decode_hex(q + 8, 2, res.status)) {
+            break;
+          }
+          values.push_back(res);
+          res.address += c;
+        }
+      }
     }
+
+    p = eol + 1;
   }
 
   CFG_ASSERT_MSG(values.empty() == false, "empty result");
-  return values;
 }
 
 void OclaOpenocdAdapter::set_target_device(FOEDAG::Device device,
                                            std::vector<FOEDAG::Tap> taplist) {
+  // the running openocd session is bound to the previous target
+  stop_session();
+  m_session_failed = false;
   m_device = device;
   m_taplist = taplist;
 }
@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <thread>
 #include <tuple>
 
 #include "Configuration/HardwareManager/OpenocdAdapter.h"
@@ -22,14 +23,48 @@ class OclaOpenocdAdapter : public OclaJtagAdapter,
                                              uint32_t increase_by = 0);
   virtual void set_target_device(FOEDAG::Device device,
                                  std::vector<FOEDAG::Tap> taplist);
+  virtual std::vector<jtag_read_result> flush();
+
+  // When session mode is enabled, the first transaction launches a single
+  // openocd process and every following transaction is sent to it over its
+  // tcl rpc port. The process is shutdown by stop_session() or destructor.
+  void set_session_mode(bool enable);
+  bool is_session_active() const;
+  void stop_session();
+
+  // When openocd does not answer a session transaction within the timeout,
+  // the session is dropped and the adapter falls back to one openocd process
+  // per transaction.
+  void set_session_timeout(uint32_t timeout_ms);
+
+  // When hex blob mode is enabled (default), bulk reads are returned by
+  // openocd as one packed record instead of one text line per word.
+  void set_hex_blob_mode(bool enable) { m_hex_blob = enable; }
+
+  // Decode openocd output and append the results to the values
+  static void parse(const std::string& output,
+                    std::vector<jtag_read_result>& values);
 
  private:
   int execute_command(const std::string& cmd, std::string& output);
-  std::string build_tcl_proc(uint32_t tap_num);
-  std::vector<jtag_read_result> parse(const std::string& output);
+  int execute_tcl(const std::string& tcl, std::string& output);
+  bool start_session();
+  bool session_transact(const std::string& tcl, std::string& output);
+  void reset_session();
+  std::string build_tcl_proc();
+  std::string build_tcl_call(const jtag_transaction& transaction);
   std::string m_openocd;
   FOEDAG::Device m_device;
   std::vector<FOEDAG::Tap> m_taplist;
+  bool m_hex_blob = true;
+  bool m_session_mode = false;
+  bool m_session_failed = false;
+  int64_t m_session_socket = -1;
+  uint32_t m_session_timeout_ms = 60000;
+  std::thread m_session_thread;
+  std::atomic<bool> m_session_stop{false};
+  std::atomic<bool> m_session_exited{false};
+  std::string m_session_output;
 };
 
 #endif  //__OCLAOPENOCDADAPTER_H__
@@ -0,0 +1,25 @@
+#include "OclaRegisterShadow.h"
+
+OclaRegisterShadow::OclaRegisterShadow() {}
+
+OclaRegisterShadow::~OclaRegisterShadow() {}
+
+bool OclaRegisterShadow::lookup(uint32_t addr, uint32_t& value) const {
+  auto it = m_registers.find(addr);
+  if (it == m_registers.end()) {
+    return false;
+  }
+  value = it->second;
+  return true;
+}
+
+void OclaRegisterShadow::update(uint32_t addr, uint32_t value) {
+  m_registers[addr] = value;
+}
+
+void OclaRegisterShadow::invalidate() { m_registers.clear(); }
+
+void OclaRegisterShadow::invalidate(uint32_t base_addr, uint32_t size) {
+  m_registers.erase(m_registers.lower_bound(base_addr),
+                    m_registers.lower_bound(base_addr + size));
+}
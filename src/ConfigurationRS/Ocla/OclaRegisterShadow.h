@@ -0,0 +1,23 @@
+#ifndef __OCLAREGISTERSHADOW_H__
+#define __OCLAREGISTERSHADOW_H__
+
+#include <cstdint>
+#include <map>
+
+// Last known value of the IP registers, keyed by register address. Used to
+// skip reading registers that never change at runtime and to skip writing
+// values that the register already holds.
+class OclaRegisterShadow {
+ private:
+  std::map<uint32_t, uint32_t> m_registers;
+
+ public:
+  OclaRegisterShadow();
+  ~OclaRegisterShadow();
+  bool lookup(uint32_t addr, uint32_t& value) const;
+  void update(uint32_t addr, uint32_t value);
+  void invalidate();
+  void invalidate(uint32_t base_addr, uint32_t size);
+};
+
+#endif  //__OCLAREGISTERSHADOW_H__
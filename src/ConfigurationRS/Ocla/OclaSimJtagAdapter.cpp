@@ -0,0 +1,396 @@
+#include "OclaSimJtagAdapter.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
+#include "EioIP.h"
+#include "OclaHelpers.h"
+#include "OclaIP.h"
+
+#define OCLA_SIM_IP_TYPE (0x6f636c61)  // "ocla"
+#define EIO_SIM_IP_TYPE (0x0045494f)   // "EIO"
+#define EIO_SIM_NUM_PROBES (64)
+#define EIO_SIM_REG_SIZE (0x18)
+
+static uint32_t ocla_sim_get_bits(const std::vector<uint32_t> &words,
+                                  uint32_t pos, uint32_t width) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < width && i < 32; i++) {
+    uint32_t bit = pos + i;
+    if ((bit / 32) < words.size() && (words[bit / 32] >> (bit % 32)) & 1) {
+      value |= (1u << i);
+    }
+  }
+  return value;
+}
+
+OclaSimJtagAdapter::OclaSimJtagAdapter() {}
+
+OclaSimJtagAdapter::~OclaSimJtagAdapter() {}
+
+void OclaSimJtagAdapter::add_ocla(uint32_t base_addr, uint32_t num_probes,
+                                  uint32_t memory_depth,
+                                  uint32_t trigger_count, uint32_t id,
+                                  uint32_t version) {
+  CFG_ASSERT(num_probes > 0);
+  CFG_ASSERT(memory_depth > 0);
+  CFG_ASSERT(trigger_count > 0 && trigger_count <= 32);
+
+  ocla_sim_ip ip{};
+  ip.is_eio = false;
+  ip.size = TSSR + (trigger_count * 0x30);
+  ip.num_probes = num_probes;
+  ip.memory_depth = memory_depth;
+  ip.registers[IP_TYPE] = OCLA_SIM_IP_TYPE;
+  ip.registers[IP_VERSION] = version;
+  ip.registers[IP_ID] = id;
+  ip.registers[UIDP0] = memory_depth & UIDP0_MD_Msk;
+  ip.registers[UIDP1] = num_probes & UIDP1_NP_Msk;
+  // compare value size of 32 bits
+  ip.registers[OCSR] = ((trigger_count - 1) << OCSR_TC_Pos) & OCSR_TC_Msk;
+  reset_ocla(ip);
+  m_ips[base_addr] = ip;
+}
+
+void OclaSimJtagAdapter::add_eio(uint32_t base_addr, uint32_t id,
+                                 uint32_t version) {
+  ocla_sim_ip ip{};
+  ip.is_eio = true;
+  ip.size = EIO_SIM_REG_SIZE;
+  ip.num_probes = EIO_SIM_NUM_PROBES;
+  ip.registers[EIO_CTRL] = 0;
+  ip.registers[EIO_IP_TYPE] = EIO_SIM_IP_TYPE;
+  ip.registers[EIO_IP_VERSION] = version;
+  ip.registers[EIO_IP_ID] = id;
+  ip.registers[EIO_AXI_DAT_OUT] = 0;
+  ip.registers[EIO_AXI_DAT_OUT + 4] = 0;
+  m_ips[base_addr] = ip;
+}
+
+void OclaSimJtagAdapter::write(uint32_t addr, uint32_t data) {
+  round_trip();
+  write_register(addr, data);
+}
+
+uint32_t OclaSimJtagAdapter::read(uint32_t addr) {
+  round_trip();
+  return read_register(addr);
+}
+
+std::vector<jtag_read_result> OclaSimJtagAdapter::read(uint32_t base_addr,
+                                                       uint32_t num_reads,
+                                                       uint32_t increase_by) {
+  std::vector<jtag_read_result> values{};
+  round_trip();
+  values.reserve(num_reads);
+  for (uint32_t i = 0; i < num_reads; i++) {
+    values.push_back({base_addr, read_register(base_addr), 0});
+    base_addr += increase_by;
+  }
+  return values;
+}
+
+void OclaSimJtagAdapter::set_target_device(FOEDAG::Device device,
+                                           std::vector<FOEDAG::Tap> taplist) {
+  // single simulated target, nothing to select
+}
+
+std::vector<jtag_read_result> OclaSimJtagAdapter::flush() {
+  std::vector<jtag_read_result> results{};
+  auto transactions = take_transactions();
+  if (transactions.empty()) {
+    return results;
+  }
+
+  // whole batch costs a single round trip
+  round_trip();
+  for (auto &t : transactions) {
+    if (t.is_write) {
+      write_register(t.address, t.data);
+      continue;
+    }
+    uint32_t addr = t.address;
+    for (uint32_t i = 0; i < t.num_reads; i++) {
+      results.push_back({addr, read_register(addr), 0});
+      addr += t.increase_by;
+    }
+  }
+  return results;
+}
+
+void OclaSimJtagAdapter::round_trip() {
+  ++m_round_trips;
+  if (m_latency_us > 0) {
+    std::this_thread::sleep_for(std::chrono::microseconds(m_latency_us));
+  }
+}
+
+ocla_sim_ip *OclaSimJtagAdapter::find_ip(uint32_t addr, uint32_t &offset) {
+  auto it = m_ips.upper_bound(addr);
+  if (it == m_ips.begin()) {
+    return nullptr;
+  }
+  --it;
+  offset = addr - it->first;
+  if (offset >= it->second.size) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void OclaSimJtagAdapter::write_register(uint32_t addr, uint32_t data) {
+  uint32_t offset = 0;
+  ++m_transactions;
+  ocla_sim_ip *ip = find_ip(addr, offset);
+  if (ip == nullptr) {
+    // nothing is mapped at the address, write is lost
+    return;
+  }
+  if (ip->is_eio) {
+    // only the control and output probe registers are writable
+    if (offset == EIO_CTRL || offset >= EIO_AXI_DAT_OUT) {
+      ip->registers[offset] = data;
+    }
+    return;
+  }
+  write_ocla(*ip, addr - offset, offset, data);
+}
+
+uint32_t OclaSimJtagAdapter::read_register(uint32_t addr) {
+  uint32_t offset = 0;
+  ++m_transactions;
+  ocla_sim_ip *ip = find_ip(addr, offset);
+  if (ip == nullptr) {
+    return 0;
+  }
+  if (ip->is_eio) {
+    return read_eio(*ip, addr - offset, offset);
+  }
+  return read_ocla(*ip, offset);
+}
+
+void OclaSimJtagAdapter::write_ocla(ocla_sim_ip &ip, uint32_t base_addr,
+                                    uint32_t offset, uint32_t data) {
+  switch (offset) {
+    case OCCR:
+      if (data & OCCR_SR_Msk) {
+        reset_ocla(ip);
+      } else if (data & OCCR_ST_Msk) {
+        capture(ip, base_addr);
+      }
+      break;
+    case IP_TYPE:
+    case IP_VERSION:
+    case IP_ID:
+    case UIDP0:
+    case UIDP1:
+    case OCSR:
+    case TBDR:
+      // read only registers
+      break;
+    default:
+      if (offset == TMTR || offset >= TSSR) {
+        ip.registers[offset] = data;
+      }
+      break;
+  }
+}
+
+uint32_t OclaSimJtagAdapter::read_ocla(ocla_sim_ip &ip, uint32_t offset) {
+  if (offset == OCSR) {
+    uint32_t ocsr = ip.registers[OCSR] & ~OCSR_DA_Msk;
+    ++ip.status_reads;
+    if (ip.sampling && !ip.buffer.empty() &&
+        ip.status_reads >= m_capture_polls &&
+        std::chrono::steady_clock::now() - ip.start_time >=
+            std::chrono::milliseconds(m_capture_time_ms)) {
+      ocsr |= OCSR_DA_Msk;
+    }
+    return ocsr;
+  }
+  if (offset == TBDR) {
+    // stream the acquisition data out, one word per read
+    if (ip.read_pos < ip.buffer.size()) {
+      return ip.buffer[ip.read_pos++];
+    }
+    return 0;
+  }
+  auto it = ip.registers.find(offset);
+  return it == ip.registers.end() ? 0 : it->second;
+}
+
+uint32_t OclaSimJtagAdapter::read_eio(ocla_sim_ip &ip, uint32_t base_addr,
+                                      uint32_t offset) {
+  if (offset < EIO_AXI_DAT_IN) {
+    return ip.registers[offset];
+  }
+  // probe read selection picks the output or input probes
+  if (ip.registers[EIO_CTRL] & EIO_CTRL_PRS_Msk) {
+    return ip.registers[offset];
+  }
+  if (!m_stimulus) {
+    // input probes are looped back from the output probes
+    return ip.registers[offset];
+  }
+  std::vector<uint32_t> words(EIO_SIM_NUM_PROBES / 32, 0);
+  m_stimulus(base_addr, ip.cycle++, words);
+  return words.at((offset - EIO_AXI_DAT_IN) / 4);
+}
+
+void OclaSimJtagAdapter::reset_ocla(ocla_sim_ip &ip) {
+  ip.registers[TMTR] = 0;
+  for (uint32_t offset = TSSR; offset < ip.size; offset += 4) {
+    ip.registers[offset] = 0;
+  }
+  ip.buffer.clear();
+  ip.read_pos = 0;
+  ip.sampling = false;
+}
+
+void OclaSimJtagAdapter::capture(ocla_sim_ip &ip, uint32_t base_addr) {
+  uint32_t words_per_line = ((ip.num_probes - 1) / 32) + 1;
+  uint32_t tmtr = ip.registers[TMTR];
+  uint32_t mode = (tmtr & TMTR_TM_Msk) >> TMTR_TM_Pos;
+  uint32_t depth = ip.memory_depth;
+  if (tmtr & TMTR_FNS_Msk) {
+    depth = std::min(depth, (tmtr & TMTR_NS_Msk) >> TMTR_NS_Pos);
+  }
+
+  auto sample = [&](uint64_t cycle, std::vector<uint32_t> &words) {
+    words.assign(words_per_line, 0);
+    if (m_stimulus) {
+      m_stimulus(base_addr, cycle, words);
+    } else {
+      // default stimulus is a free running counter on every probe word
+      for (auto &w : words) {
+        w = (uint32_t)cycle;
+      }
+    }
+    words.resize(words_per_line);
+  };
+
+  ip.buffer.clear();
+  ip.read_pos = 0;
+  ip.sampling = true;
+  ip.start_time = std::chrono::steady_clock::now();
+  ip.status_reads = 0;
+
+  // look for the trigger cycle. continuous mode does not wait for a trigger
+  uint64_t start = ip.cycle;
+  uint64_t trigger = start;
+  if (mode != CONTINUOUS) {
+    std::vector<uint32_t> prev{};
+    std::vector<uint32_t> curr{};
+    bool found = false;
+    sample(start > 0 ? start - 1 : start, prev);
+    for (uint64_t c = start; c < start + m_max_cycles; c++) {
+      sample(c, curr);
+      if (is_triggered(ip, prev, curr)) {
+        trigger = c;
+        found = true;
+        break;
+      }
+      prev.swap(curr);
+    }
+    if (!found) {
+      // trigger never fires, data available flag stays clear
+      ip.cycle = start + m_max_cycles;
+      return;
+    }
+  }
+
+  // position the capture window around the trigger cycle
+  uint64_t first = trigger;
+  if (mode == PRE) {
+    first = trigger + 1 >= start + depth ? trigger + 1 - depth : start;
+  } else if (mode == CENTER) {
+    first = trigger >= start + depth / 2 ? trigger - depth / 2 : start;
+  }
+
+  std::vector<uint32_t> words{};
+  ip.buffer.reserve((size_t)depth * words_per_line);
+  for (uint64_t c = first; c < first + depth; c++) {
+    sample(c, words);
+    ip.buffer.insert(ip.buffer.end(), words.begin(), words.end());
+  }
+  ip.cycle = first + depth;
+}
+
+bool OclaSimJtagAdapter::is_triggered(ocla_sim_ip &ip,
+                                      const std::vector<uint32_t> &prev,
+                                      const std::vector<uint32_t> &curr) {
+  uint32_t condition = (ip.registers[TMTR] & TMTR_B_Msk) >> TMTR_B_Pos;
+  uint32_t trigger_count =
+      ((ip.registers[OCSR] & OCSR_TC_Msk) >> OCSR_TC_Pos) + 1;
+  uint32_t active = 0;
+  uint32_t hits = 0;
+
+  for (uint32_t ch = 0; ch < trigger_count; ch++) {
+    uint32_t tssr = ip.registers[TSSR + ch * 0x30];
+    uint32_t tcur = ip.registers[TCUR + ch * 0x30];
+    uint32_t tdcr = ip.registers[TDCR + ch * 0x30];
+    uint32_t probe = (tssr & TSSR_PS_Msk) >> TSSR_PS_Pos;
+    uint32_t before = ocla_sim_get_bits(prev, probe, 1);
+    uint32_t after = ocla_sim_get_bits(curr, probe, 1);
+    bool hit = false;
+
+    switch ((tcur & TCUR_TT_Msk) >> TCUR_TT_Pos) {
+      case EDGE:
+        switch ((tcur & TCUR_ET_Msk) >> TCUR_ET_Pos) {
+          case RISING & 0xf:
+            hit = !before && after;
+            break;
+          case FALLING & 0xf:
+            hit = before && !after;
+            break;
+          case EITHER & 0xf:
+            hit = before != after;
+            break;
+        }
+        break;
+      case LEVEL:
+        hit = after == ((tcur & TCUR_LT_Msk) >> TCUR_LT_Pos);
+        break;
+      case VALUE_COMPARE: {
+        uint32_t width = ((tssr & TSSR_CW_Msk) >> TSSR_CW_Pos) + 1;
+        uint32_t value = ocla_sim_get_bits(curr, probe, width);
+        if (width < 32) {
+          tdcr &= (1u << width) - 1;
+        }
+        switch ((tcur & TCUR_VC_Msk) >> TCUR_VC_Pos) {
+          case EQUAL & 0xf:
+            hit = value == tdcr;
+            break;
+          case LESSER & 0xf:
+            hit = value < tdcr;
+            break;
+          case GREATER & 0xf:
+            hit = value > tdcr;
+            break;
+        }
+        break;
+      }
+      default:
+        // channel not in use
+        continue;
+    }
+
+    ++active;
+    hits += hit ? 1 : 0;
+  }
+
+  if (active == 0) {
+    // no trigger configured, start capture right away
+    return true;
+  }
+
+  switch (condition) {
+    case AND:
+      return hits == active;
+    case XOR:
+      return (hits & 1) != 0;
+    default:
+      return hits > 0;
+  }
+}
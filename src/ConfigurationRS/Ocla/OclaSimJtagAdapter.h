@@ -0,0 +1,90 @@
+#ifndef __OCLASIMJTAGADAPTER_H__
+#define __OCLASIMJTAGADAPTER_H__
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "OclaJtagAdapter.h"
+
+// Stimulus callback. Fills 'words' with the probe values of the IP at
+// 'base_addr' for the given sampling cycle. 'words' is pre-sized to the probe
+// width of the IP (32 probes per word).
+typedef std::function<void(uint32_t base_addr, uint64_t cycle,
+                           std::vector<uint32_t>& words)>
+    ocla_sim_stimulus;
+
+struct ocla_sim_ip {
+  bool is_eio;
+  uint32_t size;
+  uint32_t num_probes;
+  uint32_t memory_depth;
+  std::map<uint32_t, uint32_t> registers;
+  std::vector<uint32_t> buffer;
+  uint32_t read_pos;
+  bool sampling;
+  std::chrono::steady_clock::time_point start_time;
+  uint32_t status_reads;
+  uint64_t cycle;
+};
+
+// In-process model of the OCLA and EIO register maps. Captures are generated
+// from the stimulus when sampling is started and streamed out through TBDR,
+// so the whole debugger stack can be exercised without hardware. Every round
+// trip (write, read or flush) is delayed by the configured latency.
+class OclaSimJtagAdapter : public OclaJtagAdapter {
+ public:
+  OclaSimJtagAdapter();
+  virtual ~OclaSimJtagAdapter();
+  virtual void write(uint32_t addr, uint32_t data);
+  virtual uint32_t read(uint32_t addr);
+  virtual std::vector<jtag_read_result> read(uint32_t base_addr,
+                                             uint32_t num_reads,
+                                             uint32_t increase_by = 0);
+  virtual void set_target_device(FOEDAG::Device device,
+                                 std::vector<FOEDAG::Tap> taplist);
+  virtual std::vector<jtag_read_result> flush();
+
+  void add_ocla(uint32_t base_addr, uint32_t num_probes,
+                uint32_t memory_depth, uint32_t trigger_count = 4,
+                uint32_t id = 0, uint32_t version = 0);
+  void add_eio(uint32_t base_addr, uint32_t id = 0, uint32_t version = 0);
+  void set_stimulus(ocla_sim_stimulus stimulus) { m_stimulus = stimulus; }
+  void set_latency_us(uint32_t latency_us) { m_latency_us = latency_us; }
+  // Time between the start of sampling and the data available flag
+  void set_capture_time_ms(uint32_t ms) { m_capture_time_ms = ms; }
+  // Number of OCSR reads after the start of sampling until the data available
+  // flag is set, so that a test can step through the capture states without
+  // waiting on the clock
+  void set_capture_polls(uint32_t polls) { m_capture_polls = polls; }
+  // Number of cycles to wait for the trigger before giving up the capture
+  void set_max_cycles(uint64_t max_cycles) { m_max_cycles = max_cycles; }
+  uint64_t get_round_trip_count() const { return m_round_trips; }
+  uint64_t get_transaction_count() const { return m_transactions; }
+
+ private:
+  void round_trip();
+  ocla_sim_ip* find_ip(uint32_t addr, uint32_t& offset);
+  void write_register(uint32_t addr, uint32_t data);
+  uint32_t read_register(uint32_t addr);
+  void write_ocla(ocla_sim_ip& ip, uint32_t base_addr, uint32_t offset,
+                  uint32_t data);
+  uint32_t read_ocla(ocla_sim_ip& ip, uint32_t offset);
+  uint32_t read_eio(ocla_sim_ip& ip, uint32_t base_addr, uint32_t offset);
+  void reset_ocla(ocla_sim_ip& ip);
+  void capture(ocla_sim_ip& ip, uint32_t base_addr);
+  bool is_triggered(ocla_sim_ip& ip, const std::vector<uint32_t>& prev,
+                    const std::vector<uint32_t>& curr);
+  std::map<uint32_t, ocla_sim_ip> m_ips;
+  ocla_sim_stimulus m_stimulus;
+  uint32_t m_latency_us = 0;
+  uint32_t m_capture_time_ms = 0;
+  uint32_t m_capture_polls = 0;
+  uint64_t m_max_cycles = 1u << 20;
+  uint64_t m_round_trips = 0;
+  uint64_t m_transactions = 0;
+};
+
+#endif  //__OCLASIMJTAGADAPTER_H__
@@ -1,4 +1,6 @@
+#include <cctype>
 #include <filesystem>
+#include <memory>
 
 #include "CFGCommonRS/CFGArgRS_auto.h"
 #include "CFGObject/CFGObject_auto.h"
@@ -7,17 +9,17 @@
 #include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
 #include "Ocla.h"
 #include "OclaDebugSession.h"
-#include "OclaFstWaveformWriter.h"
+#include "OclaMultiCapture.h"
 #include "OclaOpenocdAdapter.h"
 
 #if _WIN32
 #define DEF_FST_OUTPUT "C:\\Windows\\Temp\\output.fst"
+#define DEF_CAPTURE_OUTPUT_DIR "C:\\Windows\\Temp"
 #else
 #define DEF_FST_OUTPUT "/tmp/output.fst"
+#define DEF_CAPTURE_OUTPUT_DIR "/tmp"
 #endif
 
-#define OCLA_WAIT_TIME_MS (1000)
-
 bool Ocla_select_device(OclaJtagAdapter& adapter,
                         FOEDAG::HardwareManager& hardware_manager,
                         std::string cable_name, uint32_t device_index) {
@@ -33,17 +35,13 @@ bool Ocla_select_device(OclaJtagAdapter& adapter,
   return true;
 }
 
-void Ocla_launch_gtkwave(oc_waveform_t& waveform, std::filesystem::path binpath,
+void Ocla_launch_gtkwave(std::filesystem::path binpath,
                          std::string output_filepath) {
-  OclaFstWaveformWriter fst_writer{};
-
-  if (fst_writer.write(waveform, output_filepath)) {
-    auto exepath = binpath / "gtkwave" / "bin" / "gtkwave";
-    auto cmd = exepath.string() + " " + output_filepath;
-    CFG_POST_MSG("Output file written at '%s' successfully.",
-                 output_filepath.c_str());
-    CFG_compiler_execute_cmd(cmd);
-  }
+  auto exepath = binpath / "gtkwave" / "bin" / "gtkwave";
+  auto cmd = exepath.string() + " " + output_filepath;
+  CFG_POST_MSG("Output file written at '%s' successfully.",
+               output_filepath.c_str());
+  CFG_compiler_execute_cmd(cmd);
 }
 
 void Ocla_wait_n_show_waveform(Ocla& ocla, uint32_t domain_id,
@@ -52,17 +50,10 @@ void Ocla_wait_n_show_waveform(Ocla& ocla, uint32_t domain_id,
                                std::filesystem::path binpath) {
   uint32_t status = 0;
 
-  // query the status of the ocla ip for max of 'timeout_sec' times
-  // if status is set, break the loop
-  for (uint32_t i = 0; i < timeout_sec; i++) {
-    CFG_sleep_ms(OCLA_WAIT_TIME_MS);  // wait for 1 sec
-    if (!ocla.get_status(domain_id, status)) {
-      CFG_POST_ERR("Failed to read ocla status");
-      return;
-    }
-    if (status) {
-      break;
-    }
+  // wait for the data available flag of the ocla ip for max of 'timeout_sec'
+  if (!ocla.wait(domain_id, timeout_sec * 1000, status)) {
+    CFG_POST_ERR("Failed to read ocla status");
+    return;
   }
 
   if (!status) {
@@ -70,15 +61,62 @@ void Ocla_wait_n_show_waveform(Ocla& ocla, uint32_t domain_id,
     return;
   }
 
-  // download the waveform from ocla ip
-  oc_waveform_t output_waveform{};
-  if (!ocla.get_waveform(domain_id, output_waveform)) {
+  // stream the waveform from ocla ip into the output file
+  if (!ocla.write_waveform(domain_id, output_filepath)) {
     CFG_POST_ERR("Failed to read waveform data");
     return;
   }
 
   // display the wave from on gtkwave
-  Ocla_launch_gtkwave(output_waveform, binpath, output_filepath);
+  Ocla_launch_gtkwave(binpath, output_filepath);
+}
+
+void Ocla_capture(std::string openocd, std::vector<std::string> targets,
+                  uint32_t domain_id, uint32_t timeout_sec,
+                  std::string output_dir) {
+  std::vector<std::unique_ptr<OclaOpenocdAdapter>> adapters{};
+  std::vector<ocla_capture_target> capture_targets{};
+
+  // one adapter (and openocd session) per "<cable>:<device>" target
+  for (auto& t : targets) {
+    std::string cable_name = t;
+    uint32_t device_index = 1;
+    size_t pos = t.rfind(':');
+    if (pos != std::string::npos) {
+      bool status = false;
+      cable_name = t.substr(0, pos);
+      device_index = (uint32_t)CFG_convert_string_to_u64(t.substr(pos + 1),
+                                                         false, &status);
+      if (!status) {
+        CFG_POST_ERR("Invalid device index in '%s'", t.c_str());
+        return;
+      }
+    }
+
+    adapters.push_back(std::make_unique<OclaOpenocdAdapter>(openocd));
+    adapters.back()->set_session_mode(true);
+    FOEDAG::HardwareManager hardware_manager{adapters.back().get()};
+    if (!Ocla_select_device(*adapters.back(), hardware_manager, cable_name,
+                            device_index)) {
+      return;
+    }
+
+    std::string filename = "ocla_" + cable_name + "_" +
+                           std::to_string(device_index) + ".fst";
+    for (auto& c : filename) {
+      if (!std::isalnum(c) && c != '.' && c != '_' && c != '-') {
+        c = '_';
+      }
+    }
+    capture_targets.push_back(
+        {t, adapters.back().get(), domain_id,
+         (std::filesystem::path(output_dir) / filename).string()});
+  }
+
+  OclaMultiCapture capture{capture_targets};
+  if (!capture.run(timeout_sec * 1000)) {
+    CFG_POST_ERR("Failed to capture all the targets");
+  }
 }
 
 void Ocla_entry(CFGCommon_ARG* cmdarg) {
@@ -92,6 +130,8 @@ void Ocla_entry(CFGCommon_ARG* cmdarg) {
   // setup hardware manager and ocla depencencies
   OclaOpenocdAdapter adapter{cmdarg->toolPath.string()};
   Ocla ocla{&adapter};
+  // reuse one openocd process for all the transactions of this command
+  adapter.set_session_mode(true);
   FOEDAG::HardwareManager hardware_manager{&adapter};
 
   // dispatch commands
@@ -151,6 +191,13 @@ void Ocla_entry(CFGCommon_ARG* cmdarg) {
         }
       }
     }
+  } else if (subcmd == "capture") {
+    auto parms =
+        static_cast<const CFGArg_DEBUGGER_CAPTURE*>(arg->get_sub_arg());
+    Ocla_capture(cmdarg->toolPath.string(), parms->m_args,
+                 (uint32_t)parms->domain, (uint32_t)parms->timeout,
+                 parms->output.empty() ? DEF_CAPTURE_OUTPUT_DIR
+                                       : parms->output);
   } else if (subcmd == "status") {
     auto parms = static_cast<const CFGArg_DEBUGGER_STATUS*>(arg->get_sub_arg());
     if (Ocla_select_device(adapter, hardware_manager, parms->cable,
@@ -167,11 +214,10 @@ void Ocla_entry(CFGCommon_ARG* cmdarg) {
         static_cast<const CFGArg_DEBUGGER_SHOW_WAVEFORM*>(arg->get_sub_arg());
     if (Ocla_select_device(adapter, hardware_manager, parms->cable,
                            parms->device)) {
-      oc_waveform_t output_waveform{};
-      if (ocla.get_waveform(parms->domain, output_waveform)) {
-        Ocla_launch_gtkwave(
-            output_waveform, cmdarg->binPath,
-            parms->output.empty() ? DEF_FST_OUTPUT : parms->output);
+      std::string output_filepath =
+          parms->output.empty() ? DEF_FST_OUTPUT : parms->output;
+      if (ocla.write_waveform(parms->domain, output_filepath)) {
+        Ocla_launch_gtkwave(cmdarg->binPath, output_filepath);
       }
     }
   } else if (subcmd == "show_instance") {
@@ -8,8 +8,10 @@
 
 #include "EioIP.h"
 #include "OclaJtagAdapter.h"
+#include "OclaRegisterShadow.h"
 
 using ::testing::_;
+using ::testing::AnyNumber;
 using ::testing::NiceMock;
 using ::testing::Return;
 
@@ -157,6 +159,24 @@ TEST_F(EioIPTest, set_prs_mode_probe_in_test) {
   ASSERT_EQ(result, eio_prs_mode::PROBE_IN);
 }
 
+TEST_F(EioIPTest, register_shadow_test) {
+  OclaRegisterShadow shadow{};
+  ON_CALL(mockAdapter, read(EIO_AXI_DAT_IN, 1, 4))
+      .WillByDefault(Return(std::vector<jtag_read_result>{{0, 0x1, 0}}));
+  EXPECT_CALL(mockAdapter, read(_)).Times(AnyNumber());
+  EXPECT_CALL(mockAdapter, read(EIO_CTRL)).Times(1);
+  EXPECT_CALL(mockAdapter, read(EIO_IP_TYPE)).Times(1);
+  EXPECT_CALL(mockAdapter, write(EIO_CTRL, 0x1)).Times(1);
+  for (int i = 0; i < 3; i++) {
+    EioIP eio(&mockAdapter, 0, &shadow);
+    ASSERT_EQ(eio.read_input_bits(1)[0], 0x1);
+  }
+  EioIP eio(&mockAdapter, 0, &shadow);
+  eio.set_prs_mode(eio_prs_mode::PROBE_IN);
+  eio.set_prs_mode(eio_prs_mode::PROBE_OUT);
+  eio.set_prs_mode(eio_prs_mode::PROBE_OUT);
+}
+
 TEST_F(EioIPTest, readback_output_one_test) {
   ON_CALL(mockAdapter, read(EIO_AXI_DAT_OUT, 1, 4))
       .WillByDefault(Return(std::vector<jtag_read_result>{{0, 0x12345678, 0}}));
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 
+#include <random>
 #include <vector>
 
 #include "OclaHelpers.h"
@@ -271,6 +272,90 @@ TEST(ReadWriteBitsVectorUint32Test, CFG_copy_bits_vec32) {
   EXPECT_EQ(vector, expected_vector);
 }
 
+static void copy_bits_bitwise(uint32_t *data, uint32_t pos, uint32_t *output,
+                              uint32_t output_pos, uint32_t nbits) {
+  for (uint32_t i = 0; i < nbits; i++) {
+    CFG_write_bit_vec32(output, output_pos + i,
+                        CFG_read_bit_vec32(data, pos + i));
+  }
+}
+
+TEST(ReadWriteBitsVectorUint32Test, CFG_copy_bits_vec32_offsets) {
+  std::mt19937 rng(1234);
+  std::vector<uint32_t> src(8);
+  for (auto &w : src) {
+    w = rng();
+  }
+
+  // every combination of source and destination offset, any length
+  for (uint32_t pos = 0; pos < 64; pos++) {
+    for (uint32_t output_pos = 0; output_pos < 64; output_pos++) {
+      uint32_t nbits = rng() % (8 * 32 - std::max(pos, output_pos)) + 1;
+      std::vector<uint32_t> expected(8, 0xa5a5a5a5);
+      std::vector<uint32_t> vector(8, 0xa5a5a5a5);
+      copy_bits_bitwise(src.data(), pos, expected.data(), output_pos, nbits);
+      CFG_copy_bits_vec32(src.data(), pos, vector.data(), output_pos, nbits);
+      ASSERT_EQ(vector, expected)
+          << "pos=" << pos << " output_pos=" << output_pos
+          << " nbits=" << nbits;
+    }
+  }
+}
+
+TEST(ReadWriteBitsVectorUint32Test, CFG_demux_bits_vec32) {
+  // 3 sample lines of 80 bits
+  std::vector<uint32_t> data{0x89abcdef, 0x01234567, 0x0000ffff,
+                             0xffffffff, 0x00000000, 0x00001234,
+                             0x76543210, 0xfedcba98, 0x0000a5a5};
+  std::vector<uint32_t> sig_a(3), sig_b(6), sig_c(3);
+  CFG_demux_bits_vec32(data.data(), 3, 3, {0, 4, 64}, {4, 60, 16},
+                       {sig_a.data(), sig_b.data(), sig_c.data()});
+  EXPECT_EQ(sig_a, (std::vector<uint32_t>{0xf, 0xf, 0x0}));
+  EXPECT_EQ(sig_b, (std::vector<uint32_t>{0x789abcde, 0x00123456, 0x0fffffff,
+                                          0x00000000, 0x87654321, 0x0fedcba9}));
+  EXPECT_EQ(sig_c, (std::vector<uint32_t>{0xffff, 0x1234, 0xa5a5}));
+}
+
+TEST(ReadWriteBitsVectorUint32Test, CFG_demux_bits_vec32_signals) {
+  // 1024 probes x 64 samples split into signals of assorted widths
+  const uint32_t words_per_line = 32;
+  const uint32_t depth = 64;
+  std::mt19937 rng(5678);
+  std::vector<uint32_t> data(words_per_line * depth);
+  for (auto &w : data) {
+    w = rng();
+  }
+  std::vector<uint32_t> bitpos{};
+  std::vector<uint32_t> bitwidth{};
+  for (uint32_t pos = 0, i = 0; pos < words_per_line * 32; i++) {
+    uint32_t width = std::min((i % 5 == 0) ? 45u : (i % 3) + 1,
+                              words_per_line * 32 - pos);
+    bitpos.push_back(pos);
+    bitwidth.push_back(width);
+    pos += width;
+  }
+
+  std::vector<std::vector<uint32_t>> expected{};
+  std::vector<std::vector<uint32_t>> values{};
+  std::vector<uint32_t *> outputs{};
+  for (auto width : bitwidth) {
+    expected.push_back(std::vector<uint32_t>(((width - 1) / 32 + 1) * depth));
+    values.push_back(std::vector<uint32_t>(((width - 1) / 32 + 1) * depth));
+    outputs.push_back(values.back().data());
+  }
+
+  for (size_t j = 0; j < bitwidth.size(); j++) {
+    uint32_t words = (bitwidth[j] - 1) / 32 + 1;
+    for (uint32_t i = 0; i < depth; i++) {
+      copy_bits_bitwise(&data[i * words_per_line], bitpos[j],
+                        &expected[j][i * words], 0, bitwidth[j]);
+    }
+  }
+  CFG_demux_bits_vec32(data.data(), words_per_line, depth, bitpos, bitwidth,
+                       outputs);
+  EXPECT_EQ(values, expected);
+}
+
 class ReverseByteOrderU32Test
     : public ::testing::TestWithParam<std::tuple<uint32_t, uint32_t>> {
  protected:
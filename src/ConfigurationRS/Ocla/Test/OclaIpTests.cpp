@@ -3,12 +3,15 @@
 
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <tuple>
 
 #include "OclaIP.h"
 #include "OclaJtagAdapter.h"
+#include "OclaRegisterShadow.h"
 
 using ::testing::_;
+using ::testing::AnyNumber;
 using ::testing::NiceMock;
 using ::testing::Return;
 
@@ -190,6 +193,153 @@ TEST_F(OclaIPTest, startTest) {
   oclaIP.start();
 }
 
+TEST_F(OclaIPTest, batchedConfigureTest) {
+  ::testing::MockFunction<void(std::string)> checkpoint;
+  ON_CALL(mockAdapter, read(OCSR)).WillByDefault(Return(1 << 24));
+  OclaIP oclaIP(&mockAdapter, 0);
+
+  ocla_config cfg;
+  cfg.mode = POST;
+  cfg.condition = OR;
+  cfg.sample_size = 0;
+
+  ocla_trigger_config trig_cfg;
+  trig_cfg.type = EDGE;
+  trig_cfg.event = RISING;
+  trig_cfg.probe_num = 5;
+  trig_cfg.value = 0;
+  trig_cfg.compare_width = 0;
+
+  {
+    ::testing::InSequence seq;
+    EXPECT_CALL(checkpoint, Call("flush"));
+    EXPECT_CALL(mockAdapter, write(TMTR, _));
+    EXPECT_CALL(mockAdapter, write(TSSR + 0x30, 5));
+    EXPECT_CALL(mockAdapter, write(TCUR + 0x30, _));
+    EXPECT_CALL(mockAdapter, write(TDCR + 0x30, _));
+    EXPECT_CALL(mockAdapter, write(OCCR, 0x0));
+    EXPECT_CALL(mockAdapter, write(OCCR, 0x1));
+  }
+
+  // writes are held back until the batch is flushed
+  mockAdapter.begin_transactions();
+  oclaIP.configure(cfg);
+  oclaIP.configure_channel(1, trig_cfg);
+  oclaIP.start();
+  checkpoint.Call("flush");
+  ASSERT_TRUE(mockAdapter.flush().empty());
+}
+
+TEST_F(OclaIPTest, transactionBatchUnwindTest) {
+  OclaIP oclaIP(&mockAdapter, 0);
+  EXPECT_CALL(mockAdapter, write(_, _)).Times(0);
+
+  // batch left by an exception is dropped, nothing is issued
+  try {
+    OclaTransactionBatch batch{&mockAdapter};
+    ASSERT_TRUE(batch.is_own_batch());
+    oclaIP.start();
+    throw std::runtime_error("error");
+  } catch (const std::runtime_error &) {
+  }
+  ASSERT_FALSE(mockAdapter.is_queuing());
+  ASSERT_TRUE(mockAdapter.flush().empty());
+
+  // batch that is joined is left to its owner
+  mockAdapter.begin_transactions();
+  {
+    OclaTransactionBatch batch{&mockAdapter};
+    ASSERT_FALSE(batch.is_own_batch());
+  }
+  ASSERT_TRUE(mockAdapter.is_queuing());
+  mockAdapter.cancel_transactions();
+  ASSERT_FALSE(mockAdapter.is_queuing());
+}
+
+TEST_F(OclaIPTest, registerShadowTest) {
+  OclaRegisterShadow shadow{};
+  ON_CALL(mockAdapter, read(0x100 + OCSR)).WillByDefault(Return(1 << 24));
+
+  // registers are read only once
+  EXPECT_CALL(mockAdapter, read(_)).Times(AnyNumber());
+  EXPECT_CALL(mockAdapter, read(0x100 + IP_TYPE)).Times(1);
+  EXPECT_CALL(mockAdapter, read(0x100 + TMTR)).Times(1);
+  EXPECT_CALL(mockAdapter, read(0x100 + TSSR + 0x30)).Times(1);
+  OclaIP oclaIP(&mockAdapter, 0x100, &shadow);
+  OclaIP oclaIP2(&mockAdapter, 0x100, &shadow);
+
+  ocla_config cfg;
+  cfg.mode = PRE;
+  cfg.condition = AND;
+  cfg.sample_size = 0;
+
+  // same value is written only once
+  EXPECT_CALL(mockAdapter, write(0x100 + TMTR, 0x5)).Times(1);
+  oclaIP.configure(cfg);
+  oclaIP2.configure(cfg);
+
+  // start is never skipped
+  EXPECT_CALL(mockAdapter, write(0x100 + OCCR, 0x0)).Times(2);
+  EXPECT_CALL(mockAdapter, write(0x100 + OCCR, 0x1)).Times(2);
+  oclaIP.start();
+  oclaIP.start();
+}
+
+TEST_F(OclaIPTest, registerShadowResetTest) {
+  OclaRegisterShadow shadow{};
+  EXPECT_CALL(mockAdapter, read(_)).Times(AnyNumber());
+  EXPECT_CALL(mockAdapter, read(IP_TYPE)).Times(2);
+  EXPECT_CALL(mockAdapter, read(TMTR)).Times(2);
+  OclaIP oclaIP(&mockAdapter, 0, &shadow);
+
+  ocla_config cfg;
+  cfg.mode = CENTER;
+  cfg.condition = DEFAULT;
+  cfg.sample_size = 0;
+
+  // reset invalidates the shadow
+  EXPECT_CALL(mockAdapter, write(OCCR, 0x2)).Times(1);
+  EXPECT_CALL(mockAdapter, write(TMTR, 0x3)).Times(2);
+  oclaIP.configure(cfg);
+  oclaIP.reset();
+  OclaIP oclaIP2(&mockAdapter, 0, &shadow);
+  oclaIP2.configure(cfg);
+}
+
+TEST_F(OclaIPTest, registerShadowStatusTest) {
+  OclaRegisterShadow shadow{};
+
+  // status register is read every time
+  EXPECT_CALL(mockAdapter, read(_)).Times(AnyNumber());
+  EXPECT_CALL(mockAdapter, read(0x100 + OCSR)).Times(2);
+  OclaIP oclaIP(&mockAdapter, 0x100, &shadow);
+  OclaIP oclaIP2(&mockAdapter, 0x100, &shadow);
+  uint32_t value = 0;
+  ASSERT_FALSE(shadow.lookup(0x100 + OCSR, value));
+}
+
+TEST_F(OclaIPTest, resetReadbackTest) {
+  OclaRegisterShadow shadow{};
+  ON_CALL(mockAdapter, read(OCSR)).WillByDefault(Return(1 << 24));
+  EXPECT_CALL(mockAdapter, read(_)).Times(AnyNumber());
+  EXPECT_CALL(mockAdapter, read(TMTR))
+      .WillOnce(Return((1u << 2) | 3u))
+      .WillOnce(Return(0));
+  EXPECT_CALL(mockAdapter, read(TSSR))
+      .WillOnce(Return(7))
+      .WillOnce(Return(0));
+  OclaIP oclaIP(&mockAdapter, 0, &shadow);
+  ASSERT_EQ(oclaIP.get_config().mode, CENTER);
+  ASSERT_EQ(oclaIP.get_config().condition, AND);
+  ASSERT_EQ(oclaIP.get_channel_config(0).probe_num, 7);
+
+  // configuration is read again from the ip after the reset
+  oclaIP.reset();
+  ASSERT_EQ(oclaIP.get_config().mode, CONTINUOUS);
+  ASSERT_EQ(oclaIP.get_config().condition, DEFAULT);
+  ASSERT_EQ(oclaIP.get_channel_config(0).probe_num, 0);
+}
+
 TEST_F(OclaIPTest, resetTest) {
   EXPECT_CALL(mockAdapter, write(OCCR, 0x2));
   OclaIP oclaIP(&mockAdapter, 0);
@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "OclaOpenocdAdapter.h"
+
+TEST(OclaOpenocdAdapterParseTest, parseTextTest) {
+  std::vector<jtag_read_result> values{};
+  OclaOpenocdAdapter::parse(
+      "Info : only one transport option; autoselect 'jtag'\n"
+      "0x00000010 DEADBEEF 00\n"
+      "0x00000014 deadbeef 01\n"
+      "0x00000018 DEADBEEF 00 \n"
+      "0x0000001C DEADBEEG 00\n"
+      "0x00000020 DEADBEEF 0\n"
+      "0x00000024 12345678 03",
+      values);
+  ASSERT_EQ(3, values.size());
+  ASSERT_EQ(0x10, values[0].address);
+  ASSERT_EQ(0xdeadbeef, values[0].data);
+  ASSERT_EQ(0, values[0].status);
+  ASSERT_EQ(0x14, values[1].address);
+  ASSERT_EQ(0xdeadbeef, values[1].data);
+  ASSERT_EQ(1, values[1].status);
+  ASSERT_EQ(0x24, values[2].address);
+  ASSERT_EQ(0x12345678, values[2].data);
+  ASSERT_EQ(3, values[2].status);
+  values.clear();
+  EXPECT_THROW(OclaOpenocdAdapter::parse("Error: no device found\n", values),
+               std::exception);
+}
+
+TEST(OclaOpenocdAdapterParseTest, parseHexBlobTest) {
+  std::vector<jtag_read_result> values{};
+  OclaOpenocdAdapter::parse(
+      "@0x00000028 3 0 1111111100aBcDeF0102FFFFFFFF03\n"
+      "@0x00000030 2 48 0000000100\n"
+      "@0x00000030 2 48 00000001000000000002\n"
+      "0x00000034 00000005 00\n",
+      values);
+  ASSERT_EQ(6, values.size());
+  ASSERT_EQ(0x28, values[0].address);
+  ASSERT_EQ(0x11111111, values[0].data);
+  ASSERT_EQ(0, values[0].status);
+  ASSERT_EQ(0x28, values[1].address);
+  ASSERT_EQ(0xabcdef01, values[1].data);
+  ASSERT_EQ(2, values[1].status);
+  ASSERT_EQ(0xffffffff, values[2].data);
+  ASSERT_EQ(3, values[2].status);
+  ASSERT_EQ(0x30, values[3].address);
+  ASSERT_EQ(1, values[3].data);
+  ASSERT_EQ(0x60, values[4].address);
+  ASSERT_EQ(0, values[4].data);
+  ASSERT_EQ(2, values[4].status);
+  ASSERT_EQ(0x34, values[5].address);
+  ASSERT_EQ(5, values[5].data);
+}
+
+TEST(OclaOpenocdAdapterParseTest, parseDumpTest) {
+  // synthetic openocd output of a 256 x 4 words TBDR dump in both formats
+  const uint32_t count = 256 * 4;
+  std::string text{};
+  std::string blob = "@0x00000028 " + std::to_string(count) + " 0 ";
+  char line[32];
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(line, sizeof(line), "0x00000028 %08X 00\n", i * 0x9E3779B9);
+    text += line;
+    snprintf(line, sizeof(line), "%08X00", i * 0x9E3779B9);
+    blob += line;
+  }
+  blob += "\n";
+
+  for (auto output : {&text, &blob}) {
+    std::vector<jtag_read_result> values{};
+    OclaOpenocdAdapter::parse(*output, values);
+    ASSERT_EQ(count, values.size());
+    for (uint32_t i = 0; i < count; i++) {
+      ASSERT_EQ(0x28, values[i].address);
+      ASSERT_EQ(i * 0x9E3779B9, values[i].data);
+      ASSERT_EQ(0, values[i].status);
+    }
+  }
+}
+
+#ifndef _WIN32
+
+#include <unistd.h>
+
+class OclaOpenocdAdapterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // fake openocd is a python script
+    if (std::system("python3 --version > /dev/null 2>&1") != 0) {
+      GTEST_SKIP() << "python3 is not available";
+    }
+    m_log = (std::filesystem::temp_directory_path() /
+             ("ocla_fake_openocd_" + std::to_string(getpid()) + ".log"))
+                .string();
+    std::remove(m_log.c_str());
+    setenv("OCLA_FAKE_OPENOCD_LOG", m_log.c_str(), 1);
+  }
+
+  void TearDown() override {
+    unsetenv("OCLA_FAKE_OPENOCD_LOG");
+    unsetenv("OCLA_FAKE_OPENOCD_HANG");
+    if (!m_log.empty()) {
+      std::remove(m_log.c_str());
+    }
+  }
+
+  uint32_t get_launch_count() {
+    std::ifstream file(m_log);
+    std::string line;
+    uint32_t count = 0;
+    while (std::getline(file, line)) {
+      count++;
+    }
+    return count;
+  }
+
+  std::string m_openocd = "python3 " OCLA_FAKE_OPENOCD;
+  std::string m_log{};
+};
+
+TEST_F(OclaOpenocdAdapterTest, oneProcessPerTransactionTest) {
+  OclaOpenocdAdapter adapter{m_openocd};
+  adapter.set_target_device(FOEDAG::Device{}, {});
+  adapter.write(0x100, 0x12345678);
+  auto result = adapter.read(0x100, 2, 4);
+  ASSERT_FALSE(adapter.is_session_active());
+  ASSERT_EQ(2, get_launch_count());
+  ASSERT_EQ(2, result.size());
+  // nothing persists across openocd processes
+  ASSERT_EQ(0x100, result[0].address);
+  ASSERT_EQ(0, result[0].data);
+  ASSERT_EQ(0x104, result[1].address);
+  // one text line per word
+  adapter.set_hex_blob_mode(false);
+  result = adapter.read(0x100, 3, 4);
+  ASSERT_EQ(3, get_launch_count());
+  ASSERT_EQ(3, result.size());
+  ASSERT_EQ(0x108, result[2].address);
+}
+
+TEST_F(OclaOpenocdAdapterTest, persistentSessionTest) {
+  OclaOpenocdAdapter adapter{m_openocd};
+  adapter.set_target_device(FOEDAG::Device{}, {});
+  adapter.set_session_mode(true);
+  for (uint32_t i = 0; i < 8; i++) {
+    adapter.write(0x200 + i * 4, 0xa0000000 + i);
+  }
+  ASSERT_TRUE(adapter.is_session_active());
+  auto result = adapter.read(0x200, 8, 4);
+  ASSERT_EQ(8, result.size());
+  for (uint32_t i = 0; i < 8; i++) {
+    ASSERT_EQ(0x200 + i * 4, result[i].address);
+    ASSERT_EQ(0xa0000000 + i, result[i].data);
+    ASSERT_EQ(0, result[i].status);
+  }
+  ASSERT_EQ(0xa0000003, adapter.read(0x20c));
+  adapter.stop_session();
+  ASSERT_FALSE(adapter.is_session_active());
+  ASSERT_EQ(1, get_launch_count());
+}
+
+TEST_F(OclaOpenocdAdapterTest, flushTransactionsTest) {
+  OclaOpenocdAdapter adapter{m_openocd};
+  adapter.set_target_device(FOEDAG::Device{}, {});
+  adapter.begin_transactions();
+  for (uint32_t i = 0; i < 32; i++) {
+    adapter.queue_write(0x30 + i * 0x30, i);
+    adapter.queue_write(0x34 + i * 0x30, i + 1);
+    adapter.queue_write(0x38 + i * 0x30, i + 2);
+  }
+  adapter.queue_read(0x30, 4, 0x30);
+  adapter.queue_write(0x24, 0xabcd);
+  adapter.queue_read(0x24);
+  ASSERT_TRUE(adapter.is_queuing());
+  auto result = adapter.flush();
+  ASSERT_FALSE(adapter.is_queuing());
+  // whole batch is issued by one openocd process
+  ASSERT_EQ(1, get_launch_count());
+  ASSERT_EQ(5, result.size());
+  for (uint32_t i = 0; i < 4; i++) {
+    ASSERT_EQ(0x30 + i * 0x30, result[i].address);
+    ASSERT_EQ(i, result[i].data);
+  }
+  ASSERT_EQ(0x24, result[4].address);
+  ASSERT_EQ(0xabcd, result[4].data);
+  ASSERT_TRUE(adapter.flush().empty());
+  ASSERT_EQ(1, get_launch_count());
+}
+
+TEST_F(OclaOpenocdAdapterTest, sessionRestartOnNewTargetTest) {
+  OclaOpenocdAdapter adapter{m_openocd};
+  adapter.set_target_device(FOEDAG::Device{}, {});
+  adapter.set_session_mode(true);
+  adapter.write(0x10, 0x1);
+  adapter.set_target_device(FOEDAG::Device{}, {});
+  ASSERT_FALSE(adapter.is_session_active());
+  ASSERT_EQ(0, adapter.read(0x10));
+  ASSERT_TRUE(adapter.is_session_active());
+  adapter.set_session_mode(false);
+  ASSERT_EQ(2, get_launch_count());
+}
+
+TEST_F(OclaOpenocdAdapterTest, sessionTimeoutFallbackTest) {
+  setenv("OCLA_FAKE_OPENOCD_HANG", "0x300", 1);
+  OclaOpenocdAdapter adapter{m_openocd};
+  adapter.set_target_device(FOEDAG::Device{}, {});
+  adapter.set_session_mode(true);
+  adapter.set_session_timeout(200);
+  adapter.write(0x300, 0x5);
+  ASSERT_FALSE(adapter.is_session_active());
+  // the write is issued again by its own process, and so is every
+  // transaction after it
+  ASSERT_EQ(2, get_launch_count());
+  ASSERT_EQ(0, adapter.read(0x10));
+  ASSERT_FALSE(adapter.is_session_active());
+  ASSERT_EQ(3, get_launch_count());
+}
+
+#endif
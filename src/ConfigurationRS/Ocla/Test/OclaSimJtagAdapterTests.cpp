@@ -0,0 +1,364 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+
+#include "CFGObject/CFGObject_auto.h"
+#include "EioIP.h"
+#include "Ocla.h"
+#include "OclaIP.h"
+#include "OclaMultiCapture.h"
+#include "OclaSimJtagAdapter.h"
+
+class OclaSimJtagAdapterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    adapter.add_ocla(0x1000, 64, 256, 4, 0x1234, 0x10);
+    adapter.add_eio(0x2000, 0x5678, 0x20);
+  }
+
+  void TearDown() override {}
+
+  // debug info of the simulated ocla: two 32 bits signals on one probe
+  bool write_debug_info(const std::string &bitasm) {
+    CFGObject_BITOBJ bitobj;
+    bitobj.write_str("version", "Raptor 1.0");
+    bitobj.write_str("project", "ocla_sim_test");
+    bitobj.write_str("device", "sim");
+    bitobj.write_str("time", "now");
+    bitobj.configuration.write_str("family", "sim");
+    bitobj.configuration.write_str("series", "sim");
+    bitobj.configuration.write_str("protocol", "sim");
+    bitobj.configuration.write_str("blwl", "sim");
+    bitobj.write_str(
+        "ocla",
+        "{\"ocla_debug_subsystem\": {\"Sampling_Clk\": \"SINGLE\", "
+        "\"Probes_Sum\": 64}, \"ocla\": [{\"INDEX\": 1, "
+        "\"IP_TYPE\": \"ocla\", \"IP_VERSION\": 16, \"IP_ID\": 4660, "
+        "\"MEM_DEPTH\": 256, \"NO_OF_PROBES\": 64, \"addr\": 4096, "
+        "\"probes\": [\"count[31:0]\", \"cycle[31:0]\"], "
+        "\"probe_info\": [{\"index\": 0, \"offset\": 0, "
+        "\"width\": 64}]}]}");
+    return bitobj.write(bitasm);
+  }
+
+  void set_trigger(OclaIP &ip, ocla_trigger_type type,
+                   ocla_trigger_event event, uint32_t probe_num,
+                   uint32_t value = 0, uint32_t compare_width = 0) {
+    ocla_trigger_config cfg{};
+    cfg.type = type;
+    cfg.event = event;
+    cfg.probe_num = probe_num;
+    cfg.value = value;
+    cfg.compare_width = compare_width;
+    ip.configure_channel(0, cfg);
+  }
+
+  OclaSimJtagAdapter adapter;
+};
+
+TEST_F(OclaSimJtagAdapterTest, registerMapTest) {
+  OclaIP ocla_ip{&adapter, 0x1000};
+  ASSERT_EQ("ocla", ocla_ip.get_type());
+  ASSERT_EQ(0x1234, ocla_ip.get_id());
+  ASSERT_EQ(0x10, ocla_ip.get_version());
+  ASSERT_EQ(64, ocla_ip.get_number_of_probes());
+  ASSERT_EQ(256, ocla_ip.get_memory_depth());
+  ASSERT_EQ(4, ocla_ip.get_trigger_count());
+  ASSERT_EQ(32, ocla_ip.get_max_compare_value_size());
+  ASSERT_EQ(NA, ocla_ip.get_status());
+
+  EioIP eio{&adapter, 0x2000};
+  ASSERT_EQ("EIO", eio.get_type());
+  ASSERT_EQ(0x5678, eio.get_id());
+  ASSERT_EQ(0x20, eio.get_version());
+
+  // nothing is mapped at the address
+  ASSERT_EQ(0, adapter.read(0x3000));
+}
+
+TEST_F(OclaSimJtagAdapterTest, continuousCaptureTest) {
+  OclaIP ocla_ip{&adapter, 0x1000};
+  ocla_config cfg{CONTINUOUS, DEFAULT, 16};
+  ocla_ip.configure(cfg);
+  ocla_ip.start();
+  ASSERT_EQ(DATA_AVAILABLE, ocla_ip.get_status());
+  auto data = ocla_ip.get_data();
+  ASSERT_EQ(16, data.depth);
+  ASSERT_EQ(2, data.words_per_line);
+  ASSERT_EQ(32, data.values.size());
+  // default stimulus is a free running counter
+  for (uint32_t i = 0; i < 16; i++) {
+    ASSERT_EQ(i, data.values[i * 2]);
+    ASSERT_EQ(i, data.values[i * 2 + 1]);
+  }
+  // next capture continues where the previous one stopped
+  ocla_ip.start();
+  data = ocla_ip.get_data();
+  ASSERT_EQ(16, data.values[0]);
+}
+
+TEST_F(OclaSimJtagAdapterTest, edgeTriggerTest) {
+  // probe 3 rises at cycle 100
+  adapter.set_stimulus(
+      [](uint32_t base_addr, uint64_t cycle, std::vector<uint32_t> &words) {
+        words[0] = (uint32_t)cycle << 8 | (cycle >= 100 ? 0x8 : 0);
+        words[1] = (uint32_t)cycle;
+      });
+  OclaIP ocla_ip{&adapter, 0x1000};
+
+  ocla_config cfg{POST, DEFAULT, 8};
+  ocla_ip.configure(cfg);
+  set_trigger(ocla_ip, EDGE, RISING, 3);
+  ocla_ip.start();
+  ASSERT_EQ(DATA_AVAILABLE, ocla_ip.get_status());
+  auto data = ocla_ip.get_data();
+  ASSERT_EQ(16, data.values.size());
+  ASSERT_EQ(100, data.values[1]);
+  ASSERT_EQ(107, data.values[15]);
+
+  ocla_ip.reset();
+  ocla_ip = OclaIP{&adapter, 0x1000};
+  cfg = ocla_config{PRE, DEFAULT, 8};
+  ocla_ip.configure(cfg);
+  set_trigger(ocla_ip, LEVEL, LOW, 3);
+  adapter.set_max_cycles(1000);
+  ocla_ip.start();
+  // probe 3 is already high, so the level trigger never fires
+  ASSERT_EQ(NA, ocla_ip.get_status());
+}
+
+TEST_F(OclaSimJtagAdapterTest, valueCompareTriggerTest) {
+  OclaIP ocla_ip{&adapter, 0x1000};
+
+  // counter bits [11:4] equal to 0x12 first happens at cycle 0x120
+  ocla_config cfg{CENTER, DEFAULT, 32};
+  ocla_ip.configure(cfg);
+  set_trigger(ocla_ip, VALUE_COMPARE, EQUAL, 4, 0x12, 8);
+  ocla_ip.start();
+  ASSERT_EQ(DATA_AVAILABLE, ocla_ip.get_status());
+  auto data = ocla_ip.get_data();
+  ASSERT_EQ(0x120 - 16, data.values[0]);
+  ASSERT_EQ(0x120, data.values[32]);
+}
+
+TEST_F(OclaSimJtagAdapterTest, captureStateTest) {
+  OclaIP ocla_ip{&adapter, 0x1000};
+  ocla_config cfg{CONTINUOUS, DEFAULT, 0};
+  adapter.set_capture_polls(3);
+  ASSERT_EQ(NA, ocla_ip.get_status());
+  ocla_ip.configure(cfg);
+  ocla_ip.start();
+  // sampling until the third status read
+  ASSERT_EQ(NA, ocla_ip.get_status());
+  ASSERT_EQ(NA, ocla_ip.get_status());
+  ASSERT_EQ(DATA_AVAILABLE, ocla_ip.get_status());
+  ASSERT_EQ(DATA_AVAILABLE, ocla_ip.get_status());
+  // whole memory is captured when the sample size is not fixed
+  ASSERT_EQ(256 * 2, ocla_ip.get_data().values.size());
+  // next start goes back to sampling
+  ocla_ip.start();
+  ASSERT_EQ(NA, ocla_ip.get_status());
+  // reset stops the sampling
+  ocla_ip.reset();
+  ASSERT_EQ(NA, ocla_ip.get_status());
+  ASSERT_EQ(NA, ocla_ip.get_status());
+}
+
+TEST_F(OclaSimJtagAdapterTest, eioTest) {
+  EioIP eio{&adapter, 0x2000};
+  eio.write_output_bits({0x11223344, 0x55667788}, 2);
+  auto values = eio.readback_output_bits(2);
+  ASSERT_EQ(PROBE_OUT, eio.get_prs_mode());
+  ASSERT_EQ(0x11223344, values[0]);
+  ASSERT_EQ(0x55667788, values[1]);
+  // input probes are looped back from the output probes without stimulus
+  values = eio.read_input_bits(2);
+  ASSERT_EQ(PROBE_IN, eio.get_prs_mode());
+  ASSERT_EQ(0x11223344, values[0]);
+
+  adapter.set_stimulus(
+      [](uint32_t base_addr, uint64_t cycle, std::vector<uint32_t> &words) {
+        words[0] = base_addr;
+        words[1] = 0xabcd;
+      });
+  values = eio.read_input_bits(2);
+  ASSERT_EQ(0x2000, values[0]);
+  ASSERT_EQ(0xabcd, values[1]);
+}
+
+TEST_F(OclaSimJtagAdapterTest, roundTripCountTest) {
+  // JTAG round trips of a full capture
+  uint64_t round_trips = adapter.get_round_trip_count();
+
+  OclaIP ocla_ip{&adapter, 0x1000};
+  ocla_config cfg{POST, OR, 0};
+  ocla_ip.configure(cfg);
+  set_trigger(ocla_ip, EDGE, EITHER, 0);
+  adapter.set_capture_polls(2);
+  ocla_ip.start();
+  ASSERT_EQ(NA, ocla_ip.get_status());
+  ASSERT_EQ(DATA_AVAILABLE, ocla_ip.get_status());
+  auto data = ocla_ip.get_data();
+  ASSERT_EQ(256 * 2, data.values.size());
+
+  round_trips = adapter.get_round_trip_count() - round_trips;
+  ASSERT_LE(round_trips, 10);
+}
+
+TEST_F(OclaSimJtagAdapterTest, chunkedReadDataTest) {
+  OclaIP ocla_ip{&adapter, 0x1000};
+  ocla_config cfg{CONTINUOUS, DEFAULT, 100};
+  ocla_ip.configure(cfg);
+  ocla_ip.start();
+  auto data = ocla_ip.get_data_info();
+  ASSERT_EQ(100, data.depth);
+  ASSERT_TRUE(data.values.empty());
+
+  // TBDR continues from where the previous chunk stopped
+  std::vector<uint32_t> values{};
+  for (uint32_t line = 0; line < data.depth; line += 32) {
+    ocla_ip.read_data(data, std::min(32u, data.depth - line));
+    values.insert(values.end(), data.values.begin(), data.values.end());
+  }
+  ASSERT_EQ(200, values.size());
+  for (uint32_t i = 0; i < 100; i++) {
+    ASSERT_EQ(i, values[i * 2]);
+  }
+}
+
+TEST_F(OclaSimJtagAdapterTest, waitForDataTest) {
+  OclaIP ocla_ip{&adapter, 0x1000};
+  ocla_config cfg{CONTINUOUS, DEFAULT, 16};
+  adapter.set_capture_polls(4);
+  ocla_ip.configure(cfg);
+  ocla_ip.start();
+
+  // data is noticed by the poll that follows it becoming available, the
+  // callback is called between the polls
+  uint64_t round_trips = adapter.get_round_trip_count();
+  uint32_t calls = 0;
+  ASSERT_EQ(DATA_AVAILABLE, ocla_ip.wait_for_data(60000, [&](uint32_t) {
+    calls++;
+    return true;
+  }));
+  ASSERT_EQ(3, calls);
+  ASSERT_EQ(4, adapter.get_round_trip_count() - round_trips);
+}
+
+TEST_F(OclaSimJtagAdapterTest, waitForDataTimeoutTest) {
+  OclaIP ocla_ip{&adapter, 0x1000};
+  ocla_config cfg{CONTINUOUS, DEFAULT, 16};
+  adapter.set_capture_time_ms(60000);
+  ocla_ip.configure(cfg);
+  ocla_ip.start();
+  ASSERT_EQ(NA, ocla_ip.wait_for_data(30));
+
+  // callback is called between the polls and can cancel the wait
+  uint32_t calls = 0;
+  ASSERT_EQ(NA, ocla_ip.wait_for_data(60000, [&](uint32_t elapsed_ms) {
+    return ++calls < 3;
+  }));
+  ASSERT_EQ(3, calls);
+}
+
+TEST_F(OclaSimJtagAdapterTest, oclaCaptureFlowTest) {
+  std::string bitasm = "ocla_sim_test.bitasm";
+  std::string fst = "ocla_sim_test.fst";
+  ASSERT_TRUE(write_debug_info(bitasm));
+  std::remove(fst.c_str());
+
+  // start, wait and write the waveform like the debugger commands do
+  Ocla ocla{&adapter};
+  ocla.start_session(bitasm);
+  ocla.configure(1, "post-trigger", "or", 16);
+  ocla.add_trigger(1, 1, "count[4]", "edge", "rising", 0, 0);
+  ASSERT_TRUE(ocla.start(1));
+  uint32_t status = 0;
+  ASSERT_TRUE(ocla.wait(1, 5000, status));
+  ASSERT_EQ(DATA_AVAILABLE, status);
+  ASSERT_TRUE(ocla.write_waveform(1, fst, 4));
+  ASSERT_TRUE(std::filesystem::exists(fst));
+  ASSERT_GT(std::filesystem::file_size(fst), 0);
+
+  // next capture continues the counter, bit 4 rises again at 0x30
+  ASSERT_TRUE(ocla.start(1));
+  ASSERT_TRUE(ocla.wait(1, 5000, status));
+  ASSERT_EQ(DATA_AVAILABLE, status);
+  oc_waveform_t waveform{};
+  ASSERT_TRUE(ocla.get_waveform(1, waveform));
+  ASSERT_EQ(1, waveform.probes.size());
+  auto &signals = waveform.probes[0].signal_list;
+  ASSERT_EQ(2, signals.size());
+  ASSERT_EQ("count", signals[0].name);
+  ASSERT_EQ(16, signals[0].depth);
+  ASSERT_EQ(16, signals[1].values.size());
+  for (uint32_t i = 0; i < 16; i++) {
+    ASSERT_EQ(0x30 + i, signals[0].values[i]);
+    ASSERT_EQ(0x30 + i, signals[1].values[i]);
+  }
+
+  ocla.stop_session();
+  std::remove(bitasm.c_str());
+  std::remove(fst.c_str());
+}
+
+TEST_F(OclaSimJtagAdapterTest, multiCaptureTest) {
+  std::string bitasm = "ocla_sim_multi_test.bitasm";
+  std::vector<std::string> fst{"ocla_sim_multi_a.fst", "ocla_sim_multi_b.fst",
+                               "ocla_sim_multi_c.fst"};
+  ASSERT_TRUE(write_debug_info(bitasm));
+  for (auto &f : fst) {
+    std::remove(f.c_str());
+  }
+
+  // target a triggers, the trigger probe of target b never rises and the
+  // stimulus of target c throws when the capture is started
+  OclaSimJtagAdapter adapter_b{};
+  OclaSimJtagAdapter adapter_c{};
+  adapter_b.add_ocla(0x1000, 64, 256, 4, 0x1234, 0x10);
+  adapter_b.set_max_cycles(1000);
+  adapter_b.set_stimulus(
+      [](uint32_t base_addr, uint64_t cycle, std::vector<uint32_t> &words) {
+        words[0] = 0;
+        words[1] = (uint32_t)cycle;
+      });
+  adapter_c.add_ocla(0x1000, 64, 256, 4, 0x1234, 0x10);
+  adapter_c.set_stimulus(
+      [](uint32_t base_addr, uint64_t cycle, std::vector<uint32_t> &words) {
+        throw std::runtime_error("cable disconnected");
+      });
+
+  Ocla ocla{&adapter};
+  ocla.start_session(bitasm);
+  ocla.configure(1, "post-trigger", "or", 16);
+  ocla.add_trigger(1, 1, "count[4]", "edge", "rising", 0, 0);
+
+  OclaMultiCapture capture{{{"a", &adapter, 1, fst[0]},
+                            {"b", &adapter_b, 1, fst[1]},
+                            {"c", &adapter_c, 1, fst[2]}}};
+  ASSERT_FALSE(capture.run(50));
+  auto &results = capture.get_results();
+  ASSERT_EQ(3, results.size());
+  ASSERT_EQ(CAPTURE_DONE, results[0].state);
+  ASSERT_EQ(CAPTURE_TIMEOUT, results[1].state);
+  ASSERT_EQ(CAPTURE_FAILED, results[2].state);
+  ASSERT_TRUE(std::filesystem::exists(fst[0]));
+  ASSERT_GT(std::filesystem::file_size(fst[0]), 0);
+  ASSERT_FALSE(std::filesystem::exists(fst[1]));
+  ASSERT_FALSE(std::filesystem::exists(fst[2]));
+
+  // the captures worked on their own copy of the session, the shared one is
+  // still loaded and usable
+  ASSERT_TRUE(ocla.start(1));
+  uint32_t status = 0;
+  ASSERT_TRUE(ocla.wait(1, 5000, status));
+  ASSERT_EQ(DATA_AVAILABLE, status);
+
+  ocla.stop_session();
+  std::remove(bitasm.c_str());
+  for (auto &f : fst) {
+    std::remove(f.c_str());
+  }
+}
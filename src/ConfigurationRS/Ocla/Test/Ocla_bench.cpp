@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ConfigurationRS/CFGCommonRS/CFGCommonRS.h"
+#include "OclaHelpers.h"
+#include "OclaOpenocdAdapter.h"
+
+void bench_parse() {
+  // synthetic openocd output of a 32K x 4 words TBDR dump
+  const uint32_t count = 32 * 1024 * 4;
+  std::string text{};
+  std::string blob = "@0x00000028 " + std::to_string(count) + " 0 ";
+  char line[32];
+  for (uint32_t i = 0; i < count; i++) {
+    snprintf(line, sizeof(line), "0x00000028 %08X 00\n", i * 0x9E3779B9);
+    text += line;
+    snprintf(line, sizeof(line), "%08X00", i * 0x9E3779B9);
+    blob += line;
+  }
+  blob += "\n";
+
+  for (auto output : {&text, &blob}) {
+    std::vector<jtag_read_result> values{};
+    values.reserve(count);
+    auto begin = std::chrono::steady_clock::now();
+    OclaOpenocdAdapter::parse(*output, values);
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - begin)
+                         .count();
+    CFG_ASSERT(values.size() == count);
+    for (uint32_t i = 0; i < count; i++) {
+      CFG_ASSERT(values[i].data == i * 0x9E3779B9);
+    }
+    CFG_POST_MSG("%s format: %d words (%ld bytes) parsed in %.3f ms, %.1f MB/s",
+                 output == &text ? "text" : "blob", count, output->size(),
+                 elapsed * 1000, output->size() / elapsed / (1024 * 1024));
+  }
+}
+
+void bench_demux() {
+  // 1024 probes x 4K samples split into signals of assorted widths
+  const uint32_t words_per_line = 32;
+  const uint32_t depth = 4096;
+  std::mt19937 rng(5678);
+  std::vector<uint32_t> data(words_per_line * depth);
+  for (auto &w : data) {
+    w = rng();
+  }
+  std::vector<uint32_t> bitpos{};
+  std::vector<uint32_t> bitwidth{};
+  for (uint32_t pos = 0, i = 0; pos < words_per_line * 32; i++) {
+    uint32_t width = std::min((i % 5 == 0) ? 45u : (i % 3) + 1,
+                              words_per_line * 32 - pos);
+    bitpos.push_back(pos);
+    bitwidth.push_back(width);
+    pos += width;
+  }
+
+  std::vector<std::vector<uint32_t>> expected{};
+  std::vector<std::vector<uint32_t>> values{};
+  std::vector<uint32_t *> outputs{};
+  for (auto width : bitwidth) {
+    expected.push_back(std::vector<uint32_t>(((width - 1) / 32 + 1) * depth));
+    values.push_back(std::vector<uint32_t>(((width - 1) / 32 + 1) * depth));
+    outputs.push_back(values.back().data());
+  }
+
+  // one bit at a time as reference
+  auto begin = std::chrono::steady_clock::now();
+  for (size_t j = 0; j < bitwidth.size(); j++) {
+    uint32_t words = (bitwidth[j] - 1) / 32 + 1;
+    for (uint32_t i = 0; i < depth; i++) {
+      for (uint32_t k = 0; k < bitwidth[j]; k++) {
+        CFG_write_bit_vec32(
+            &expected[j][i * words], k,
+            CFG_read_bit_vec32(&data[i * words_per_line], bitpos[j] + k));
+      }
+    }
+  }
+  double bitwise = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin)
+                       .count();
+
+  begin = std::chrono::steady_clock::now();
+  CFG_demux_bits_vec32(data.data(), words_per_line, depth, bitpos, bitwidth,
+                       outputs);
+  double demux = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count();
+
+  CFG_ASSERT(values == expected);
+  CFG_POST_MSG("%ld signals x %d samples: bitwise copy %.3f ms, word demux "
+               "%.3f ms",
+               bitwidth.size(), depth, bitwise * 1000, demux * 1000);
+}
+
+int main(int argc, const char **argv) {
+  CFG_POST_MSG("This is OCLA benchmark");
+  bench_parse();
+  bench_demux();
+  return 0;
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+#
+# Minimal stand-in of openocd for OclaOpenocdAdapter unit tests
+#
+#   - understands the ocla_read/ocla_read_blob/ocla_write procs issued by
+#     the adapter
+#   - registers are kept in memory for the lifetime of the process
+#   - with "-c tcl_port <n>", serves the openocd tcl rpc protocol on <n>
+#   - otherwise executes the -c commands once and exits
+#   - every launch is appended to $OCLA_FAKE_OPENOCD_LOG (if defined)
+#   - in tcl rpc mode, never answers a command that accesses the address in
+#     $OCLA_FAKE_OPENOCD_HANG (if defined)
+#
+import os
+import re
+import socket
+import sys
+
+registers = {}
+
+
+def ocla_write(addr, data):
+    registers[addr] = data
+    return "0x%08X %08X 00\n" % (addr, data)
+
+
+def ocla_read(addr, n, c):
+    out = ""
+    for i in range(n):
+        out += "0x%08X %08X 00\n" % (addr, registers.get(addr, 0))
+        addr += c
+    return out
+
+
+def ocla_read_blob(addr, n, c):
+    out = "@0x%08X %d %d " % (addr, n, c)
+    for i in range(n):
+        out += "%08X00" % registers.get(addr, 0)
+        addr += c
+    return out + "\n"
+
+
+def evaluate(cmd):
+    out = ""
+    if cmd.startswith("proc"):
+        return out
+    # transactions are evaluated in the order they appear in the script
+    pattern = r"\bocla_(write|read_blob|read) (\w+) (\w+)(?: (\w+))?"
+    for m in re.finditer(pattern, cmd):
+        addr = int(m.group(2), 0)
+        if m.group(1) == "write":
+            out += ocla_write(addr, int(m.group(3), 0))
+        elif m.group(1) == "read_blob":
+            out += ocla_read_blob(addr, int(m.group(3)), int(m.group(4)))
+        else:
+            out += ocla_read(addr, int(m.group(3)), int(m.group(4)))
+    return out
+
+
+def hangs(cmd):
+    hang = os.environ.get("OCLA_FAKE_OPENOCD_HANG")
+    if not hang or cmd.startswith("proc"):
+        return False
+    pattern = r"\bocla_(?:write|read_blob|read) (\w+)"
+    for m in re.finditer(pattern, cmd):
+        if int(m.group(1), 0) == int(hang, 0):
+            return True
+    return False
+
+
+def serve(port):
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("127.0.0.1", port))
+    server.listen(1)
+    conn, _ = server.accept()
+    buffer = b""
+    while True:
+        data = conn.recv(4096)
+        if not data:
+            break
+        buffer += data
+        while b"\x1a" in buffer:
+            cmd, buffer = buffer.split(b"\x1a", 1)
+            cmd = cmd.decode()
+            if cmd == "shutdown":
+                conn.sendall(b"shutdown command invoked\x1a")
+                conn.close()
+                server.close()
+                return
+            if hangs(cmd):
+                continue
+            result = evaluate(cmd)
+            if cmd.startswith("format"):
+                # emulate catch wrapper: "<status>\n<result>"
+                result = "0\n" + result
+            conn.sendall(result.encode() + b"\x1a")
+    conn.close()
+    server.close()
+
+
+def main():
+    log = os.environ.get("OCLA_FAKE_OPENOCD_LOG")
+    if log:
+        with open(log, "a") as f:
+            f.write(" ".join(sys.argv[1:]) + "\n")
+    commands = [
+        sys.argv[i + 1] for i in range(1, len(sys.argv) - 1) if sys.argv[i] == "-c"
+    ]
+    for cmd in commands:
+        m = re.match(r"tcl_port (\d+)", cmd)
+        if m:
+            serve(int(m.group(1)))
+            return 0
+    for cmd in commands:
+        sys.stdout.write(evaluate(cmd))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())